@@ -0,0 +1,508 @@
+/* ***************************************************************************
+ *
+ * @file bench_opacity.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief A micro-benchmark for the opacity backends.
+ *
+ * @details
+ *
+ * Usage: bench_opacity [n_samples] [2d_table]
+ *
+ * Three sets of n_samples (logT, logR) points are generated for each family
+ * of backends: uniform over the table, clustered along the T-rho track of an
+ * accretion disc atmosphere, like the example simulations, and within a
+ * fraction EDGE_WIDTH of the edges of the table. Points where the Opal tables
+ * have no data are discarded, so every backend can be used for every point.
+ *
+ * The Opal backends are the original Fortran routine opacgn93, the C port of
+ * it, and the fixed composition slice, which falls back to the C port near the
+ * edge of the tables, as it does in a simulation. These are compared against
+ * opacgn93. The 2D backends, which are only benchmarked if the name of a 2D
+ * table is given, are bilinear and bicubic interpolation for a single point,
+ * and the batched kernels supported by the CPU. Bilinear interpolation is
+ * compared against bicubic interpolation, and each batched kernel against the
+ * single point interpolation of the same type.
+ *
+ * The number of lookups per second and the maximum and RMS error in
+ * log(kappa) against the reference backend are printed, and also written to
+ * bench_opacity.csv. The Opal tables, GN93hz, are required to be in the
+ * working directory.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/gsl_interp.h"
+#include "../src/interp_2d.h"
+#include "../src/opac_batch.h"
+#include "../src/opal.h"
+#include "../src/snake.h"
+
+#define N_SAMPLES_DEFAULT 100000
+#define MIN_BENCH_TIME 0.2
+#define EDGE_WIDTH 0.01
+#define OP_NO_DATA 9.0
+#define BENCH_X 0.70
+#define BENCH_Z 0.02
+
+/*
+ * The sets of sample points
+ */
+
+enum SAMPLE_SETS
+{
+  SAMPLES_UNIFORM,
+  SAMPLES_CLUSTERED,
+  SAMPLES_EDGE,
+  N_SAMPLE_SETS
+};
+
+char *sample_set_names[N_SAMPLE_SETS] = {"uniform", "clustered", "edge"};
+
+/*
+ * A set of sample points, where T and rho are the temperature and density
+ * for logT and logR, for the batched kernels
+ */
+
+typedef struct Samples
+{
+  int n;
+  double *logT, *logR;
+  double *T, *rho;
+} Samples;
+
+/*
+ * A backend to benchmark. lookup finds log(kappa) for every sample point, and
+ * reference is the index of the backend it is compared against, or -1 if it is
+ * the reference itself
+ */
+
+typedef struct Backend
+{
+  char name[LINE_LEN];
+  void (*lookup) (const Samples *samples, double *logk);
+  int reference;
+  int interp_type;
+  OpacKernel kernel;
+} Backend;
+
+/*
+ * The interpolators for the 2D table, and the backend currently being run so
+ * the batched kernels know which interpolator and kernel to use
+ */
+
+Interp2D bilinear, bicubic;
+Backend *current_backend;
+
+unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+// A xorshift64* random number in [0, 1), so the samples are the same each run
+double
+random_uniform (void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (double) ((rng_state * 0x2545f4914f6cdd1dULL) >> 11) / 9007199254740992.0;
+}
+
+// A normally distributed random number with zero mean and unit variance
+double
+random_normal (void)
+{
+  double u = random_uniform ();
+
+  while (u == 0.0)
+    u = random_uniform ();
+
+  return sqrt (-2.0 * log (u)) * cos (2.0 * M_PI * random_uniform ());
+}
+
+// Generate a single point of a sample set within logT_min <= logT <= logT_max
+// and logR_min <= logR <= logR_max
+void
+random_point (int set, double logT_min, double logT_max, double logR_min, double logR_max, double *logT,
+              double *logR)
+{
+  int edge;
+  double u, width;
+
+  switch (set)
+  {
+  case SAMPLES_CLUSTERED:
+    u = random_uniform ();
+    *logT = 4.0 + 1.0 * u + 0.05 * random_normal ();
+    *logR = -6.0 + 3.0 * u + 0.3 * random_normal ();
+    break;
+  case SAMPLES_EDGE:
+    edge = (int) (4.0 * random_uniform ());
+    *logT = logT_min + (logT_max - logT_min) * random_uniform ();
+    *logR = logR_min + (logR_max - logR_min) * random_uniform ();
+    width = EDGE_WIDTH * random_uniform ();
+    if (edge == 0)
+      *logT = logT_min + width * (logT_max - logT_min);
+    else if (edge == 1)
+      *logT = logT_max - width * (logT_max - logT_min);
+    else if (edge == 2)
+      *logR = logR_min + width * (logR_max - logR_min);
+    else
+      *logR = logR_max - width * (logR_max - logR_min);
+    break;
+  default:
+    *logT = logT_min + (logT_max - logT_min) * random_uniform ();
+    *logR = logR_min + (logR_max - logR_min) * random_uniform ();
+    break;
+  }
+}
+
+// Check if the Opal tables have data for a point
+int
+opal_has_data (double logT, double logR)
+{
+  OpalState state;
+  OpalOpacity opacity;
+
+  return opal_opacity (opal_tables, &state, BENCH_Z, BENCH_X, pow (10.0, logT - 6.0), pow (10.0, logR),
+                       &opacity) == OPAL_OK && opacity.opact <= OP_NO_DATA;
+}
+
+// Generate n points of a sample set within the table. If opal is TRUE, then
+// points where the Opal tables have no data are discarded
+void
+generate_samples (Samples *samples, int n, int set, double logT_min, double logT_max, double logR_min,
+                  double logR_max, int opal)
+{
+  int i = 0;
+  long n_tries = 0;
+  double logT, logR;
+
+  samples->logT = malloc (n * sizeof (*samples->logT));
+  samples->logR = malloc (n * sizeof (*samples->logR));
+  samples->T = malloc (n * sizeof (*samples->T));
+  samples->rho = malloc (n * sizeof (*samples->rho));
+  if (!samples->logT || !samples->logR || !samples->T || !samples->rho)
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for samples\n");
+
+  while (i < n && n_tries++ < 100L * n)
+  {
+    random_point (set, logT_min, logT_max, logR_min, logR_max, &logT, &logR);
+    if (logT < logT_min || logT > logT_max || logR < logR_min || logR > logR_max)
+      continue;
+    if (opal && !opal_has_data (logT, logR))
+      continue;
+
+    samples->logT[i] = logT;
+    samples->logR[i] = logR;
+    samples->T[i] = pow (10.0, logT);
+    samples->rho[i] = pow (10.0, logR) * pow (samples->T[i] * 1e-6, 3.0);
+    i++;
+  }
+
+  samples->n = i;
+}
+
+// Free a sample set
+void
+free_samples (Samples *samples)
+{
+  free (samples->logT);
+  free (samples->logR);
+  free (samples->T);
+  free (samples->rho);
+}
+
+// The original Fortran Opal routine
+void
+lookup_opal_fortran (const Samples *samples, double *logk)
+{
+  int i;
+  float X = BENCH_X, Z = BENCH_Z, T6f, Rf;
+
+  for (i = 0; i < samples->n; i++)
+  {
+    T6f = (float) pow (10.0, samples->logT[i] - 6.0);
+    Rf = (float) pow (10.0, samples->logR[i]);
+    opacgn93_ (&Z, &X, &T6f, &Rf);
+    logk[i] = e_.opact;
+  }
+}
+
+// The C port of the Opal routine
+void
+lookup_opal_c (const Samples *samples, double *logk)
+{
+  int i;
+  OpalState state;
+  OpalOpacity opacity;
+
+  for (i = 0; i < samples->n; i++)
+  {
+    opal_opacity (opal_tables, &state, BENCH_Z, BENCH_X, pow (10.0, samples->logT[i] - 6.0),
+                  pow (10.0, samples->logR[i]), &opacity);
+    logk[i] = opacity.opact;
+  }
+}
+
+// The fixed composition slice of the Opal tables, using the C port of Opal
+// near the edge of the tables
+void
+lookup_opal_slice (const Samples *samples, double *logk)
+{
+  int i;
+  OpalState state;
+  OpalOpacity opacity;
+
+  for (i = 0; i < samples->n; i++)
+  {
+    if (opal_slice_lookup (samples->logT[i], samples->logR[i], &logk[i], NULL, NULL) == SUCCESS)
+      continue;
+    opal_opacity (opal_tables, &state, BENCH_Z, BENCH_X, pow (10.0, samples->logT[i] - 6.0),
+                  pow (10.0, samples->logR[i]), &opacity);
+    logk[i] = opacity.opact;
+  }
+}
+
+// Bilinear interpolation of the 2D table for a single point
+void
+lookup_2d_bilinear (const Samples *samples, double *logk)
+{
+  int i;
+
+  for (i = 0; i < samples->n; i++)
+    logk[i] = interp2d_eval (&bilinear, samples->logR[i], samples->logT[i]);
+}
+
+// Bicubic interpolation of the 2D table for a single point
+void
+lookup_2d_bicubic (const Samples *samples, double *logk)
+{
+  int i;
+
+  for (i = 0; i < samples->n; i++)
+    logk[i] = interp2d_eval (&bicubic, samples->logR[i], samples->logT[i]);
+}
+
+// A batched kernel for the 2D table. The kernels return kappa, rather than
+// log(kappa), so this is converted afterwards
+void
+lookup_2d_batch (const Samples *samples, double *logk)
+{
+  int i;
+  OpacBounds bounds;
+
+  bounds.logT_min = min_log_T;
+  bounds.logT_max = max_log_T;
+  bounds.logR_min = min_log_R;
+  bounds.logR_max = max_log_R;
+
+  if (current_backend->kernel (current_backend->interp_type == INTERP_BICUBIC ? &bicubic : &bilinear, &bounds,
+                               samples->n, samples->T, samples->rho, logk) >= 0)
+    Exit (TABLE_BOUNDS, "Sample outside of the 2D table for %s\n", current_backend->name);
+
+  for (i = 0; i < samples->n; i++)
+    logk[i] = log10 (logk[i]);
+}
+
+// Add a backend to the list of backends
+void
+add_backend (Backend *backends, int *n_backends, char *name, void (*lookup) (const Samples *, double *),
+             int reference, int interp_type, OpacKernel kernel)
+{
+  Backend *b = &backends[(*n_backends)++];
+
+  strcpy (b->name, name);
+  b->lookup = lookup;
+  b->reference = reference;
+  b->interp_type = interp_type;
+  b->kernel = kernel;
+}
+
+// Check if a batched kernel is supported by the CPU, using the same checks as
+// select_opac_kernel without exiting if it is not
+int
+kernel_supported (char *choice)
+{
+  if (!strcmp (choice, "scalar"))
+    return TRUE;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init ();
+  if (!strcmp (choice, "avx2"))
+    return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+  if (!strcmp (choice, "avx512"))
+    return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma") &&
+           __builtin_cpu_supports ("avx512f");
+#endif
+  return FALSE;
+}
+
+// Time a backend over a sample set, repeating the lookups until at least
+// MIN_BENCH_TIME seconds have passed. Returns the number of lookups per second
+double
+time_backend (Backend *backend, const Samples *samples, double *logk)
+{
+  int n_reps = 0;
+  double elapsed;
+  struct timespec start_time;
+
+  current_backend = backend;
+  start_time = get_time ();
+
+  do
+  {
+    backend->lookup (samples, logk);
+    n_reps++;
+    elapsed = time_difference (start_time, get_time ());
+  } while (elapsed < MIN_BENCH_TIME);
+
+  return (double) n_reps * samples->n / elapsed;
+}
+
+// Benchmark each backend of a family over each of the sample sets, printing
+// the results and writing them to the CSV file
+void
+run_family (Backend *backends, int n_backends, int n_samples, double logT_min, double logT_max, double logR_min,
+            double logR_max, int opal, FILE *csv)
+{
+  int i, j, set, ref;
+  double rate, d, max_err, rms_err;
+  double **logk;
+  Samples samples;
+
+  if (!(logk = malloc (n_backends * sizeof (*logk))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for benchmark results\n");
+
+  for (set = 0; set < N_SAMPLE_SETS; set++)
+  {
+    generate_samples (&samples, n_samples, set, logT_min, logT_max, logR_min, logR_max, opal);
+    printf ("\n %s samples: %i points\n", sample_set_names[set], samples.n);
+    printf ("\t%-24s %-20s %14s %14s %14s\n", "backend", "reference", "lookups/s", "max error", "rms error");
+
+    for (i = 0; i < n_backends; i++)
+      if (!(logk[i] = malloc (samples.n * sizeof (**logk))))
+        Exit (MEM_ALLOC_ERR, "Unable to allocate memory for benchmark results\n");
+
+    for (i = 0; i < n_backends; i++)
+    {
+      rate = time_backend (&backends[i], &samples, logk[i]);
+
+      max_err = rms_err = 0.0;
+      if ((ref = backends[i].reference) >= 0)
+      {
+        for (j = 0; j < samples.n; j++)
+        {
+          d = fabs (logk[i][j] - logk[ref][j]);
+          if (d > max_err)
+            max_err = d;
+          rms_err += d * d;
+        }
+        rms_err = samples.n ? sqrt (rms_err / samples.n) : 0.0;
+      }
+
+      printf ("\t%-24s %-20s %14.4e %14.4e %14.4e\n", backends[i].name, ref >= 0 ? backends[ref].name : "-", rate,
+              max_err, rms_err);
+      fprintf (csv, "%s,%s,%s,%i,%e,%e,%e\n", sample_set_names[set], backends[i].name,
+               ref >= 0 ? backends[ref].name : "", samples.n, rate, max_err, rms_err);
+    }
+
+    for (i = 0; i < n_backends; i++)
+      free (logk[i]);
+    free_samples (&samples);
+  }
+
+  free (logk);
+}
+
+int
+main (int argc, char **argv)
+{
+  int i, n_backends, n_samples = N_SAMPLES_DEFAULT;
+  char name[LINE_LEN], kernel_name[LINE_LEN];
+  char *kernels[] = {"scalar", "avx2", "avx512"};
+  Backend backends[16];
+  OpacKernel kernel;
+  FILE *csv;
+
+  if (argc > 3 || (argc > 1 && (n_samples = atoi (argv[1])) < 1))
+  {
+    printf ("Usage: bench_opacity [n_samples] [2d_table]\n");
+    return FAILURE;
+  }
+
+  strcpy (OUTPUT_PREFIX, "bench_opacity_");
+  INIT_LOGFILE = TRUE;
+  VERBOSITY = FALSE;
+
+  if (!(csv = fopen ("bench_opacity.csv", "w")))
+    Exit (FILE_OPEN_ERR, "Can't open file bench_opacity.csv to write\n");
+  fprintf (csv, "samples,backend,reference,n_samples,lookups_per_second,max_error_dex,rms_error_dex\n");
+
+  /*
+   * The Opal backends, compared against the original Fortran routine
+   */
+
+  if (access (OPAL_FILENAME, F_OK) == -1)
+  {
+    printf (" %s not found in the current directory, skipping the Opal backends\n", OPAL_FILENAME);
+  }
+  else
+  {
+    geo.X = BENCH_X;
+    geo.Z = BENCH_Z;
+    load_opacity_table (OPAL_FILENAME);
+    init_opal_slice ();
+
+    n_backends = 0;
+    add_backend (backends, &n_backends, "opal_fortran", lookup_opal_fortran, -1, 0, NULL);
+    add_backend (backends, &n_backends, "opal_c", lookup_opal_c, 0, 0, NULL);
+    add_backend (backends, &n_backends, "opal_slice", lookup_opal_slice, 0, 0, NULL);
+
+    printf ("\n Opal backends, X = %.2f Z = %.2f\n", BENCH_X, BENCH_Z);
+    run_family (backends, n_backends, n_samples, OP_MIN_LOG_T, OP_MAX_LOG_T, OP_MIN_LOG_R, OP_MAX_LOG_R, TRUE, csv);
+  }
+
+  /*
+   * The 2D backends, compared against bicubic interpolation for a single
+   * point, or the single point interpolation of the same type for the
+   * batched kernels
+   */
+
+  if (argc == 3)
+  {
+    load_opacity_table (argv[2]);
+    interp2d_init (&bilinear, INTERP_BILINEAR, logR_table, n_log_R, logT_table, n_log_T, logRMO_table);
+    interp2d_init (&bicubic, INTERP_BICUBIC, logR_table, n_log_R, logT_table, n_log_T, logRMO_table);
+
+    n_backends = 0;
+    add_backend (backends, &n_backends, "2d_bicubic", lookup_2d_bicubic, -1, INTERP_BICUBIC, NULL);
+    add_backend (backends, &n_backends, "2d_bilinear", lookup_2d_bilinear, 0, INTERP_BILINEAR, NULL);
+    for (i = 0; i < (int) (sizeof (kernels) / sizeof (*kernels)); i++)
+    {
+      if (!kernel_supported (kernels[i]))
+        continue;
+      kernel = select_opac_kernel (kernels[i], kernel_name);
+      snprintf (name, LINE_LEN, "2d_bilinear_%.16s", kernel_name);
+      add_backend (backends, &n_backends, name, lookup_2d_batch, 1, INTERP_BILINEAR, kernel);
+      snprintf (name, LINE_LEN, "2d_bicubic_%.16s", kernel_name);
+      add_backend (backends, &n_backends, name, lookup_2d_batch, 0, INTERP_BICUBIC, kernel);
+    }
+
+    printf ("\n 2D backends, table %s\n", argv[2]);
+    run_family (backends, n_backends, n_samples, min_log_T, max_log_T, min_log_R, max_log_R, FALSE, csv);
+
+    interp2d_free (&bilinear);
+    interp2d_free (&bicubic);
+  }
+
+  if (fclose (csv))
+    Exit (FILE_CLOSE_ERR, "Can't close bench_opacity.csv\n");
+
+  return SUCCESS;
+}
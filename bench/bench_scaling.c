@@ -0,0 +1,302 @@
+/* ***************************************************************************
+ *
+ * @file bench_scaling.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief A benchmark of how the Eddington iterations scale with the number of
+ *        grid cells and threads.
+ *
+ * @details
+ *
+ * Usage: bench_scaling par_file [n_cycles] [max_cells] [n_threads,...]
+ *
+ * The parameter file sets up the simulation as usual, i.e. the opacity table,
+ * temperatures, z_max and irho, but must not contain density_file, as the grid
+ * is set using the standard density profile. For each number of cells from
+ * 1e2 to max_cells (default 1e8) in steps of a factor of ten, and each number
+ * of threads (default 1, 2, 4, ... up to OMP_NUM_THREADS, and only 1 without
+ * OpenMP), the Eddington iterations are run for n_cycles (default 10) cycles
+ * with no output written, by setting nz_cells, max_iterations,
+ * converge_fraction and output_format.
+ *
+ * As with batches of simulations, each run is done in a child process forked
+ * after the opacity table has been read in, so every run starts from the same
+ * state and the peak resident set size of the run can be found from the
+ * resource usage of the child. The time per cycle, time per cell per cycle,
+ * peak RSS and the thread scaling efficiency, relative to the run with the
+ * fewest threads for the same number of cells, are printed and written to
+ * bench_scaling.csv. The log of the most recent run is bench_scaling_run_logfile.
+ *
+ * ************************************************************************** */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../src/snake.h"
+
+#define N_CYCLES_DEFAULT 10
+#define MIN_CELLS 100
+#define MAX_CELLS_DEFAULT 100000000
+#define MAX_THREAD_COUNTS 32
+
+/*
+ * The result of a single run, sent from the child process to the benchmark
+ * through a pipe
+ */
+
+typedef struct RunResult
+{
+  int n_cycles;
+  double iteration_time;
+} RunResult;
+
+// Parse a comma separated list of thread counts. Returns the number of thread
+// counts, or 0 if the list is invalid
+int
+parse_thread_counts (char *list, int *thread_counts)
+{
+  int n = 0;
+  char *token;
+
+  for (token = strtok (list, ","); token; token = strtok (NULL, ","))
+  {
+    if (n == MAX_THREAD_COUNTS || (thread_counts[n] = atoi (token)) < 1)
+      return 0;
+    n++;
+  }
+
+  return n;
+}
+
+// Use 1, 2, 4, ... threads up to the maximum number of OpenMP threads, which
+// is also included if it is not a power of two. Returns the number of thread
+// counts
+int
+default_thread_counts (int *thread_counts)
+{
+  int n = 0, max_threads = 1, n_threads;
+
+  #ifdef _OPENMP
+    max_threads = omp_get_max_threads ();
+  #endif
+
+  for (n_threads = 1; n_threads < max_threads && n < MAX_THREAD_COUNTS - 1; n_threads *= 2)
+    thread_counts[n++] = n_threads;
+  thread_counts[n++] = max_threads;
+
+  return n;
+}
+
+// Run the Eddington iterations for a grid of n_cells cells using n_threads
+// threads in the child process, and send the time taken to the benchmark. This
+// does not return
+void
+run_scaling_child (char *par_file, long n_cells, int n_threads, int n_cycles, int fd)
+{
+  char value[LINE_LEN];
+  struct timespec start_time;
+  RunResult result;
+
+  strcpy (OUTPUT_PREFIX, "bench_scaling_run_");
+  if (!freopen ("/dev/null", "w", stdout))
+    _exit (FILE_OPEN_ERR);
+  INIT_LOGFILE = TRUE;
+  VERBOSITY = FALSE;
+
+  #ifdef _OPENMP
+    omp_set_num_threads (n_threads);
+  #endif
+
+  init_parameter_file (par_file);
+  snprintf (value, LINE_LEN, "%li", n_cells);
+  set_parameter ("nz_cells", value);
+  snprintf (value, LINE_LEN, "%i", n_cycles);
+  set_parameter ("max_iterations", value);
+  set_parameter ("converge_fraction", "2.0");
+  set_parameter ("output_format", "none");
+  set_parameter ("output_summary", "0");
+  set_parameter ("profile", "0");
+
+  init_profiler ();
+  init_snake ();
+  init_outfile ();
+  init_geo ();
+
+  start_time = get_time ();
+  eddington_iterations ();
+  result.iteration_time = time_difference (start_time, get_time ());
+  result.n_cycles = geo.icycle;
+
+  if (write (fd, &result, sizeof (result)) != (ssize_t) sizeof (result))
+    _exit (FILE_IN_ERR);
+  close (fd);
+
+  clean_up ();
+  exit (SUCCESS);
+}
+
+// Run the Eddington iterations in a child process and wait for it to finish.
+// Returns FAILURE if the run did not complete
+int
+run_scaling (char *par_file, long n_cells, int n_threads, int n_cycles, RunResult *result, long *peak_rss)
+{
+  int fd[2], status;
+  ssize_t n_read;
+  pid_t pid;
+  struct rusage usage;
+
+  if (pipe (fd))
+    Exit (FILE_OPEN_ERR, "Unable to create a pipe for the benchmark run\n");
+
+  fflush (NULL);
+  if ((pid = fork ()) == -1)
+    Exit (UNKNOWN_MODE, "Unable to start benchmark run with %li cells\n", n_cells);
+  if (pid == 0)
+  {
+    close (fd[0]);
+    run_scaling_child (par_file, n_cells, n_threads, n_cycles, fd[1]);
+  }
+
+  close (fd[1]);
+  n_read = read (fd[0], result, sizeof (*result));
+  close (fd[0]);
+
+  if (wait4 (pid, &status, 0, &usage) == -1)
+    Exit (UNKNOWN_MODE, "Unable to wait for benchmark run to finish\n");
+
+  /*
+   * On Linux, ru_maxrss is in kilobytes
+   */
+
+  *peak_rss = usage.ru_maxrss * 1024L;
+
+  if (n_read != (ssize_t) sizeof (*result) || !WIFEXITED (status) || WEXITSTATUS (status) || result->n_cycles < 1)
+    return FAILURE;
+
+  return SUCCESS;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i, n_thread_counts, n_cycles = N_CYCLES_DEFAULT;
+  int thread_counts[MAX_THREAD_COUNTS];
+  long n_cells, max_cells = MAX_CELLS_DEFAULT, peak_rss;
+  double per_cycle, per_cell_cycle, efficiency, ref_thread_time = 0.0;
+  char table_name[LINE_LEN];
+  RunResult result;
+  FILE *csv;
+
+  if (argc < 2 || argc > 5 || (argc > 2 && (n_cycles = atoi (argv[2])) < 1) ||
+      (argc > 3 && (max_cells = atol (argv[3])) < MIN_CELLS))
+  {
+    printf ("Usage: bench_scaling par_file [n_cycles] [max_cells] [n_threads,...]\n");
+    return FAILURE;
+  }
+
+  if (argc > 4)
+    n_thread_counts = parse_thread_counts (argv[4], thread_counts);
+  else
+    n_thread_counts = default_thread_counts (thread_counts);
+  if (!n_thread_counts)
+  {
+    printf ("Invalid list of thread counts %s\n", argv[4]);
+    return FAILURE;
+  }
+
+  /*
+   * Without OpenMP every run uses one thread, so any other thread count would
+   * give a meaningless efficiency
+   */
+
+  #ifndef _OPENMP
+    for (i = 0; i < n_thread_counts; i++)
+    {
+      if (thread_counts[i] != 1)
+      {
+        printf ("bench_scaling was built without OpenMP, so the only thread count allowed is 1\n");
+        return FAILURE;
+      }
+    }
+  #endif
+
+  if (n_cycles > MAX_ITER)
+  {
+    printf ("The number of cycles can be at most %i\n", MAX_ITER);
+    return FAILURE;
+  }
+
+  strcpy (OUTPUT_PREFIX, "bench_scaling_");
+  INIT_LOGFILE = TRUE;
+  VERBOSITY = FALSE;
+
+  /*
+   * The opacity table is read in once, so it is shared by every run rather
+   * than read in by each of them
+   */
+
+  init_parameter_file (argv[1]);
+  if (check_for_parameter ("density_file"))
+    Exit (INVALID_VALUE, "%s sets density_file, but the benchmark uses the standard density profile\n", argv[1]);
+  get_string ("opacity_table", table_name);
+  free_parameter_table ();
+  load_opacity_table (table_name);
+
+  if (!(csv = fopen ("bench_scaling.csv", "w")))
+    Exit (FILE_OPEN_ERR, "Can't open file bench_scaling.csv to write\n");
+  fprintf (csv, "n_cells,n_threads,n_cycles,time_per_cycle_s,time_per_cell_cycle_s,peak_rss_bytes,efficiency\n");
+
+  printf ("\n Eddington iterations for %i cycles, %s\n\n", n_cycles, argv[1]);
+  printf ("\t%12s %9s %16s %16s %16s %10s\n", "n_cells", "threads", "time/cycle (s)", "time/cell (s)",
+          "peak RSS (MB)", "efficiency");
+
+  for (n_cells = MIN_CELLS; n_cells <= max_cells; n_cells *= 10)
+  {
+    for (i = 0; i < n_thread_counts; i++)
+    {
+      if (run_scaling (argv[1], n_cells, thread_counts[i], n_cycles, &result, &peak_rss))
+      {
+        printf ("\t%12li %9i    run failed, see bench_scaling_run_logfile\n", n_cells, thread_counts[i]);
+        if (fclose (csv))
+          Exit (FILE_CLOSE_ERR, "Can't close bench_scaling.csv\n");
+        return FAILURE;
+      }
+
+      per_cycle = result.iteration_time / result.n_cycles;
+      per_cell_cycle = per_cycle / n_cells;
+
+      /*
+       * The efficiency is relative to the run with the first thread count, i.e.
+       * t_1 n_1 / (t_i n_i), which is 1 for perfect scaling
+       */
+
+      if (i == 0)
+        ref_thread_time = per_cycle * thread_counts[0];
+      efficiency = ref_thread_time / (per_cycle * thread_counts[i]);
+
+      printf ("\t%12li %9i %16.6e %16.6e %16.2f %10.3f\n", n_cells, thread_counts[i], per_cycle, per_cell_cycle,
+              peak_rss / 1048576.0, efficiency);
+      fprintf (csv, "%li,%i,%i,%e,%e,%li,%f\n", n_cells, thread_counts[i], result.n_cycles, per_cycle,
+               per_cell_cycle, peak_rss, efficiency);
+      fflush (csv);
+    }
+  }
+
+  if (fclose (csv))
+    Exit (FILE_CLOSE_ERR, "Can't close bench_scaling.csv\n");
+
+  return SUCCESS;
+}
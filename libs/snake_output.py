@@ -42,6 +42,58 @@ def read_and_reshape_data(filename):
     return np.reshape(sgrid, (ncycles, ncells, ncols))
 
 
+def read_binary_data(filename):
+    """
+    Memory map the binary Snake grid output, sgrid.bin, as a 3d array of
+    (ncycles, ncells, ncols) so it can be used in the same way as the output
+    of read_and_reshape_data. The data is only read from disk when it is
+    accessed.
+
+    Parameters
+    ----------
+    filename: str
+        The file path to the binary grid output
+
+    Returns
+    -------
+    sgrid: (ncycles, ncells, ncols) array of float
+        A view of the memory mapped grid output from Snake. The columns are in
+        the same order as read_and_reshape_data.
+    cycles: (ncycles, 2) array of float
+        A view of the cycle number and the total optical depth of each cycle
+    fields: list of str
+        The name of each column
+    """
+
+    header = np.fromfile(filename, dtype=np.uint8, count=32)
+    if header[:8].tobytes() != b"SNAKEBIN":
+        raise ValueError("{} is not a binary Snake grid output file".format(filename))
+
+    # The byte order of the file is found from the endian marker
+    byteorder = "<"
+    if np.frombuffer(header[8:12].tobytes(), dtype="<i4")[0] != 0x01020304:
+        byteorder = ">"
+    version, header_size, nfields, ncells, ncycles = np.frombuffer(header[12:32].tobytes(),
+                                                                   dtype=byteorder + "i4")
+    if version != 1:
+        raise ValueError("Unknown version {} of the binary Snake grid output".format(version))
+
+    names = np.fromfile(filename, dtype="S32", count=nfields, offset=32)
+    fields = [name.decode() for name in names]
+
+    # If Snake did not finish, the number of cycles in the header will not have
+    # been updated, so use the size of the file instead
+    block_size = 8 * (2 + nfields * ncells)
+    ncycles_file = (path.getsize(filename) - header_size) // block_size
+    if ncycles == 0 or ncycles > ncycles_file:
+        ncycles = ncycles_file
+
+    block = np.dtype([("cycle", byteorder + "f8", (2,)), ("grid", byteorder + "f8", (nfields, ncells))])
+    data = np.memmap(filename, dtype=block, mode="r", offset=header_size, shape=(ncycles,))
+
+    return np.swapaxes(data["grid"], 1, 2), data["cycle"], fields
+
+
 def plot_each_var_and_cycle(sgrid):
     """
     The function for plotting the cell conditions as a function of disk height.
@@ -141,7 +193,10 @@ def main():
     print("\n--------------------------------------------------------------------------------\n")
     print(" Snake plotting script")
 
-    sgrid = read_and_reshape_data("sgrid.out")
+    if path.exists("sgrid.bin"):
+        sgrid, _, _ = read_binary_data("sgrid.bin")
+    else:
+        sgrid = read_and_reshape_data("sgrid.out")
     plot_each_var_and_cycle(sgrid)
 
     print("\n--------------------------------------------------------------------------------\n")
@@ -0,0 +1,451 @@
+/* ***************************************************************************
+ *
+ * @file acceleration.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Functions for accelerating the convergence of the Eddington
+ *        iterations.
+ *
+ * @details
+ *
+ * Each Eddington iteration is a fixed point map T_new = G(T) of the cell
+ * temperatures, which can converge slowly. The temperatures from the last
+ * few iterations are used to extrapolate a better estimate of the fixed point,
+ * which is used as the input for the next iteration. The choice of method is
+ * made using the optional parameter acceleration:
+ *
+ *  - none: the iterations are not accelerated, the default.
+ *  - ng: Ng acceleration, where every fourth iteration is replaced by an
+ *    extrapolation from the last four iterations (Ng 1974, J. Chem. Phys. 61,
+ *    2680, in the form given by Auer 1987).
+ *  - anderson: Anderson mixing using up to acceleration_depth previous
+ *    iterations, which is applied every iteration (Walker & Ni 2011, SIAM J.
+ *    Numer. Anal. 49, 1715).
+ *
+ * The residuals are weighted by 1 / T^2, so each cell contributes by its
+ * relative change in temperature. An extrapolation is rejected, and the
+ * history of iterations is discarded, if it gives a non-finite or
+ * non-positive temperature, if it changes the temperature of a cell by more
+ * than a factor of ACCEL_MAX_CHANGE, or if the residual has grown by more
+ * than a factor of ACCEL_MAX_GROWTH since the last iteration. In these cases
+ * the un-accelerated temperatures are used instead.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snake.h"
+
+#define ACCEL_MAX_DEPTH 10
+#define ACCEL_MAX_CHANGE 2.0
+#define ACCEL_MAX_GROWTH 2.0
+#define NG_ORDER 4
+
+/*
+ * The available acceleration methods
+ */
+
+enum ACCEL_METHODS
+{
+  ACCEL_NONE,
+  ACCEL_NG,
+  ACCEL_ANDERSON
+};
+
+/*
+ * The history of the iterations. x[j] is the input temperature of an
+ * iteration and g[j] is the temperature it returned, ordered from the oldest,
+ * j = 0, to the newest, j = n_hist - 1
+ */
+
+typedef struct Acceleration
+{
+  int method;
+  int depth;
+  int n_hist;
+  int n_accepted;
+  int n_rejected;
+  double last_residual;
+  double *x[ACCEL_MAX_DEPTH + 1];
+  double *g[ACCEL_MAX_DEPTH + 1];
+  double *x_new;
+} Acceleration;
+
+Acceleration accel;
+
+// Initialise the acceleration of the Eddington iterations
+void
+init_acceleration (void)
+{
+  int j, n_store;
+  char method[LINE_LEN];
+
+  strcpy (method, "none");
+  get_optional_string ("acceleration", method);
+
+  if (!strcmp (method, "none"))
+    accel.method = ACCEL_NONE;
+  else if (!strcmp (method, "ng"))
+    accel.method = ACCEL_NG;
+  else if (!strcmp (method, "anderson"))
+    accel.method = ACCEL_ANDERSON;
+  else
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for acceleration: %s. Allowed: none, ng or anderson\n", method);
+
+  if (accel.method == ACCEL_NONE)
+    return;
+
+  accel.depth = 3;
+  if (accel.method == ACCEL_ANDERSON)
+  {
+    get_optional_int ("acceleration_depth", &accel.depth);
+    if (accel.depth < 1 || accel.depth > ACCEL_MAX_DEPTH)
+      Exit (INVALID_VALUE, "Invalid value for acceleration_depth: 1 <= acceleration_depth <= %i\n",
+            ACCEL_MAX_DEPTH);
+    Log ("\t- Using Anderson acceleration with a depth of %i\n", accel.depth);
+  }
+  else
+    Log ("\t- Using Ng acceleration\n");
+
+  n_store = accel.method == ACCEL_NG ? NG_ORDER : accel.depth + 1;
+  for (j = 0; j < n_store; j++)
+  {
+    accel.x[j] = allocate_grid_array (sizeof (*accel.x[j]));
+    accel.g[j] = allocate_grid_array (sizeof (*accel.g[j]));
+  }
+  accel.x_new = allocate_grid_array (sizeof (*accel.x_new));
+
+  accel.n_hist = accel.n_accepted = accel.n_rejected = 0;
+  accel.last_residual = -1.0;
+}
+
+// Add the input and output temperatures of the latest iteration to the
+// history, discarding the oldest iteration if the history is full
+void
+push_iteration (int n_store)
+{
+  int j;
+  double *x_old, *g_old;
+
+  if (accel.n_hist == n_store)
+  {
+    x_old = accel.x[0];
+    g_old = accel.g[0];
+    for (j = 0; j < n_store - 1; j++)
+    {
+      accel.x[j] = accel.x[j + 1];
+      accel.g[j] = accel.g[j + 1];
+    }
+    accel.x[n_store - 1] = x_old;
+    accel.g[n_store - 1] = g_old;
+    accel.n_hist--;
+  }
+
+  memcpy (accel.x[accel.n_hist], grid.T_old, geo.nz_cells * sizeof (*grid.T_old));
+  memcpy (accel.g[accel.n_hist], grid.T, geo.nz_cells * sizeof (*grid.T));
+  accel.n_hist++;
+}
+
+// Discard all of the history apart from the latest iteration
+void
+restart_history (void)
+{
+  double *x_tmp, *g_tmp;
+
+  if (accel.n_hist < 2)
+    return;
+
+  x_tmp = accel.x[0];
+  g_tmp = accel.g[0];
+  accel.x[0] = accel.x[accel.n_hist - 1];
+  accel.g[0] = accel.g[accel.n_hist - 1];
+  accel.x[accel.n_hist - 1] = x_tmp;
+  accel.g[accel.n_hist - 1] = g_tmp;
+  accel.n_hist = 1;
+}
+
+// The weighted norm of the residual G(T) - T of the latest iteration
+double
+residual_norm (void)
+{
+  int i;
+  double r, sum = 0.0;
+  const double *x = accel.x[accel.n_hist - 1];
+  const double *g = accel.g[accel.n_hist - 1];
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    r = (g[i] - x[i]) / g[i];
+    sum += r * r;
+  }
+
+  return sqrt (sum);
+}
+
+// Solve the n x n linear system a x = b using Gaussian elimination with
+// partial pivoting. a and b are overwritten. Returns FAILURE if the system
+// is singular, or close to singular
+int
+solve_small_system (int n, double a[ACCEL_MAX_DEPTH][ACCEL_MAX_DEPTH], double *b, double *x)
+{
+  int i, j, k, pivot;
+  double tmp, factor, scale = 0.0;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < n; j++)
+      if (fabs (a[i][j]) > scale)
+        scale = fabs (a[i][j]);
+  if (scale == 0.0)
+    return FAILURE;
+
+  for (k = 0; k < n; k++)
+  {
+    pivot = k;
+    for (i = k + 1; i < n; i++)
+      if (fabs (a[i][k]) > fabs (a[pivot][k]))
+        pivot = i;
+    if (fabs (a[pivot][k]) < 1e-12 * scale)
+      return FAILURE;
+
+    if (pivot != k)
+    {
+      for (j = 0; j < n; j++)
+      {
+        tmp = a[k][j];
+        a[k][j] = a[pivot][j];
+        a[pivot][j] = tmp;
+      }
+      tmp = b[k];
+      b[k] = b[pivot];
+      b[pivot] = tmp;
+    }
+
+    for (i = k + 1; i < n; i++)
+    {
+      factor = a[i][k] / a[k][k];
+      for (j = k; j < n; j++)
+        a[i][j] -= factor * a[k][j];
+      b[i] -= factor * b[k];
+    }
+  }
+
+  for (i = n - 1; i > -1; i--)
+  {
+    x[i] = b[i];
+    for (j = i + 1; j < n; j++)
+      x[i] -= a[i][j] * x[j];
+    x[i] /= a[i][i];
+  }
+
+  return SUCCESS;
+}
+
+// Extrapolate the temperatures using Ng acceleration from the last four
+// successive iterations in the history. Returns FAILURE if the extrapolation
+// can not be made
+int
+ng_extrapolate (void)
+{
+  int i;
+  double w, d0, d1, d2;
+  double a1 = 0.0, b1 = 0.0, b2 = 0.0, c1 = 0.0, c2 = 0.0;
+  double det, alpha, beta;
+  const double *g0, *g1, *g2, *g3;
+
+  g0 = accel.g[3];
+  g1 = accel.g[2];
+  g2 = accel.g[1];
+  g3 = accel.g[0];
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    w = 1.0 / (g0[i] * g0[i]);
+    d0 = g0[i] - g1[i];
+    d1 = g1[i] - g2[i];
+    d2 = g2[i] - g3[i];
+    a1 += w * (d0 - d1) * (d0 - d1);
+    b1 += w * (d0 - d1) * (d0 - d2);
+    b2 += w * (d0 - d2) * (d0 - d2);
+    c1 += w * d0 * (d0 - d1);
+    c2 += w * d0 * (d0 - d2);
+  }
+
+  det = a1 * b2 - b1 * b1;
+  if (det == 0.0 || !isfinite (det))
+    return FAILURE;
+
+  alpha = (c1 * b2 - c2 * b1) / det;
+  beta = (c2 * a1 - c1 * b1) / det;
+
+  for (i = 0; i < geo.nz_cells; i++)
+    accel.x_new[i] = (1.0 - alpha - beta) * g0[i] + alpha * g1[i] + beta * g2[i];
+
+  return SUCCESS;
+}
+
+// Extrapolate the temperatures using Anderson mixing, using the differences
+// between the residuals of the iterations in the history. Returns FAILURE if
+// the least squares problem is singular
+int
+anderson_extrapolate (void)
+{
+  int i, j, k, m;
+  double w, fk, dfj, dfk;
+  double a[ACCEL_MAX_DEPTH][ACCEL_MAX_DEPTH], b[ACCEL_MAX_DEPTH], gamma[ACCEL_MAX_DEPTH];
+  const double *xk, *gk;
+
+  m = accel.n_hist - 1;
+  xk = accel.x[m];
+  gk = accel.g[m];
+
+  /*
+   * Solve the normal equations of the least squares problem for gamma, which
+   * minimises |f_k - sum_j gamma_j (f_{j+1} - f_j)| where f = G(T) - T
+   */
+
+  for (j = 0; j < m; j++)
+  {
+    b[j] = 0.0;
+    for (k = 0; k < m; k++)
+      a[j][k] = 0.0;
+  }
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    w = 1.0 / (gk[i] * gk[i]);
+    fk = gk[i] - xk[i];
+    for (j = 0; j < m; j++)
+    {
+      dfj = (accel.g[j + 1][i] - accel.x[j + 1][i]) - (accel.g[j][i] - accel.x[j][i]);
+      b[j] += w * dfj * fk;
+      for (k = j; k < m; k++)
+      {
+        dfk = (accel.g[k + 1][i] - accel.x[k + 1][i]) - (accel.g[k][i] - accel.x[k][i]);
+        a[j][k] += w * dfj * dfk;
+      }
+    }
+  }
+
+  for (j = 0; j < m; j++)
+    for (k = 0; k < j; k++)
+      a[j][k] = a[k][j];
+
+  if (solve_small_system (m, a, b, gamma))
+    return FAILURE;
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    accel.x_new[i] = gk[i];
+    for (j = 0; j < m; j++)
+      accel.x_new[i] -= gamma[j] * (accel.g[j + 1][i] - accel.g[j][i]);
+  }
+
+  return SUCCESS;
+}
+
+// Check that the extrapolated temperatures are sensible compared to the
+// temperatures from the latest iteration
+int
+check_extrapolation (void)
+{
+  int i;
+  double ratio;
+  const double *gk = accel.g[accel.n_hist - 1];
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    ratio = accel.x_new[i] / gk[i];
+    if (!isfinite (accel.x_new[i]) || accel.x_new[i] <= 0.0 || ratio > ACCEL_MAX_CHANGE ||
+        ratio < 1.0 / ACCEL_MAX_CHANGE)
+      return FAILURE;
+  }
+
+  return SUCCESS;
+}
+
+// Replace the temperatures from the latest iteration with an extrapolated
+// estimate of the converged temperatures. This should be called at the end of
+// an iteration, after update_cell_temperatures, once the grid has been written
+// and the convergence checked
+void
+accelerate_temperatures (void)
+{
+  int status;
+  double residual;
+
+  if (accel.method == ACCEL_NONE)
+    return;
+
+  push_iteration (accel.method == ACCEL_NG ? NG_ORDER : accel.depth + 1);
+
+  /*
+   * If the residual has grown, the history is not helping and may be making
+   * things worse, so start again from the latest iteration
+   */
+
+  residual = residual_norm ();
+  if (accel.last_residual > 0.0 && residual > ACCEL_MAX_GROWTH * accel.last_residual)
+  {
+    Log_verbose ("\t\t- Residual grew from %e to %e, restarting acceleration\n", accel.last_residual, residual);
+    restart_history ();
+    accel.last_residual = residual;
+    accel.n_rejected++;
+    return;
+  }
+  accel.last_residual = residual;
+
+  if (accel.n_hist < (accel.method == ACCEL_NG ? NG_ORDER : 2))
+    return;
+
+  if (accel.method == ACCEL_NG)
+    status = ng_extrapolate ();
+  else
+    status = anderson_extrapolate ();
+
+  if (status || check_extrapolation ())
+  {
+    Log_verbose ("\t\t- Rejected extrapolation of temperatures, restarting acceleration\n");
+    restart_history ();
+    accel.n_rejected++;
+    return;
+  }
+
+  memcpy (grid.T, accel.x_new, geo.nz_cells * sizeof (*grid.T));
+  accel.n_accepted++;
+  Log_verbose ("\t\t- Extrapolated temperatures accepted\n");
+
+  /*
+   * Ng acceleration starts a new set of four iterations from the extrapolated
+   * temperatures
+   */
+
+  if (accel.method == ACCEL_NG)
+    accel.n_hist = 0;
+}
+
+// Report how well the acceleration worked and free the history
+void
+clean_up_acceleration (void)
+{
+  int j;
+
+  if (accel.method == ACCEL_NONE)
+    return;
+
+  Log_verbose (" - Acceleration: %i extrapolations accepted, %i rejected\n", accel.n_accepted, accel.n_rejected);
+
+  for (j = 0; j < ACCEL_MAX_DEPTH + 1; j++)
+  {
+    free (accel.x[j]);
+    free (accel.g[j]);
+    accel.x[j] = accel.g[j] = NULL;
+  }
+  free (accel.x_new);
+  accel.x_new = NULL;
+  accel.method = ACCEL_NONE;
+}
@@ -0,0 +1,317 @@
+/* ***************************************************************************
+ *
+ * @file batch.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Functions for running a batch of simulations from a manifest.
+ *
+ * @details
+ *
+ * The batch manifest lists the simulations to run, one per line. Blank lines
+ * and lines starting with # are ignored. Each line is either,
+ *
+ *    par_file [prefix]
+ *
+ * to run the parameter file par_file, or,
+ *
+ *    sweep par_file par_name value_1 value_2 ... value_n
+ *
+ * to run par_file n times, with the parameter par_name replaced by each of the
+ * values in turn. The output files of each run are prefixed by prefix, which
+ * is by default the name of the parameter file without the .par extension and
+ * the value of the swept parameter, i.e. plane_T_disk_4e4_sgrid.out.
+ *
+ * The opacity tables used by the runs are read in once, before any runs are
+ * started. Each run is then executed in a child process forked from the batch
+ * process, n_workers at a time. As Snake keeps the state of a run in global
+ * variables, forking lets the runs execute concurrently without them sharing
+ * any state other than the opacity tables, which are only read and so are
+ * shared by the child processes rather than copied.
+ *
+ * ************************************************************************** */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "snake.h"
+
+#define MANIFEST_LINE_LEN 4096
+
+/*
+ * A run of the batch. par_name is empty unless the run is part of a parameter
+ * sweep
+ */
+
+typedef struct BatchRun
+{
+  char par_file[LINE_LEN];
+  char prefix[LINE_LEN];
+  char par_name[LINE_LEN];
+  char par_value[LINE_LEN];
+  pid_t pid;
+  int status;
+} BatchRun;
+
+// Add a run to the list of runs, growing the list if required. If prefix is
+// NULL, the prefix is made from the name of the parameter file and the value
+// of the swept parameter
+void
+add_batch_run (BatchRun **runs, int *n_runs, int *n_alloc, char *par_file, char *prefix, char *par_name,
+               char *par_value)
+{
+  int len;
+  char *base, *ext, *c;
+  char name[LINE_LEN], value[LINE_LEN];
+  BatchRun *run;
+
+  if (*n_runs == *n_alloc)
+  {
+    *n_alloc = *n_alloc ? 2 * *n_alloc : 16;
+    if (!(*runs = realloc (*runs, *n_alloc * sizeof (**runs))))
+      Exit (MEM_ALLOC_ERR, "Unable to allocate memory for batch runs\n");
+  }
+
+  if (strlen (par_file) >= LINE_LEN || strlen (par_name) >= LINE_LEN || strlen (par_value) >= LINE_LEN)
+    Exit (FILE_IN_ERR, "Batch run %s is too long\n", par_file);
+
+  run = &(*runs)[(*n_runs)++];
+  memset (run, 0, sizeof (*run));
+  strcpy (run->par_file, par_file);
+  strcpy (run->par_name, par_name);
+  strcpy (run->par_value, par_value);
+
+  if (prefix)
+  {
+    if (strlen (prefix) >= LINE_LEN)
+      Exit (FILE_IN_ERR, "Batch prefix %s is too long\n", prefix);
+    strcpy (run->prefix, prefix);
+    return;
+  }
+
+  base = (base = strrchr (par_file, '/')) ? base + 1 : par_file;
+  strcpy (name, base);
+  if ((ext = strrchr (name, '.')) && !strcmp (ext, ".par"))
+    *ext = '\0';
+
+  /*
+   * The value is put in the prefix with any path separators replaced, so that
+   * sweeping a file name such as density_file does not put the output files
+   * in a directory which does not exist
+   */
+
+  strcpy (value, par_value);
+  for (c = value; *c; c++)
+    if (*c == '/' || *c == '\\')
+      *c = '_';
+
+  if (strlen (par_name))
+    len = snprintf (run->prefix, LINE_LEN, "%s_%s_%s_", name, par_name, value);
+  else
+    len = snprintf (run->prefix, LINE_LEN, "%s_", name);
+  if (len >= LINE_LEN)
+    Exit (FILE_IN_ERR, "Batch prefix for %s is too long\n", par_file);
+}
+
+// Read the batch manifest into a list of runs. Returns the number of runs
+int
+read_batch_manifest (char *manifest_path, BatchRun **runs)
+{
+  int line_num = 0, n_runs = 0, n_alloc = 0;
+  char line[MANIFEST_LINE_LEN];
+  char *token, *par_file = NULL, *par_name = NULL;
+  FILE *manifest;
+
+  if (!(manifest = fopen (manifest_path, "r")))
+    Exit (FILE_OPEN_ERR, "Could not find batch manifest %s\n", manifest_path);
+
+  *runs = NULL;
+
+  while (fgets (line, MANIFEST_LINE_LEN, manifest) != NULL)
+  {
+    line_num++;
+    if (!(token = strtok (line, " \t\r\n")) || token[0] == '#')
+      continue;
+
+    if (strcmp (token, "sweep"))
+    {
+      add_batch_run (runs, &n_runs, &n_alloc, token, strtok (NULL, " \t\r\n"), "", "");
+      continue;
+    }
+
+    if (!(par_file = strtok (NULL, " \t\r\n")) || !(par_name = strtok (NULL, " \t\r\n")))
+      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in batch manifest\n", line_num);
+    if (!(token = strtok (NULL, " \t\r\n")))
+      Exit (PAR_FILE_SYNTAX_ERR, "No values to sweep over on line %i in batch manifest\n", line_num);
+    while (token)
+    {
+      add_batch_run (runs, &n_runs, &n_alloc, par_file, NULL, par_name, token);
+      token = strtok (NULL, " \t\r\n");
+    }
+  }
+
+  if (fclose (manifest))
+    Exit (FILE_CLOSE_ERR, "Couldn't close batch manifest %s\n", manifest_path);
+
+  return n_runs;
+}
+
+// Read in the opacity tables used by the runs of the batch, so they are
+// shared by the runs rather than read in by each run
+void
+preload_opacity_tables (BatchRun *runs, int n_runs)
+{
+  int i;
+  char table_name[LINE_LEN], loaded_2d_name[LINE_LEN];
+
+  loaded_2d_name[0] = '\0';
+
+  for (i = 0; i < n_runs; i++)
+  {
+    table_name[0] = '\0';
+    init_parameter_file (runs[i].par_file);
+    if (!strcmp (runs[i].par_name, "opacity_table"))
+      strcpy (table_name, runs[i].par_value);
+    else
+      get_optional_string ("opacity_table", table_name);
+    free_parameter_table ();
+
+    /*
+     * Only one 2D table can be in memory at once, so only the first 2D table is
+     * loaded. Runs which use another table will read it in themselves
+     */
+
+    if (!strlen (table_name))
+      continue;
+    if (strcmp (table_name, OPAL_FILENAME))
+    {
+      if (strlen (loaded_2d_name))
+        continue;
+      strcpy (loaded_2d_name, table_name);
+    }
+
+    load_opacity_table (table_name);
+  }
+}
+
+// Run a single run of the batch in the child process. This does not return
+void
+run_batch_child (BatchRun *run)
+{
+  char stdout_name[LINE_LEN];
+
+  /*
+   * The output of each run, including the log file and the output which is
+   * only printed to the screen, is written to files with the prefix of the run
+   */
+
+  strcpy (OUTPUT_PREFIX, run->prefix);
+  prefixed_name (stdout_name, "stdout");
+  if (!freopen (stdout_name, "w", stdout))
+    _exit (FILE_OPEN_ERR);
+
+  INIT_LOGFILE = TRUE;
+  Log ("\n--------------------------------------------------------------\n\n");
+  print_time_date ();
+  Log ("\n--------------------------------------------------------------\n\n");
+
+  run_simulation (run->par_file, strlen (run->par_name) ? run->par_name : NULL, run->par_value);
+
+  exit (SUCCESS);
+}
+
+// Wait for a run to finish and record its exit status. Returns the index of
+// the run which finished
+int
+wait_for_batch_run (BatchRun *runs, int n_runs)
+{
+  int i, status;
+  pid_t pid;
+
+  if ((pid = wait (&status)) == -1)
+    Exit (UNKNOWN_MODE, "Unable to wait for batch run to finish\n");
+
+  for (i = 0; i < n_runs; i++)
+    if (runs[i].pid == pid)
+      break;
+  if (i == n_runs)
+    Exit (UNKNOWN_MODE, "Unknown batch run with pid %li finished\n", (long) pid);
+
+  runs[i].status = WIFEXITED (status) ? WEXITSTATUS (status) : -1;
+  if (runs[i].status)
+    Log ("\t- Batch run %s failed with error code %i, see %sstdout\n", runs[i].prefix, runs[i].status,
+         runs[i].prefix);
+  else
+    Log ("\t- Batch run %s completed\n", runs[i].prefix);
+
+  return i;
+}
+
+// Run each of the simulations in the batch manifest, n_workers at a time. If
+// n_workers is 0, the number of processors is used. Returns the number of runs
+// which failed
+int
+run_batch (char *manifest_path, int n_workers)
+{
+  int i, n_runs, n_running = 0, n_failed = 0;
+  BatchRun *runs;
+
+  n_runs = read_batch_manifest (manifest_path, &runs);
+  if (!n_runs)
+    Exit (NO_INPUT, "No runs in batch manifest %s\n", manifest_path);
+
+  if (n_workers < 1 && (n_workers = (int) sysconf (_SC_NPROCESSORS_ONLN)) < 1)
+    n_workers = 1;
+
+  Log (" - Running %i simulations from %s with %i workers\n", n_runs, manifest_path, n_workers);
+
+  preload_opacity_tables (runs, n_runs);
+
+  for (i = 0; i < n_runs; i++)
+  {
+    if (n_running == n_workers)
+    {
+      wait_for_batch_run (runs, n_runs);
+      n_running--;
+    }
+
+    Log ("\t- Starting batch run %s\n", runs[i].prefix);
+
+    /*
+     * Anything buffered for stdout or the log file is flushed before forking,
+     * otherwise it would also be written by the child process
+     */
+
+    fflush (NULL);
+    if ((runs[i].pid = fork ()) == -1)
+      Exit (UNKNOWN_MODE, "Unable to start batch run %s\n", runs[i].prefix);
+    if (runs[i].pid == 0)
+      run_batch_child (&runs[i]);
+    n_running++;
+  }
+
+  while (n_running)
+  {
+    wait_for_batch_run (runs, n_runs);
+    n_running--;
+  }
+
+  for (i = 0; i < n_runs; i++)
+    if (runs[i].status)
+      n_failed++;
+
+  Log ("\n--------------------------------------------------------------\n\n");
+  Log (" - %i of %i batch runs completed successfully\n", n_runs - n_failed, n_runs);
+  Log ("\n--------------------------------------------------------------\n\n");
+
+  free (runs);
+  close_logfile ();
+
+  return n_failed;
+}
@@ -18,33 +18,41 @@
 
 // Iterate over each grid cell and figure out how much the temperature has
 // changed between cycles
-// TODO: remove hardcoded convergence limit (eps)
+// TODO: remove hardcoded convergence limit (CONVERGENCE_EPS)
 int
 check_cell_convergence (void)
 {
   int i;
   int n_converged = 0;
-  double eps = 0.025;
+  double eps = CONVERGENCE_EPS;
 
+  #ifdef _OPENMP
+    #pragma omp parallel for reduction(+:n_converged) schedule(static)
+  #endif
   for (i = 0; i  < geo.nz_cells; i++)
   {
-    if (fabs ((grid[i].T_old - grid[i].T) / (grid[i].T_old + grid[i].T)) < eps)
+    if (fabs ((grid.T_old[i] - grid.T[i]) / (grid.T_old[i] + grid.T[i])) < eps)
       n_converged += 1;
   }
 
   return n_converged;
 }
 
-// Steering function for checking the convergence of the simulation
+// Report the fraction of cells which have converged
 double
-report_convergence (void)
+convergence_fraction (int n_converged)
 {
-  int n_converged;
   double c_fraction;
 
-  n_converged = check_cell_convergence ();
   c_fraction = (double) n_converged / geo.nz_cells;
   Log ("\t\t- %i cells out of %i converged (%1.3f)\n", n_converged, geo.nz_cells, c_fraction);
 
   return c_fraction;
 }
+
+// Steering function for checking the convergence of the simulation
+double
+report_convergence (void)
+{
+  return convergence_fraction (check_cell_convergence ());
+}
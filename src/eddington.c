@@ -12,14 +12,57 @@
  *
  * @details
  *
+ * Each iteration can either be done by the standard kernel, which updates the
+ * opacities, optical depths, temperatures, column densities and convergence
+ * of every cell in separate passes over the grid, or by the fused kernel. The
+ * temperature of every cell depends on the total optical depth through T_eff,
+ * so the fused kernel needs two passes. The first pass walks down from the top
+ * of the atmosphere in blocks of BLOCK_CELLS cells, updating the
+ * opacities of a block and then, whilst the block is still in cache, the
+ * optical depths, cumulative optical depth and column densities. The second
+ * pass updates the temperatures and checks the convergence of each cell. The
+ * optical depths are summed in the same order as the standard kernel, so both
+ * kernels give the same temperatures.
+ *
+ * By default, the cumulative optical depth is summed serially from the top of
+ * the atmosphere. For large grids, it can instead be summed as a blocked scan,
+ * where the grid is split into blocks of BLOCK_CELLS cells from the top. The
+ * partial sums within each block are found in parallel, then the optical
+ * depth above each block is found by summing the block totals, and finally
+ * this offset is added to each cell of the block. As the blocks do not depend
+ * on the number of threads, neither does the result. The sums can optionally
+ * use Kahan compensated summation.
+ *
  * ************************************************************************** */
 
 #include <time.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "snake.h"
 
+#define M_PROTON 1.6726219e-24  // grams
+#define M_ELECTRON 9.10938e-28  // grams
+#define BLOCK_CELLS 4096
+
+/*
+ * The methods for summing the cumulative optical depth. tau_offsets holds the
+ * optical depth above each block for the blocked scan, where the blocks are
+ * numbered from the top of the atmosphere
+ */
+
+enum TAU_SUMMATIONS
+{
+  TAU_SERIAL,
+  TAU_BLOCKED,
+  TAU_COMPENSATED
+};
+
+int tau_summation;
+int n_tau_blocks;
+double *tau_offsets;
+
 // The Eddington approximation for T^4
 double
 eddington_approximation (double T_eff, double tau)
@@ -37,33 +80,170 @@ update_Teff (void)
               0.25);
 }
 
+// Initialise the method used to sum the cumulative optical depth
+void
+init_tau_summation (void)
+{
+  char summation[LINE_LEN];
+
+  strcpy (summation, "serial");
+  get_optional_string ("tau_summation", summation);
+
+  if (!strcmp (summation, "serial"))
+    tau_summation = TAU_SERIAL;
+  else if (!strcmp (summation, "blocked"))
+    tau_summation = TAU_BLOCKED;
+  else if (!strcmp (summation, "compensated"))
+    tau_summation = TAU_COMPENSATED;
+  else
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for tau_summation: %s. Allowed: serial, blocked or compensated\n",
+          summation);
+
+  n_tau_blocks = (geo.nz_cells + BLOCK_CELLS - 1) / BLOCK_CELLS;
+  if (tau_summation == TAU_SERIAL)
+    return;
+
+  Log ("\t- Summing the optical depth as a %s scan of %i blocks\n", summation, n_tau_blocks);
+
+  if (!(tau_offsets = calloc ((size_t) n_tau_blocks, sizeof (*tau_offsets))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for optical depth blocks\n");
+}
+
+// Free the memory used for summing the cumulative optical depth
+void
+clean_up_tau_summation (void)
+{
+  free (tau_offsets);
+  tau_offsets = NULL;
+}
+
+// Find the range of cells lo <= i < hi in block b, counting from the top
+void
+tau_block_range (int b, int *lo, int *hi)
+{
+  *hi = geo.nz_cells - b * BLOCK_CELLS;
+  *lo = *hi > BLOCK_CELLS ? *hi - BLOCK_CELLS : 0;
+}
+
+// Sum the optical depth of the cells lo <= i < hi downwards from the top of
+// the block, storing the partial sums in tau_depth. Returns the optical depth
+// of the block
+double
+sum_tau_block (int lo, int hi)
+{
+  int i;
+  double sum = 0.0, c = 0.0, y, t;
+
+  if (tau_summation == TAU_COMPENSATED)
+  {
+    for (i = hi - 1; i >= lo; i--)
+    {
+      y = grid.cell_tau[i] - c;
+      t = sum + y;
+      c = (t - sum) - y;
+      grid.tau_depth[i] = sum = t;
+    }
+    return sum - c;
+  }
+
+  for (i = hi - 1; i >= lo; i--)
+    grid.tau_depth[i] = sum += grid.cell_tau[i];
+
+  return sum;
+}
+
+// Replace the optical depth of each block in tau_offsets with the optical
+// depth of all of the blocks above it, and find the total optical depth
+void
+find_tau_offsets (void)
+{
+  int b;
+  double sum = 0.0, c = 0.0, y, t, block_tau;
+
+  for (b = 0; b < n_tau_blocks; b++)
+  {
+    block_tau = tau_offsets[b];
+    tau_offsets[b] = sum;
+    if (tau_summation == TAU_COMPENSATED)
+    {
+      y = block_tau - c;
+      t = sum + y;
+      c = (t - sum) - y;
+      sum = t;
+    }
+    else
+      sum += block_tau;
+  }
+
+  /*
+   * As for the sum of each block, the total includes the final compensation
+   */
+
+  geo.tot_tau = tau_summation == TAU_COMPENSATED ? sum - c : sum;
+}
+
 // Find the total amount of optical depth from bottom to top of the Eddington
-// geometry
+// geometry. The optical depth of each cell is independent and is found in
+// parallel. The cumulative sum is either serial or a blocked scan, neither of
+// which depend on the number of threads
 void
 find_vertical_tau (void)
 {
-  int i;
+  int i, b, lo, hi;
   double dz;
 
   Log_verbose ("\t\t- Calculating total vertical optical depth for cells\n");
 
-  geo.tot_tau = 0.0;
-
-  for (i = geo.nz_cells - 1; i > -1; i--)
+  #ifdef _OPENMP
+    #pragma omp parallel for private(dz) schedule(static)
+  #endif
+  for (i = 0; i < geo.nz_cells; i++)
   {
     if (i == 0)
-      dz = grid[i].z;
+      dz = grid.z[i];
     else
-      dz = grid[i].z - grid[i - 1].z;
+      dz = grid.z[i] - grid.z[i - 1];
 
-    grid[i].cell_tau = dz * grid[i].rho * grid[i].kappa;
-    grid[i].tau_depth = geo.tot_tau += grid[i].cell_tau;
+    grid.cell_tau[i] = dz * grid.rho[i] * grid.kappa[i];
+  }
+
+  if (tau_summation == TAU_SERIAL)
+  {
+    geo.tot_tau = 0.0;
+
+    for (i = geo.nz_cells - 1; i > -1; i--)
+      grid.tau_depth[i] = geo.tot_tau += grid.cell_tau[i];
+  }
+  else
+  {
+    #ifdef _OPENMP
+      #pragma omp parallel for private(lo, hi) schedule(static)
+    #endif
+    for (b = 0; b < n_tau_blocks; b++)
+    {
+      tau_block_range (b, &lo, &hi);
+      tau_offsets[b] = sum_tau_block (lo, hi);
+    }
+
+    find_tau_offsets ();
+
+    #ifdef _OPENMP
+      #pragma omp parallel for private(i, lo, hi) schedule(static)
+    #endif
+    for (b = 1; b < n_tau_blocks; b++)
+    {
+      tau_block_range (b, &lo, &hi);
+      for (i = lo; i < hi; i++)
+        grid.tau_depth[i] += tau_offsets[b];
+    }
   }
 
   Log ("\t\t- Total vertical optical depth %e\n", geo.tot_tau);
 }
 
-// Update the temperature of the cell using the Eddington approximation
+// Update the temperature of the cell using the Eddington approximation. With
+// OpenMP, rtau is a parallel reduction so may differ from the serial sum in
+// the last few bits, but it is only used as a check against tot_tau
 void
 update_cell_temperatures (void)
 {
@@ -73,15 +253,18 @@ update_cell_temperatures (void)
 
   Log_verbose ("\t\t- Updating cell temperatures\n");
 
-  Teff = update_Teff ();
+  Teff = geo.T_eff = update_Teff ();
   Log ("\t\t- Effective temperature %e K\n", Teff);
 
+  #ifdef _OPENMP
+    #pragma omp parallel for private(T_inter) reduction(+:rtau) schedule(static)
+  #endif
   for (i = geo.nz_cells - 1; i > -1; i--)
   {
-    grid[i].T_old = grid[i].T;
-    rtau += grid[i].cell_tau;
-    T_inter = eddington_approximation (Teff, grid[i].tau_depth);
-    grid[i].T = pow (T_inter, 0.25);
+    grid.T_old[i] = grid.T[i];
+    rtau += grid.cell_tau[i];
+    T_inter = eddington_approximation (Teff, grid.tau_depth[i]);
+    grid.T[i] = pow (T_inter, 0.25);
   }
 
   #ifdef DEBUG
@@ -98,83 +281,238 @@ update_cell_temperatures (void)
   }
 }
 
-// Calculate the hydrogen column density
+// Calculate the hydrogen column density. The number densities of each cell
+// are only needed for the sums, so they are not stored. With OpenMP, the
+// column densities are parallel reductions and may differ from a serial run in
+// the last few bits
 void
 calculate_column_density (void)
 {
   int i;
-  double *nh, *ne;
   double dz, nh_col, ne_col;
-  double m_proton = 1.6726219e-24;  // grams
-  double m_electon = 9.10938e-28;   // grams
-
-  nh = calloc ((size_t) geo.nz_cells, sizeof (*nh));
-  ne = calloc ((size_t) geo.nz_cells, sizeof (*ne));
-
-  for (i = 0; i < geo.nz_cells; i++)
-  {
-    nh[i] = grid[i].rho / m_proton;
-    ne[i] = grid[i].rho / m_electon;
-  }
 
   #ifdef DEBUG
     for (i = 0; i < geo.nz_cells; i++)
       Log ("Grid[%i].rho = %e\n          nh = %e\n          ne = %e\n", i,
-           grid[i].rho, nh[i], ne[i]);
+           grid.rho[i], grid.rho[i] / M_PROTON, grid.rho[i] / M_ELECTRON);
   #endif
 
   nh_col = ne_col = 0;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(dz) reduction(+:nh_col, ne_col) schedule(static)
+  #endif
   for (i = 0; i < geo.nz_cells; i++)
   {
     if (i == 0)
-      dz = grid[i].z;
+      dz = grid.z[i];
     else
-      dz = grid[i].z - grid[i - 1].z;
+      dz = grid.z[i] - grid.z[i - 1];
+
+    nh_col += dz * (grid.rho[i] / M_PROTON);
+    ne_col += dz * (grid.rho[i] / M_ELECTRON);
+  }
+
+  Log ("\t\t- H column density %e cm^-2\n", nh_col);
+  Log ("\t\t- e- column density %e cm^-2\n", ne_col);
+}
+
+// Initialise the choice of kernel for each Eddington iteration
+void
+init_iteration_kernel (void)
+{
+  char kernel[LINE_LEN];
+
+  strcpy (kernel, "standard");
+  get_optional_string ("iteration_kernel", kernel);
+
+  if (!strcmp (kernel, "standard"))
+    modes.fused = FALSE;
+  else if (!strcmp (kernel, "fused"))
+    modes.fused = TRUE;
+  else
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for iteration_kernel: %s. Allowed: standard or fused\n", kernel);
+
+  if (modes.fused && modes.newton)
+    Exit (INVALID_VALUE, "The fused iteration kernel can not be used with the Newton solver\n");
+  if (modes.fused)
+    Log ("\t- Using the fused iteration kernel\n");
+}
+
+// Do one Eddington iteration using the fused kernel. The opacities, optical
+// depths and column densities are updated in a single pass down from the top
+// of the atmosphere, and the temperatures and convergence in a second pass.
+// For the blocked scan, the partial sums of each block are found in the first
+// pass and the offsets are added in the second. Returns the fraction of cells
+// which have converged
+double
+fused_iteration (void)
+{
+  int i, b, lo, hi, n_updated = 0, n_converged = 0;
+  double dz, Teff, T_inter;
+  double nh_col = 0.0, ne_col = 0.0;
+
+  Log_verbose ("\t\t- Updating cell opacities and optical depths\n");
+
+  profile_start (PHASE_OPACITY);
+  geo.tot_tau = 0.0;
 
-    nh_col += dz * nh[i];
-    ne_col += dz * ne[i];
+  for (b = 0; b < n_tau_blocks; b++)
+  {
+    tau_block_range (b, &lo, &hi);
+    n_updated += update_cell_opacities_range (lo, hi);
+
+    for (i = hi - 1; i >= lo; i--)
+    {
+      if (i == 0)
+        dz = grid.z[i];
+      else
+        dz = grid.z[i] - grid.z[i - 1];
+
+      grid.cell_tau[i] = dz * grid.rho[i] * grid.kappa[i];
+      if (tau_summation == TAU_SERIAL)
+        grid.tau_depth[i] = geo.tot_tau += grid.cell_tau[i];
+      nh_col += dz * (grid.rho[i] / M_PROTON);
+      ne_col += dz * (grid.rho[i] / M_ELECTRON);
+    }
+
+    if (tau_summation != TAU_SERIAL)
+      tau_offsets[b] = sum_tau_block (lo, hi);
   }
 
+  if (tau_summation != TAU_SERIAL)
+    find_tau_offsets ();
+
+  profile_stop (PHASE_OPACITY);
+
+  Log_verbose ("\t\t- Updated the opacity of %i of %i cells\n", n_updated, geo.nz_cells);
+  Log ("\t\t- Total vertical optical depth %e\n", geo.tot_tau);
+
+  profile_start (PHASE_TEMPERATURE);
+  Teff = geo.T_eff = update_Teff ();
+  Log ("\t\t- Effective temperature %e K\n", Teff);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(T_inter) reduction(+:n_converged) schedule(static)
+  #endif
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    if (tau_summation != TAU_SERIAL)
+      grid.tau_depth[i] += tau_offsets[(geo.nz_cells - 1 - i) / BLOCK_CELLS];
+    grid.T_old[i] = grid.T[i];
+    T_inter = eddington_approximation (Teff, grid.tau_depth[i]);
+    grid.T[i] = pow (T_inter, 0.25);
+    if (fabs ((grid.T_old[i] - grid.T[i]) / (grid.T_old[i] + grid.T[i])) < CONVERGENCE_EPS)
+      n_converged += 1;
+  }
+  profile_stop (PHASE_TEMPERATURE);
+
   Log ("\t\t- H column density %e cm^-2\n", nh_col);
   Log ("\t\t- e- column density %e cm^-2\n", ne_col);
 
-  free (nh);
-  free (ne);
+  return convergence_fraction (n_converged);
 }
 
 // Main controlling function for the Eddington algorithm
 void
 eddington_iterations (void)
 {
-  int n_iters = 0;
+  int n_iters = 0, max_iters = MAX_ITER;
   int converged = FALSE;
   double converge_fraction = 0.9;
+  double c_fraction;
   struct timespec edd_start;
+  #ifdef DEBUG
+    long n_allocs;
+  #endif
 
   Log ("\n - Beginning Eddington iterations\n");
 
   get_double ("converge_fraction", &converge_fraction);
   if (converge_fraction <= 0)
     Exit (UNKNOWN_PARAMETER, "Invalid value for converge_fraction: converge_fraction > 0");
+  get_optional_int ("max_iterations", &max_iters);
+  if (max_iters < 1 || max_iters > MAX_ITER)
+    Exit (UNKNOWN_PARAMETER, "Invalid value for max_iterations: 0 < max_iterations <= %i\n", MAX_ITER);
+
+  init_solver ();
+  init_acceleration ();
+  init_iteration_kernel ();
+
+  /*
+   * Every work array used by the iterations is allocated before the loop
+   * starts, so no memory should be allocated in the loop itself. In a DEBUG
+   * build, every heap allocation made by Snake is counted to check this
+   */
+
+  #ifdef DEBUG
+    n_allocs = count_heap_allocations ();
+  #endif
 
   edd_start = get_time ();
 
-  while (!converged && n_iters < MAX_ITER)
+  while (!converged && n_iters < max_iters)
   {
     Log ("\t- Beginning iteration %i\n", geo.icycle = ++n_iters);
 
-    update_cell_opacities ();
-    find_vertical_tau ();
-    update_cell_temperatures ();
-    calculate_column_density ();
-
-    if (report_convergence () >= converge_fraction)
+    if (modes.fused)
+    {
+      c_fraction = fused_iteration ();
+    }
+    else
+    {
+      profile_start (PHASE_OPACITY);
+      update_cell_opacities ();
+      profile_stop (PHASE_OPACITY);
+
+      profile_start (PHASE_TAU);
+      find_vertical_tau ();
+      profile_stop (PHASE_TAU);
+
+      profile_start (PHASE_TEMPERATURE);
+      if (modes.newton)
+      {
+        update_cell_opacity_derivatives ();
+        update_cell_temperatures ();
+        newton_update_temperatures ();
+      }
+      else
+        update_cell_temperatures ();
+      profile_stop (PHASE_TEMPERATURE);
+
+      profile_start (PHASE_COLUMN_DENSITY);
+      calculate_column_density ();
+      profile_stop (PHASE_COLUMN_DENSITY);
+
+      profile_start (PHASE_CONVERGENCE);
+      c_fraction = report_convergence ();
+      profile_stop (PHASE_CONVERGENCE);
+    }
+
+    if (c_fraction >= converge_fraction)
       converged = TRUE;
 
-    write_grid ();
+    profile_start (PHASE_OUTPUT);
+    write_summary (c_fraction);
+    if (snapshot_due (converged || n_iters == max_iters, converged))
+      write_grid ();
+    profile_stop (PHASE_OUTPUT);
+
+    if (!converged)
+    {
+      profile_start (PHASE_ACCELERATION);
+      accelerate_temperatures ();
+      profile_stop (PHASE_ACCELERATION);
+    }
+
+    #ifdef DEBUG
+      if (count_heap_allocations () != n_allocs)
+        Exit (MEM_ALLOC_ERR, "%li heap allocations were made during iteration %i\n",
+              count_heap_allocations () - n_allocs, n_iters);
+    #endif
   }
 
-  if (n_iters == MAX_ITER)
+  if (!converged)
     Log (" - Ruh roh, max number of iterations reached!\n");
 
   Log ("\n - Cells converged in %i iterations in", n_iters);
@@ -22,6 +22,9 @@
  *
  * ************************************************************************** */
 
+#ifndef FLIB_H
+#define FLIB_H
+
 #define OP_MIN_LOG_R -8.0
 #define OP_MAX_LOG_R 1.0
 #define OP_MIN_LOG_T 3.75
@@ -49,6 +52,75 @@ struct
   float dopactd;
 } e_;
 
+/*
+ * The dimensions of the Opal tables, as set by the parameter statements in
+ * opal.f
+ */
+
+#define OP_MX 10
+#define OP_MZ 13
+#define OP_NR 19
+#define OP_NT 70
+
+/*
+ * The common block a contains the opacity tables once they have been read in
+ * by readco. As Fortran arrays are column major, the order of the dimensions
+ * is reversed compared to opal.f, i.e. xz(mx,mz,nt,nr) is xz[nr][nt][mz][mx].
+ * The ones which are useful from C are:
+ *
+ * T6LIST      The values of T6 for each row of the tables
+ * ALT         Log(T6) for each row of the tables
+ * ALR         Log(R) for each column of the tables
+ */
+
+struct
+{
+  int mzz;
+  float xz[OP_NR][OP_NT][OP_MZ][OP_MX];
+  float t6list[OP_NT];
+  float alr[OP_NR];
+  int n[OP_MX];
+  float alt[OP_NT];
+  float opk[OP_NR][OP_NT];
+  float opk2[OP_NR][OP_NT];
+  float dfsx[OP_MX];
+  float dfs[OP_NT];
+  float dfsr[OP_NR];
+  float dfsz[OP_MZ];
+  float a[OP_MX][3];
+  float b[3];
+  int m;
+  int mf;
+  float xa[OP_MX];
+  float alrf[OP_NR];
+  float xzf[OP_NR][OP_NT];
+  float t6listf[OP_NT];
+  float za[OP_MZ];
+} a_;
+
+/*
+ * The common block b contains the composition of each table read in from
+ * GN93hz, and NTA, the last row of the tables with data for each column of
+ * log(R). The common block ee contains XX = log(0.005 + X) for each X in the
+ * tables, and ZZA which is the value of Z for each set of tables
+ */
+
+struct
+{
+  int itab[OP_MZ][OP_MX];
+  int nta[OP_NR];
+  float x[OP_MZ][OP_MX];
+  float y[OP_MZ][OP_MX];
+  float zz[OP_MZ][OP_MX];
+} b_;
+
+struct
+{
+  float opl[OP_NR][OP_NT][OP_MX];
+  float xx[OP_MX];
+  float zza[OP_MZ];
+} ee_;
+
 /*
  * z: the metallicity fraction, Z
  * xh: the hydrogen mass fraction, X
@@ -68,3 +140,5 @@ void opacgn93_ (float *z, float *xh, float *t6, float *r);
  */
 
 void opac_ (int *izi, int *mzin, float *xh, float *t6, float *r);
+
+#endif
@@ -12,233 +12,374 @@
  *
  * ************************************************************************** */
 
+#include <ctype.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <gsl/gsl_interp2d.h>
 
 #include "gsl_interp.h"
+#include "interp_2d.h"
+#include "opac_batch.h"
+#include "opal.h"
 #include "snake.h"
 
-gsl_interp2d *interp;
-gsl_interp_accel *logR_accel, *logT_accel;
+Interp2D interp;
+OpacKernel opac_kernel;
+char loaded_2d_table[LINE_LEN];
 
-// Allocate memory for the opacity tables
+// Allocate memory for the opacity tables, once the dimensions of the table
+// are known
 void
 allocate_opacity_table (void)
 {
-  /*
-   * Allocate a temporary buffer to use when scanf is used to read in the
-   * opacity table from file
-   */
+  size_t mem_req;
 
-  if (!(buffer = calloc (N_ROWS * N_COLS, sizeof (*buffer))))
-    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for opacity table\n");
-  int mem_req = N_ROWS * N_COLS * sizeof (*buffer);
-  Log ("\t\t- Allocated %1.2e bytes for opacity table\n", (double) mem_req);
+  mem_req = (size_t) (n_log_T + n_log_R + n_log_T * n_log_R) * sizeof (*logRMO_table);
 
   /*
    * Allocate memory for logT, logR and logRMO arrays
    */
 
-  if (!(logT_table = calloc (N_LOG_T, sizeof (*logT_table))))
+  if (!(logT_table = calloc (n_log_T, sizeof (*logT_table))))
     Exit (MEM_ALLOC_ERR, "Unable to allocate memory for logT_table\n");
-  if (!(logR_table = calloc (N_LOG_R, sizeof (*logR_table))))
+  if (!(logR_table = calloc (n_log_R, sizeof (*logR_table))))
     Exit (MEM_ALLOC_ERR, "Unable to allocate memory for logR_table\n");
 
-/* ************************************************************************** */
-
   /*
-   * Valgrind is very upset with this memory allocation and I'm not sure why...
-   * Address xxxxx is 0 bytes after a block of size 11,016 alloc'd
-   *
-   * 14/12/18: I changed from N_LOG_R to N_COLS and N_LOG_T to N_ROWS and this
-   * seems to stop the problems and things looks the same...? Hasn't fixed the
-   * error with GSL interp adding 0 to the diagonals though. I still suspect
-   * that there may be more underlying issues...
+   * logRMO_table does not include the header row and column of the table, and
+   * is stored with logR varying fastest as required by the interpolation
+   * engine, i.e. logRMO_table[i * n_log_R + j] for logT_table[i] and
+   * logR_table[j]
    */
 
-  if (!(logRMO_table = calloc (N_COLS * N_ROWS, sizeof (*logRMO_table))))
+  if (!(logRMO_table = calloc ((size_t) n_log_T * n_log_R, sizeof (*logRMO_table))))
     Exit (MEM_ALLOC_ERR, "Unable to allocate memory for logRMO_table\n");
+
+  Log ("\t\t- Allocated %1.2e bytes for opacity table\n", (double) mem_req);
 }
 
-// Check that the 2d opacity table is the correct dimensions, i.e. it has been
-// generated from the included Python script
+// Check that the 2d opacity table read in is usable, i.e. there are at least
+// two values of logT and logR, both of which are strictly increasing, and
+// every value is finite
 int
 check_2d_opact_table (void)
 {
+  int i;
+
+  if (n_log_T < 2 || n_log_R < 2)
+  {
+    Log ("\t- The opacity table needs at least 2 values of logT and logR, found %i and %i\n", n_log_T, n_log_R);
+    return FAILURE;
+  }
+
+  for (i = 0; i < n_log_T * n_log_R; i++)
+  {
+    if (!isfinite (logRMO_table[i]))
+    {
+      Log ("\t- The opacity table has a value which is not finite for logT = %f\n", logT_table[i / n_log_R]);
+      return FAILURE;
+    }
+  }
+
+  for (i = 0; i < n_log_R; i++)
+  {
+    if (!isfinite (logR_table[i]) || (i && logR_table[i] <= logR_table[i - 1]))
+    {
+      Log ("\t- logR is not strictly increasing at column %i of the opacity table\n", i + 1);
+      return FAILURE;
+    }
+  }
+
+  for (i = 0; i < n_log_T; i++)
+  {
+    if (!isfinite (logT_table[i]) || (i && logT_table[i] <= logT_table[i - 1]))
+    {
+      Log ("\t- logT is not strictly increasing at row %i of the opacity table\n", i + 1);
+      return FAILURE;
+    }
+  }
+
   return SUCCESS;
 }
 
-// Read the 2D opacity table into memory
+// Read a 2D opacity table in the text format into memory. The number of values
+// of logT and logR is found from the table
 void
-read_2d_opact_table (char *file_path)
+read_2d_opact_table_text (FILE *opact_file, char *file_path)
 {
   int i, j;
-  int n, col, row, skip_lines;
-  FILE *opact_file;
-
-  if (!(opact_file = fopen (file_path, "r")))
-    Exit (FILE_OPEN_ERR, "Can't open opacity table %s\n", file_path);
-  Log ("\t- Opacity table %s opened\n", file_path);
-
-  if (check_2d_opact_table ())
-    Exit (INVALID_TABLE, "Don't know how to read opacity table %s", geo.opacity_table_filepath);
-
-  allocate_opacity_table ();
+  int n, n_rows = 0, n_cols = 0, line_num = 0;
+  size_t n_values = 0, n_alloc = 0, line_size = 0;
+  char *line = NULL, *p, *end;
+  double value, *values = NULL;
 
   /*
-   * Skip the first two lines in the opacity data which are assumed to be the
-   * header lines logR and logT
+   * Read every number in the table into values, a row at a time. Lines with no
+   * numbers on them are only allowed before the first row, i.e. the logR and
+   * logT labels, and every row must have the same number of columns
    */
 
-  skip_lines = 2;
-  for (i = 0; i < skip_lines; i++)
+  while (getline (&line, &line_size, opact_file) != -1)
   {
-    n = fscanf (opact_file, "%*s");
-    if (n)
-      Exit (FILE_IN_ERR, "fscanf didn't discard header\n");
+    line_num++;
+    n = 0;
+    p = line;
+    while (value = strtod (p, &end), end != p)
+    {
+      if (n_values == n_alloc)
+      {
+        n_alloc = n_alloc ? 2 * n_alloc : 4096;
+        if (!(values = realloc (values, n_alloc * sizeof (*values))))
+          Exit (MEM_ALLOC_ERR, "Unable to allocate memory for opacity table\n");
+      }
+      values[n_values++] = value;
+      p = end;
+      n++;
+    }
+
+    while (isspace ((unsigned char) *p))
+      p++;
+
+    if (n == 0 && (n_rows == 0 || *p == '\0'))
+      continue;
+    if (*p != '\0')
+      Exit (FILE_IN_ERR, "Unable to read line %i of opacity table %s\n", line_num, file_path);
+    if (n_rows == 0)
+      n_cols = n;
+    else if (n != n_cols)
+      Exit (INVALID_TABLE, "Line %i of opacity table %s has %i columns, but the first row has %i\n", line_num,
+            file_path, n, n_cols);
+    n_rows++;
   }
 
+  free (line);
+
+  if (n_rows < 2 || n_cols < 2)
+    Exit (INVALID_TABLE, "Opacity table %s does not contain a table\n", file_path);
+
   /*
-   * Read the data into opacity data array - we are assuming here that memory
-   * has already been allocated for the array. NOTE that buffer is defined
-   * in the header file gsl_interp.h.....
+   * Copy the table into arrays which are better suited for the interpolation
+   * routines
    */
 
-  col = 0;
-  row = 0;
-  while ((n = fscanf (opact_file, "%lf", &buffer[i2d (row, col)])) != EOF)
+  n_log_T = n_rows - 1;
+  n_log_R = n_cols - 1;
+  allocate_opacity_table ();
+
+  for (i = 0; i < n_log_T; i++)
+    logT_table[i] = values[(1 + i) * n_cols];
+
+  for (i = 0; i < n_log_R; i++)
+    logR_table[i] = values[1 + i];
+
+  for (i = 0; i < n_log_T; i++)
+    for (j = 0; j < n_log_R; j++)
+      logRMO_table[i * n_log_R + j] = values[(1 + i) * n_cols + 1 + j];
+
+  free (values);
+}
+
+// Read a 2D opacity table in the binary format into memory
+void
+read_2d_opact_table_binary (FILE *opact_file, char *file_path)
+{
+  size_t n;
+  TableBinHeader header;
+
+  if (fread (&header, sizeof (header), 1, opact_file) != 1 || memcmp (header.magic, TABLE_BIN_MAGIC, 8))
+    Exit (FILE_IN_ERR, "Unable to read the header of opacity table %s\n", file_path);
+  if (header.endian != TABLE_BIN_ENDIAN_MARK)
+    Exit (INVALID_TABLE, "Opacity table %s was written on a machine with a different byte order\n", file_path);
+  if (header.version != TABLE_BIN_VERSION || header.header_size != TABLE_BIN_HEADER_SIZE)
+    Exit (INVALID_TABLE, "Opacity table %s has an unknown binary format version %i\n", file_path, header.version);
+  if (header.n_log_T < 2 || header.n_log_R < 2)
+    Exit (INVALID_TABLE, "Opacity table %s does not contain a table\n", file_path);
+
+  n_log_T = header.n_log_T;
+  n_log_R = header.n_log_R;
+  allocate_opacity_table ();
+
+  n = (size_t) n_log_T * n_log_R;
+  if (fseek (opact_file, TABLE_BIN_HEADER_SIZE, SEEK_SET) ||
+      fread (logT_table, sizeof (*logT_table), n_log_T, opact_file) != (size_t) n_log_T ||
+      fread (logR_table, sizeof (*logR_table), n_log_R, opact_file) != (size_t) n_log_R ||
+      fread (logRMO_table, sizeof (*logRMO_table), n, opact_file) != n)
+    Exit (FILE_IN_ERR, "Opacity table %s is shorter than its header says\n", file_path);
+
+  Log ("\t\t- Binary table for X = %f and Z = %f\n", header.X, header.Z);
+}
+
+// Read the 2D opacity table into memory. The table can either be in the text
+// format or the binary format, which is detected from the start of the file,
+// and it is checked before it is used
+void
+read_2d_opact_table (char *file_path)
+{
+  char magic[8];
+  #ifdef DEBUG
+    int i, j;
+  #endif
+  FILE *opact_file;
+
+  if (!(opact_file = fopen (file_path, "r")))
+    Exit (FILE_OPEN_ERR, "Can't open opacity table %s\n", file_path);
+  Log ("\t- Opacity table %s opened\n", file_path);
+
+  if (fread (magic, sizeof (magic), 1, opact_file) == 1 && !memcmp (magic, TABLE_BIN_MAGIC, sizeof (magic)))
   {
-    if (n != 1)
-      Exit (FILE_IN_ERR, "fscanf failed to return a single number\n");
-    if (++col == N_COLS)
-    {
-      col = 0;
-      row++;
-    }
+    rewind (opact_file);
+    read_2d_opact_table_binary (opact_file, file_path);
+  }
+  else
+  {
+    rewind (opact_file);
+    read_2d_opact_table_text (opact_file, file_path);
   }
 
   if (fclose (opact_file))
     Exit (FILE_CLOSE_ERR, "Cannot close opacity table %s\n", file_path);
 
-  /*
-   * Write the temporary buffer into more appropriate arrays which are better
-   * suited for GSL interpolation routines
-   */
-
-  for (i = 0; i < N_LOG_T; i++)
-    logT_table[i] = buffer[i2d (1+i, 0)];
-
-  for (i = 0; i < N_LOG_R; i++)
-    logR_table[i] = buffer[i2d (0, 1+i)];
+  if (check_2d_opact_table ())
+    Exit (INVALID_TABLE, "Don't know how to read opacity table %s\n", file_path);
 
-  for (i = 0; i < N_LOG_T; i++)
-    for (j = 0; j < N_LOG_R; j++)
-      logRMO_table[i2d (i, j)] = buffer[i2d (1+i, 1+j)];
+  min_log_T = logT_table[0];
+  max_log_T = logT_table[n_log_T - 1];
+  min_log_R = logR_table[0];
+  max_log_R = logR_table[n_log_R - 1];
 
-  free (buffer);
+  Log ("\t\t- %i values of logT from %f to %f and %i values of logR from %f to %f\n", n_log_T, min_log_T,
+       max_log_T, n_log_R, min_log_R, max_log_R);
 
   #ifdef DEBUG
     Log ("logT\n");
-    for (i = 0; i < N_LOG_T; i++)
+    for (i = 0; i < n_log_T; i++)
       Log ("%f ", logT_table[i]);
     Log ("\nlogR\n");
-    for (i = 0; i < N_LOG_R; i++)
+    for (i = 0; i < n_log_R; i++)
       Log ("%f ", logR_table[i]);
     Log("\nlogRMO\n");
-    for (i = 0; i < N_LOG_T; i++)
+    for (i = 0; i < n_log_T; i++)
     {
-      for (j = 0; j < N_LOG_R; j++)
-        Log ("%+f ", logRMO_table[i2d (i, j)]);
+      for (j = 0; j < n_log_R; j++)
+        Log ("%+f ", logRMO_table[i * n_log_R + j]);
       Log ("\n");
     }
   #endif
 }
 
-// Initialise the GSL interpolation routines
+// Write a 2D opacity table in the text format, where logk[i * n_logR + j] is
+// log(kappa) for logT[i] and logR[j]. Returns FAILURE if the table could not
+// be written
+int
+write_2d_opact_table_text (char *file_path, const double *logT, int n_logT, const double *logR, int n_logR,
+                           const double *logk)
+{
+  int i, j, ok;
+  FILE *opact_file;
+
+  if (!(opact_file = fopen (file_path, "w")))
+    return FAILURE;
+
+  fprintf (opact_file, "%*s\n", 8 * (n_logR + 1) + 4, "logR");
+  fprintf (opact_file, " logT  \n");
+
+  fprintf (opact_file, "%+.4f ", 0.0);
+  for (j = 0; j < n_logR; j++)
+    fprintf (opact_file, " %+.4f ", logR[j]);
+  fprintf (opact_file, "\n");
+
+  for (i = 0; i < n_logT; i++)
+  {
+    fprintf (opact_file, "%+.4f ", logT[i]);
+    for (j = 0; j < n_logR; j++)
+      fprintf (opact_file, " %+.6f ", logk[i * n_logR + j]);
+    fprintf (opact_file, "\n");
+  }
+
+  ok = !ferror (opact_file);
+  ok = !fclose (opact_file) && ok;
+
+  return ok ? SUCCESS : FAILURE;
+}
+
+// Write a 2D opacity table in the binary format, where logk[i * n_logR + j] is
+// log(kappa) for logT[i] and logR[j]. Returns FAILURE if the table could not
+// be written
+int
+write_2d_opact_table_binary (char *file_path, const double *logT, int n_logT, const double *logR, int n_logR,
+                             const double *logk, double X, double Z)
+{
+  int ok;
+  char header[TABLE_BIN_HEADER_SIZE];
+  TableBinHeader table_header;
+  FILE *opact_file;
+
+  memset (&table_header, 0, sizeof (table_header));
+  memcpy (table_header.magic, TABLE_BIN_MAGIC, sizeof (table_header.magic));
+  table_header.endian = TABLE_BIN_ENDIAN_MARK;
+  table_header.version = TABLE_BIN_VERSION;
+  table_header.header_size = TABLE_BIN_HEADER_SIZE;
+  table_header.n_log_T = n_logT;
+  table_header.n_log_R = n_logR;
+  table_header.X = X;
+  table_header.Z = Z;
+  memset (header, 0, sizeof (header));
+  memcpy (header, &table_header, sizeof (table_header));
+
+  if (!(opact_file = fopen (file_path, "wb")))
+    return FAILURE;
+
+  ok = fwrite (header, sizeof (header), 1, opact_file) == 1 &&
+       fwrite (logT, sizeof (*logT), n_logT, opact_file) == (size_t) n_logT &&
+       fwrite (logR, sizeof (*logR), n_logR, opact_file) == (size_t) n_logR &&
+       fwrite (logk, sizeof (*logk), (size_t) n_logT * n_logR, opact_file) == (size_t) n_logT * n_logR;
+  ok = !fclose (opact_file) && ok;
+
+  return ok ? SUCCESS : FAILURE;
+}
+
+// Initialise the 2D interpolation routines
 void
-init_gsl_interp (void)
+init_interp_2d (void)
 {
-  const gsl_interp2d_type *T = gsl_interp2d_bilinear;
+  int type = INTERP_BILINEAR;
+  char kernel_choice[LINE_LEN], kernel_name[LINE_LEN];
 
-  Log ("\t- Initialising GSL interpolation routines\n");
+  Log ("\t- Initialising 2D interpolation routines\n");
 
   /*
-   * Choose the type of simple 2D interpolation -- 2D splines are also possible
+   * Choose the type of simple 2D interpolation -- bicubic interpolation is
+   * also possible
    */
 
   strcpy (gsl_interp_choice, "bilinear");
   get_string ("gsl_interpolation", gsl_interp_choice);
   if (!(strcmp (gsl_interp_choice, "bilinear")))
-    T = gsl_interp2d_bilinear;
+    type = INTERP_BILINEAR;
   else if (!(strcmp (gsl_interp_choice, "bicubic")))
-    T = gsl_interp2d_bicubic;
+    type = INTERP_BICUBIC;
   else
-    Exit (UNKNOWN_PARAMETER, "Unknown interpolation choice for GSL\n");
+    Exit (UNKNOWN_PARAMETER, "Unknown interpolation choice for 2D interpolation\n");
 
   /*
-   * Allocate memory for the GSL interpolation routines
+   * Initialise the interpolation routine. The spacing of logR and logT is
+   * checked here, so that the cell in the table can be found without having to
+   * search the table each time
    */
 
-  interp = gsl_interp2d_alloc (T, N_LOG_R, N_LOG_T);
-  logR_accel = gsl_interp_accel_alloc ();
-  logT_accel = gsl_interp_accel_alloc ();
-
-  #ifdef DEBUG
-    Log("logRMO before being read into gsl\n");
-    for (int i = 0; i < N_LOG_T / 5; i++)
-    {
-      int ncols = 0;
-      for (int j = 0; j < N_LOG_R; j++)
-      {
-        if (logRMO_table[i2d (i, j)] != 0)
-          ncols++;
-        Log ("%+f ", logRMO_table[i2d (i, j)]);
-      }
-      Log ("\n");
-      if (ncols != N_LOG_R)
-        Log ("panic, ncols != N_LOG_R");
-    }
-  #endif
+  interp2d_init (&interp, type, logR_table, n_log_R, logT_table, n_log_T, logRMO_table);
 
   /*
-   * Initialise the interpolation routine
+   * Choose the kernel used to find the opacity for every cell at once. By
+   * default, the fastest kernel supported by the CPU is used
    */
 
-  gsl_interp2d_init (interp, logR_table, logT_table, logRMO_table, N_LOG_R, N_LOG_T);
-
-  #ifdef DEBUG
-    Log ("logRMO within gsl\n");
-    for (int y = 0; y < N_LOG_T / 5; y++)
-    {
-      for (int x = 0; x < N_LOG_R; x++)
-      {
-        double logRMO = gsl_interp2d_get (interp, logRMO_table, x, y);
-        Log ("%+f ", logRMO);
-      }
-      Log ("\n");
-    }
-  #endif
-
-/* ************************************************************************** */
-  /*
-   * Temporary hacky fix for GSL until I work out why the diagonal elements in
-   * the GSL routine are read in as being 0. Most likely a weird memory issues
-   * with incorrect dimensions or some other awful thing
-   *
-   * TODO: figure out why GSL isn't working how I want it to
-   */
-
-  size_t x, y;
-
-  for (y = 0; y < N_LOG_T; y++)
-  {
-    for (x = 0; x < N_LOG_R; x++)
-    {
-      gsl_interp2d_set (interp, logRMO_table, x, y, logRMO_table[i2d ((int) y, (int) x)]);
-    }
-  }
+  strcpy (kernel_choice, "auto");
+  get_optional_string ("opacity_kernel", kernel_choice);
+  opac_kernel = select_opac_kernel (kernel_choice, kernel_name);
+  Log ("\t- Using the %s opacity kernel\n", kernel_name);
 }
 
 // Clean up the opacity tables
@@ -248,17 +389,52 @@ clean_up_opac_tables (void)
   free (logR_table);
   free (logT_table);
   free (logRMO_table);
+  logR_table = logT_table = logRMO_table = NULL;
+  n_log_T = n_log_R = 0;
+  loaded_2d_table[0] = '\0';
   Log_verbose (" - Opacity table cleaned up successfully\n");
 }
 
-// Clean up the GSL stuff
+// Clean up the 2D interpolation routines
 void
-clean_up_gsl (void)
+clean_up_interp_2d (void)
 {
-  gsl_interp2d_free (interp);
-  gsl_interp_accel_free (logR_accel);
-  gsl_interp_accel_free (logT_accel);
-  Log_verbose (" - GSL routines cleaned up successfully\n");
+  interp2d_free (&interp);
+  Log_verbose (" - 2D interpolation routines cleaned up successfully\n");
+}
+
+// Read in an opacity table, unless it is already in memory. The batch runner
+// loads the tables before the runs are started, so each run does not have to
+// read them in again. Only one 2D table can be in memory at once
+void
+load_opacity_table (char *table_name)
+{
+  if (!strcmp (table_name, OPAL_FILENAME))
+  {
+    if (opal_tables)
+    {
+      Log ("\t- Using Opal tables already in memory\n");
+      return;
+    }
+
+    Log ("\t- Checking for Opal Opacity Table GN93hz\n");
+    if (access (OPAL_FILENAME, F_OK) == -1)
+      Exit (15, "%s not found in current directory.\n", OPAL_FILENAME);
+    init_opal_tables ();
+  }
+  else
+  {
+    if (!strcmp (table_name, loaded_2d_table))
+    {
+      Log ("\t- Using opacity table %s already in memory\n", table_name);
+      return;
+    }
+
+    if (logRMO_table)
+      clean_up_opac_tables ();
+    read_2d_opact_table (table_name);
+    strcpy (loaded_2d_table, table_name);
+  }
 }
 
 // Initialise the opacity table which is going to be used
@@ -266,9 +442,10 @@ void
 init_opacity_table (void)
 {
   /*
-   * If the opacity table is the default Opal table, then, for now, we will
-   * use the Opal Fortran routines
-   *    - OPAL_FILENAME = GN93hz
+   * If the opacity table is the default Opal table, OPAL_FILENAME = GN93hz,
+   * then the Opal interpolation is done by the C port in opal.c. The Fortran
+   * routines only read in and smooth the tables, and are not used at all when
+   * the tables are mapped from a valid GN93hz.cache
    */
 
   get_string ("opacity_table", geo.opacity_table_filepath);
@@ -279,29 +456,60 @@ init_opacity_table (void)
 
   if (modes.opal)
   {
-    Log ("\t- Checking for Opal Opacity Table GN93hz\n");
-    if (access (OPAL_FILENAME, F_OK) == -1)
-      Exit (15, "%s not found in current directory.\n", OPAL_FILENAME);
-
     get_double ("X", &geo.X);
     get_double ("Z", &geo.Z);
     if (geo.X + geo.Z > 1)
       Exit (INVALID_VALUE, "Invalid choice for X =%f or Z = %f. X + Z <= 1.0",
             geo.X, geo.Z);
     geo.Y = 1.0 - geo.X - geo.Z;
+
+    load_opacity_table (geo.opacity_table_filepath);
+
+    /*
+     * As the composition is fixed for the entire run, the X and Z
+     * interpolation can optionally be done once at the start of the run
+     */
+
+    get_optional_int ("opal_fixed_composition", &modes.opal_slice);
+    if (modes.opal_slice)
+      init_opal_slice ();
   }
   else if (modes.low_temp)
   {
-    read_2d_opact_table (geo.opacity_table_filepath);
-    init_gsl_interp ();
+    load_opacity_table (geo.opacity_table_filepath);
+    init_interp_2d ();
   }
   else
     Exit (UNKNOWN_MODE, "Unknown opacity mode\n");
 }
 
-// Interpolate using the 2D GSL interpolation routines
+// Interpolate using the 2D interpolation routines
 void
 opac_2d (double logT, double logR, double *logRMO)
 {
-  *logRMO = gsl_interp2d_eval (interp, logR_table, logT_table, logRMO_table, logR, logT, logR_accel, logT_accel);
+  *logRMO = interp2d_eval (&interp, logR, logT);
+}
+
+// Interpolate using the 2D interpolation routines, also returning the
+// derivatives dlog(kappa)/dlog(T) and dlog(kappa)/dlog(R)
+void
+opac_2d_deriv (double logT, double logR, double *logRMO, double *dlogk_dlogT, double *dlogk_dlogR)
+{
+  interp2d_eval_deriv (&interp, logR, logT, logRMO, dlogk_dlogR, dlogk_dlogT);
+}
+
+// Find the opacity for n temperatures and densities at once. Returns the index
+// of the first element outside of the opacity table, or -1 if all of the
+// elements are within the table
+int
+opac_2d_batch (int n, const double *T, const double *rho, double *kappa)
+{
+  OpacBounds bounds;
+
+  bounds.logT_min = min_log_T;
+  bounds.logT_max = max_log_T;
+  bounds.logR_min = min_log_R;
+  bounds.logR_max = max_log_R;
+
+  return opac_kernel (&interp, &bounds, n, T, rho, kappa);
 }
@@ -11,6 +11,14 @@
  *
  * @details
  *
+ * The first line of the table with numbers on it holds the values of logR,
+ * after a placeholder for the logT column, and each following line holds a
+ * value of logT followed by log(kappa) for each logR. Any lines before this
+ * which have no numbers on them, i.e. the logR and logT labels, are skipped.
+ * The number of logT and logR values is found from the table. Tables can also
+ * be in the binary format described below, which is detected from the first
+ * eight bytes of the file.
+ *
  * ************************************************************************** */
 
 
@@ -18,23 +26,13 @@
 #define LINE_LEN 128
 
 /*
- * Constants for the maximum and minimum values of logR and logT in the opacity
- * table
- */
-
-#define MIN_LOG_R -7.0
-#define MAX_LOG_R 1.0
-#define MIN_LOG_T 3.2
-#define MAX_LOG_T 8.5
-
-/*
- * Constants relating to the dimensions for the 2D opacity table
+ * The dimensions of the 2D opacity table and the range of logR and logT which
+ * it covers. These are found from the table when it is read in
  */
 
-#define N_LOG_T 81
-#define N_LOG_R 17
-#define N_ROWS (N_LOG_T + 1)
-#define N_COLS (N_LOG_R + 1)
+int n_log_T, n_log_R;
+double min_log_R, max_log_R;
+double min_log_T, max_log_T;
 
 /*
  * Global variables for interpolation and opacity
@@ -43,13 +41,40 @@
 char gsl_interp_choice[LINE_LEN];
 
 // Pointers for tables
-double *buffer;
 double *logR_table, *logT_table, *logRMO_table;
 
 /*
- * This function is defined here because so it isn't used implicitly
+ * The binary format of the 2D opacity table, as written by snake-mktable. The
+ * header is TABLE_BIN_HEADER_SIZE bytes, in the byte order of the machine
+ * which wrote the file, and is followed by float64 arrays of logT[n_log_T],
+ * logR[n_log_R] and log(kappa)[n_log_T][n_log_R], with logR varying fastest
+ */
+
+#define TABLE_BIN_MAGIC "SNAKETAB"
+#define TABLE_BIN_ENDIAN_MARK 0x01020304
+#define TABLE_BIN_VERSION 1
+#define TABLE_BIN_HEADER_SIZE 64
+
+typedef struct TableBinHeader
+{
+  char magic[8];
+  int endian;
+  int version;
+  int header_size;
+  int n_log_T;
+  int n_log_R;
+  int pad;
+  double X, Z;
+} TableBinHeader;
+
+/*
+ * These functions are defined here because so they aren't used implicitly
  */
 
-void init_gsl_interp (void);
+void init_interp_2d (void);
+int write_2d_opact_table_text (char *file_path, const double *logT, int n_logT, const double *logR, int n_logR,
+                               const double *logk);
+int write_2d_opact_table_binary (char *file_path, const double *logT, int n_logT, const double *logR, int n_logR,
+                                 const double *logk, double X, double Z);
 
 #include "snake_functions.h"
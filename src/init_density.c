@@ -12,13 +12,77 @@
  *
  * ************************************************************************** */
 
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "snake.h"
 
-FILE *density;
+/*
+ * The binary format of the density file. The header is DENSITY_BIN_HEADER_SIZE
+ * bytes, in the byte order of the machine which wrote the file, and is followed
+ * by n_cells pairs of float64 (z, rho). As with the text format, z can be in
+ * ascending or descending order
+ */
+
+#define DENSITY_BIN_MAGIC "SNAKERHO"
+#define DENSITY_BIN_ENDIAN_MARK 0x01020304
+#define DENSITY_BIN_VERSION 1
+#define DENSITY_BIN_HEADER_SIZE 32
+
+typedef struct DensityBinHeader
+{
+  char magic[8];
+  int32_t endian;
+  int32_t version;
+  int32_t header_size;
+  int32_t pad;
+  int64_t n_cells;
+} DensityBinHeader;
+
+/*
+ * The largest number of digits, and power of ten, for which parse_double can
+ * convert a number exactly using a single multiplication or division
+ */
+
+#define FAST_MAX_DIGITS 19
+#define FAST_MAX_POW10 22
+#define FAST_MAX_MANTISSA 9007199254740992ULL
+
+/*
+ * The ways the density profile from file can be put onto the grid: a cell for
+ * each point in the file, or resampled onto nz_cells cells which are uniformly
+ * spaced in z or log(tau)
+ */
+
+enum DENSITY_RESAMPLE
+{
+  RESAMPLE_NONE,
+  RESAMPLE_Z,
+  RESAMPLE_LOG_TAU
+};
+
+// Allocate a zeroed array, aligned to GRID_ALIGN bytes, for one quantity of
+// the grid
+void *
+allocate_grid_array (size_t element_size)
+{
+  void *array = NULL;
+  size_t mem_req = element_size * (size_t) geo.nz_cells;
+
+  if (posix_memalign (&array, GRID_ALIGN, mem_req))
+    Exit (MEM_ALLOC_ERR, "Could not allocate memory for grid of size %li\n", (long) mem_req);
+  memset (array, 0, mem_req);
+
+  return array;
+}
 
 // Allocate memory for the grid structure
 void
@@ -26,114 +90,520 @@ allocate_1d_grid (void)
 {
   long mem_req;
 
-  mem_req = geo.nz_cells * sizeof (*grid);
+  mem_req = geo.nz_cells * (sizeof (*grid.n) + 10 * sizeof (*grid.z));
+
+  grid.n = allocate_grid_array (sizeof (*grid.n));
+  grid.z = allocate_grid_array (sizeof (*grid.z));
+  grid.T = allocate_grid_array (sizeof (*grid.T));
+  grid.T_old = allocate_grid_array (sizeof (*grid.T_old));
+  grid.kappa = allocate_grid_array (sizeof (*grid.kappa));
+  grid.rho = allocate_grid_array (sizeof (*grid.rho));
+  grid.cell_tau = allocate_grid_array (sizeof (*grid.cell_tau));
+  grid.tau_depth = allocate_grid_array (sizeof (*grid.tau_depth));
+  grid.dlnk_dlnT = allocate_grid_array (sizeof (*grid.dlnk_dlnT));
+  grid.T_kappa = allocate_grid_array (sizeof (*grid.T_kappa));
+  grid.rho_kappa = allocate_grid_array (sizeof (*grid.rho_kappa));
 
-  if (!(grid = calloc ((size_t) geo.nz_cells, sizeof (*grid))))
-    Exit (MEM_ALLOC_ERR, "Could not allocate memory for grid of size %li\n", mem_req);
   Log ("\t\t- Allocated %1.2e bytes for %1.2e grid cells\n", (double) mem_req, (double) geo.nz_cells);
 }
 
-// Figure out the number of grid cell points in the density file
-size_t
-get_num_cells (void)
+// Free the memory for the grid structure
+void
+free_1d_grid (void)
+{
+  free (grid.n);
+  free (grid.z);
+  free (grid.T);
+  free (grid.T_old);
+  free (grid.kappa);
+  free (grid.rho);
+  free (grid.cell_tau);
+  free (grid.tau_depth);
+  free (grid.dlnk_dlnT);
+  free (grid.T_kappa);
+  free (grid.rho_kappa);
+}
+
+// Convert the number at the start of p, which ends before end, with strtod.
+// This is used for the numbers which parse_double can not convert exactly.
+// Returns the position after the number, or NULL if there is no number
+const char *
+parse_double_slow (const char *p, const char *end, double *value)
+{
+  char number[LINE_LEN], *number_end;
+  size_t len = 0;
+
+  while (p + len < end && len < LINE_LEN - 1 && p[len] != ' ' && p[len] != '\t' && p[len] != '\r' && p[len] != '\n')
+    len++;
+  memcpy (number, p, len);
+  number[len] = '\0';
+
+  *value = strtod (number, &number_end);
+  if (number_end == number)
+    return NULL;
+
+  return p + (number_end - number);
+}
+
+// Convert the number at the start of p, which ends before end. Numbers with at
+// most FAST_MAX_DIGITS significant digits and a small exponent, which is what
+// is usually written by a hydro code, are converted with one multiplication or
+// division of two exactly representable numbers, which gives the same result
+// as strtod. Other numbers, and inf or nan, are converted by strtod. Returns
+// the position after the number, or NULL if there is no number
+const char *
+parse_double (const char *p, const char *end, double *value)
 {
-  size_t n_cells = 0;
-  char line[LINE_LEN];
+  int negative = FALSE, n_digits = 0, any_digits = FALSE, exponent = 0, exp_value = 0, exp_negative = FALSE;
+  uint64_t mantissa = 0;
+  const char *start = p;
+  static const double pow10[FAST_MAX_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  if (p < end && (*p == '+' || *p == '-'))
+    negative = *p++ == '-';
+
+  for (; p < end && *p >= '0' && *p <= '9'; p++, any_digits = TRUE)
+  {
+    if (n_digits == FAST_MAX_DIGITS)
+      return parse_double_slow (start, end, value);
+    mantissa = 10 * mantissa + (*p - '0');
+    n_digits += mantissa > 0;
+  }
 
-  while (fgets (line, LINE_LEN, density) != NULL)
+  if (p < end && *p == '.')
   {
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
-    n_cells++;
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, any_digits = TRUE)
+    {
+      if (n_digits == FAST_MAX_DIGITS)
+        return parse_double_slow (start, end, value);
+      mantissa = 10 * mantissa + (*p - '0');
+      n_digits += mantissa > 0;
+      exponent--;
+    }
   }
 
+  if (!any_digits || (p < end && (*p == 'x' || *p == 'X')))
+    return parse_double_slow (start, end, value);
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    p++;
+    if (p < end && (*p == '+' || *p == '-'))
+      exp_negative = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9')
+      return parse_double_slow (start, end, value);
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+      if (exp_value < 10000)
+        exp_value = 10 * exp_value + (*p - '0');
+    exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  if (mantissa > FAST_MAX_MANTISSA || exponent < -FAST_MAX_POW10 || exponent > FAST_MAX_POW10)
+    return parse_double_slow (start, end, value);
+
+  *value = exponent < 0 ? (double) mantissa / pow10[-exponent] : (double) mantissa * pow10[exponent];
+  if (negative)
+    *value = -*value;
+
+  return p;
+}
+
+// Skip over spaces and tabs
+const char *
+skip_blanks (const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+
+  return p;
+}
+
+// Parse the text density file in the n_bytes at map in a single pass. The (z,
+// rho) pairs are returned in a new array, in the order they are in the file.
+// Returns the number of pairs
+long
+parse_density_text (const char *map, size_t n_bytes, char *filepath, double **pairs)
+{
+  int line_num = 0;
+  long n_cells = 0, n_alloc;
+  const char *p = map, *end = map + n_bytes, *line_end, *first_end;
+
   /*
-   * Send the file pointer back to the beginning of the file
+   * The lines of density files are usually all the same length, so the length
+   * of the first line is used to guess how many cells there are
    */
 
-  rewind (density);
+  first_end = memchr (map, '\n', n_bytes);
+  n_alloc = (long) (n_bytes / (first_end ? (size_t) (first_end - map) + 1 : n_bytes)) + 16;
+  if (!(*pairs = malloc (2 * n_alloc * sizeof (**pairs))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory to read density file %s\n", filepath);
+
+  for (; p < end; p = line_end + 1)
+  {
+    line_num++;
+    if (!(line_end = memchr (p, '\n', end - p)))
+      line_end = end;
+    if (*p == '#' || *p == '\r' || *p == '\n')
+      continue;
+
+    if (n_cells == n_alloc)
+    {
+      n_alloc *= 2;
+      if (!(*pairs = realloc (*pairs, 2 * n_alloc * sizeof (**pairs))))
+        Exit (MEM_ALLOC_ERR, "Unable to allocate memory to read density file %s\n", filepath);
+    }
+
+    if (!(p = parse_double (skip_blanks (p, line_end), line_end, &(*pairs)[2 * n_cells])) ||
+        (p < line_end && *p != ' ' && *p != '\t') ||
+        !parse_double (skip_blanks (p, line_end), line_end, &(*pairs)[2 * n_cells + 1]))
+      Exit (FILE_IN_ERR, "Syntax error on line %i in density file\n", line_num);
+
+    n_cells++;
+  }
 
   return n_cells;
 }
 
-// Reverse the order of an array -- assuming that it is ordered in some way
-void
-reverse_sort (void)
+// Check the header of the binary density file in the n_bytes at map. Returns
+// the number of (z, rho) pairs, which follow the header
+long
+check_density_binary (const char *map, size_t n_bytes, char *filepath)
 {
-  int i, j;
-  double *orig_z, *orig_rho;
+  DensityBinHeader header;
+
+  if (n_bytes < DENSITY_BIN_HEADER_SIZE)
+    Exit (FILE_IN_ERR, "Binary density file %s is too short\n", filepath);
+  memcpy (&header, map, sizeof (header));
+
+  if (header.endian != DENSITY_BIN_ENDIAN_MARK)
+    Exit (FILE_IN_ERR, "Binary density file %s was written on a machine with a different byte order\n", filepath);
+  if (header.version != DENSITY_BIN_VERSION || header.header_size != DENSITY_BIN_HEADER_SIZE)
+    Exit (FILE_IN_ERR, "Binary density file %s has an unknown version\n", filepath);
+  if (header.n_cells < 0 || (uint64_t) header.n_cells != (n_bytes - DENSITY_BIN_HEADER_SIZE) / (2 * sizeof (double)) ||
+      (n_bytes - DENSITY_BIN_HEADER_SIZE) % (2 * sizeof (double)))
+    Exit (FILE_IN_ERR, "Binary density file %s should have %li cells, but is the wrong size\n", filepath,
+          (long) header.n_cells);
+
+  return (long) header.n_cells;
+}
 
-  orig_z = calloc (geo.nz_cells, sizeof (*orig_z));
-  orig_rho = calloc (geo.nz_cells, sizeof (*orig_rho));
+// Copy the n (z, rho) pairs in cells into z and rho in ascending order of z. If
+// the pairs are in descending order rather than ascending, they are copied in
+// reverse
+void
+copy_ascending (const double *cells, long n, double *z, double *rho)
+{
+  long i, first = 0, step = 1;
 
-  for (i = 0; i < geo.nz_cells; i++)
+  if (n > 1 && cells[0] > cells[2])
   {
-    orig_z[i] = grid[i].z;
-    orig_rho[i] = grid[i].rho;
+    first = n - 1;
+    step = -1;
   }
 
-  for (i = geo.nz_cells - 1, j = 0; i >= 0; i--, j++)
+  for (i = 0; i < n; i++)
   {
-    grid[j].z = orig_z[i];
-    grid[j].rho = orig_rho[i];
+    z[i] = cells[2 * (first + step * i)];
+    rho[i] = cells[2 * (first + step * i) + 1];
   }
+}
+
+// The slope at the end of a monotone cubic interpolant, where h0 and s0 are
+// the width and slope of the interval at the end and h1 and s1 are for the
+// interval next to it. The slope is limited so the interpolant does not
+// overshoot
+double
+monotone_end_slope (double h0, double h1, double s0, double s1)
+{
+  double d = ((2.0 * h0 + h1) * s0 - h0 * s1) / (h0 + h1);
+
+  if (d * s0 <= 0.0)
+    return 0.0;
+  if (s0 * s1 <= 0.0 && fabs (d) > fabs (3.0 * s0))
+    return 3.0 * s0;
 
-  free (orig_z);
-  free (orig_rho);
+  return d;
 }
 
-// Read in the density from file and assign to the grid cells
-// TODO: GSL interpolation for an arbitrary number of grid cells
+// Find the slopes d at the n knots of a monotone piecewise cubic Hermite
+// interpolant of y(x), using the method of Fritsch and Butland. The slope is 0
+// where y has a local extremum, so the interpolant never has an extremum
+// between the knots. x must be strictly increasing
 void
-density_from_file (char *filepath)
+monotone_slopes (const double *x, const double *y, int n, double *d)
 {
   int i;
-  int cell = 0, line_num = 0;
-  char line[LINE_LEN];
-  double z_coord, rho;
+  double h0, h1, s0, s1, w0, w1;
 
-  if (!(density = fopen (filepath, "r")))
-    Exit (FILE_OPEN_ERR, "Unable to open density file %s\n", filepath);
+  if (n == 2)
+  {
+    d[0] = d[1] = (y[1] - y[0]) / (x[1] - x[0]);
+    return;
+  }
 
-  /*
-   * Get the number of density and z coordinates, initialise the grid and read
-   * in z and rho from file
-   */
+  for (i = 1; i < n - 1; i++)
+  {
+    h0 = x[i] - x[i - 1];
+    h1 = x[i + 1] - x[i];
+    s0 = (y[i] - y[i - 1]) / h0;
+    s1 = (y[i + 1] - y[i]) / h1;
+    if (s0 * s1 <= 0.0)
+    {
+      d[i] = 0.0;
+    }
+    else
+    {
+      w0 = 2.0 * h1 + h0;
+      w1 = h1 + 2.0 * h0;
+      d[i] = (w0 + w1) / (w0 / s0 + w1 / s1);
+    }
+  }
 
-  geo.nz_cells = get_num_cells ();
+  d[0] = monotone_end_slope (x[1] - x[0], x[2] - x[1], (y[1] - y[0]) / (x[1] - x[0]),
+                             (y[2] - y[1]) / (x[2] - x[1]));
+  d[n - 1] = monotone_end_slope (x[n - 1] - x[n - 2], x[n - 2] - x[n - 3],
+                                 (y[n - 1] - y[n - 2]) / (x[n - 1] - x[n - 2]),
+                                 (y[n - 2] - y[n - 3]) / (x[n - 2] - x[n - 3]));
+}
 
-  allocate_1d_grid ();
+// Evaluate the monotone interpolant of y(x), with slopes d, at the ni points xi
+// which must be in ascending order and within x
+void
+monotone_eval (const double *x, const double *y, const double *d, int n, const double *xi, int ni, double *yi)
+{
+  int i, k = 0;
+  double h, t, t2, t3;
 
-  for (i = 0; i < geo.nz_cells; i++)
+  for (i = 0; i < ni; i++)
   {
-    grid[i].n = i;
-    grid[i].T = grid[i].T_old = geo.T_init;
+    while (k < n - 2 && xi[i] > x[k + 1])
+      k++;
+
+    h = x[k + 1] - x[k];
+    t = (xi[i] - x[k]) / h;
+    t2 = t * t;
+    t3 = t2 * t;
+    yi[i] = (2.0 * t3 - 3.0 * t2 + 1.0) * y[k] + (t3 - 2.0 * t2 + t) * h * d[k] + (3.0 * t2 - 2.0 * t3) * y[k + 1] +
+            (t3 - t2) * h * d[k + 1];
   }
+}
+
+// Find log10 of the optical depth at each point of the density profile, at the
+// initial temperature. The optical depth is summed from the top of the profile
+// down, using the trapezium rule between points
+void
+profile_log_tau (const double *z, const double *rho, int n, char *filepath, double *log_tau)
+{
+  int i, bad_point;
+  double *T, *kappa, tau;
+
+  T = malloc (n * sizeof (*T));
+  kappa = malloc (n * sizeof (*kappa));
+  if (!T || !kappa)
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory to resample density file %s\n", filepath);
 
-  while (fgets (line, LINE_LEN, density) != NULL)
+  for (i = 0; i < n; i++)
   {
-    line_num++;
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
+    if (rho[i] <= 0)
+      Exit (INVALID_VALUE, "Density file %s must have rho > 0 to be resampled in log(tau)\n", filepath);
+    T[i] = geo.T_init;
+  }
 
-    if (sscanf (line, "%lf %lf", &z_coord, &rho) != 2)
-      Exit (FILE_IN_ERR, "Syntax error on line %i in density file\n", line_num);
+  if ((bad_point = find_opacities (n, T, rho, kappa)) >= 0)
+    Exit (TABLE_BOUNDS, "Point %i of density file %s, rho = %e, is outside of the opacity table at T_init\n",
+          bad_point, filepath, rho[bad_point]);
 
-    grid[cell].z = z_coord;
-    grid[cell].rho = rho;
-    cell++;
+  tau = (z[n - 1] - z[n - 2]) * rho[n - 1] * kappa[n - 1];
+  log_tau[n - 1] = log10 (tau);
+
+  for (i = n - 2; i > -1; i--)
+  {
+    tau += 0.5 * (z[i + 1] - z[i]) * (rho[i] * kappa[i] + rho[i + 1] * kappa[i + 1]);
+    log_tau[i] = log10 (tau);
+    if (!(log_tau[i] > log_tau[i + 1]))
+      Exit (INVALID_VALUE, "The optical depth of density file %s does not increase at point %i. Try resampling in z\n",
+            filepath, i);
   }
 
+  free (T);
+  free (kappa);
+}
+
+// Resample the density profile of n points onto the grid, so the cells are
+// uniformly spaced in z or log(tau). The first and last cell are at the first
+// and last point of the profile. z must be strictly increasing
+void
+resample_density (const double *z, const double *rho, int n, int mode, char *filepath)
+{
+  int i;
+  double *x, *y, *d, *target;
+
+  x = malloc (n * sizeof (*x));
+  y = malloc (n * sizeof (*y));
+  d = malloc (n * sizeof (*d));
+  target = malloc (geo.nz_cells * sizeof (*target));
+  if (!x || !y || !d || !target)
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory to resample density file %s\n", filepath);
+
+  if (mode == RESAMPLE_Z)
+  {
+    for (i = 0; i < geo.nz_cells; i++)
+      grid.z[i] = z[0] + i * (z[n - 1] - z[0]) / (geo.nz_cells - 1);
+    grid.z[geo.nz_cells - 1] = z[n - 1];
+  }
+  else
+  {
+    /*
+     * z is interpolated as a function of log(tau). As log(tau) decreases with
+     * z, the profile is reversed so that log(tau) is increasing
+     */
+
+    profile_log_tau (z, rho, n, filepath, d);
+    for (i = 0; i < n; i++)
+    {
+      x[i] = d[n - 1 - i];
+      y[i] = z[n - 1 - i];
+    }
+
+    for (i = 0; i < geo.nz_cells; i++)
+      target[i] = x[0] + i * (x[n - 1] - x[0]) / (geo.nz_cells - 1);
+    target[geo.nz_cells - 1] = x[n - 1];
+
+    monotone_slopes (x, y, n, d);
+    monotone_eval (x, y, d, n, target, geo.nz_cells, target);
+    for (i = 0; i < geo.nz_cells; i++)
+      grid.z[i] = target[geo.nz_cells - 1 - i];
+  }
+
+  monotone_slopes (z, rho, n, d);
+  monotone_eval (z, rho, d, n, grid.z, geo.nz_cells, grid.rho);
+
+  free (x);
+  free (y);
+  free (d);
+  free (target);
+}
+
+// Read in the density from file and assign to the grid cells. The file is
+// memory mapped, and is either the text format of a z and rho on each line,
+// or the binary format described above, which is detected by the first eight
+// bytes of the file. Unless density_resample is given, there is a cell for
+// each point in the file
+void
+density_from_file (char *filepath)
+{
+  int i, fd, binary, n_target, mode = RESAMPLE_NONE;
+  long n_cells;
+  char *map, resample[LINE_LEN];
+  double *pairs = NULL, *z, *rho;
+  const double *cells;
+  struct stat file_stat;
+
+  strcpy (resample, "none");
+  get_optional_string ("density_resample", resample);
+  if (!strcmp (resample, "none"))
+    mode = RESAMPLE_NONE;
+  else if (!strcmp (resample, "z"))
+    mode = RESAMPLE_Z;
+  else if (!strcmp (resample, "log_tau"))
+    mode = RESAMPLE_LOG_TAU;
+  else
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for density_resample: %s. Allowed: none, z or log_tau\n", resample);
+
+  if ((fd = open (filepath, O_RDONLY)) == -1)
+    Exit (FILE_OPEN_ERR, "Unable to open density file %s\n", filepath);
+  if (fstat (fd, &file_stat))
+    Exit (FILE_IN_ERR, "Unable to find size of density file %s\n", filepath);
+  if (!file_stat.st_size)
+    Exit (FILE_IN_ERR, "Density file %s is empty\n", filepath);
+
+  map = mmap (NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (close (fd))
+    Exit (FILE_CLOSE_ERR, "Unable to close density file %s\n", filepath);
+  if (map == MAP_FAILED)
+    Exit (FILE_IN_ERR, "Unable to map density file %s\n", filepath);
+  madvise (map, file_stat.st_size, MADV_SEQUENTIAL);
+
   /*
-   * If the density grid is in descending order rather than ascending, reverse
-   * the order
+   * The binary format can be used in place, whereas the text format is parsed
+   * into an array of (z, rho) pairs with the same layout
    */
 
-  if (grid[0].z > grid[1].z)
-    reverse_sort ();
+  binary = (size_t) file_stat.st_size >= sizeof (DENSITY_BIN_MAGIC) - 1 &&
+           !memcmp (map, DENSITY_BIN_MAGIC, sizeof (DENSITY_BIN_MAGIC) - 1);
+  if (binary)
+  {
+    n_cells = check_density_binary (map, file_stat.st_size, filepath);
+    cells = (const double *) (map + DENSITY_BIN_HEADER_SIZE);
+  }
+  else
+  {
+    n_cells = parse_density_text (map, file_stat.st_size, filepath, &pairs);
+    cells = pairs;
+  }
 
-  if (fclose (density))
-    Exit (FILE_CLOSE_ERR, "Unable to close density file %s\n", filepath);
+  if (n_cells < 1)
+    Exit (FILE_IN_ERR, "No cells in density file %s\n", filepath);
+  if (n_cells > INT_MAX)
+    Exit (FILE_IN_ERR, "Too many cells in density file %s\n", filepath);
+  Log_verbose ("\t\t- Read %li points from %s density file %s\n", n_cells, binary ? "binary" : "text", filepath);
+
+  if (mode == RESAMPLE_NONE)
+  {
+    /*
+     * Initialise the grid and copy z and rho straight into it
+     */
+
+    geo.nz_cells = (int) n_cells;
+    allocate_1d_grid ();
+    copy_ascending (cells, n_cells, grid.z, grid.rho);
+  }
+  else
+  {
+    /*
+     * Otherwise the profile is copied out in ascending order, and then
+     * resampled onto nz_cells cells
+     */
+
+    get_int ("nz_cells", &n_target);
+    if (n_target < 2)
+      Exit (UNKNOWN_PARAMETER, "Invalid value for nz_cells: nz_cells > 1 to resample the density file\n");
+    if (n_cells < 2)
+      Exit (FILE_IN_ERR, "Density file %s needs at least two points to be resampled\n", filepath);
+
+    z = malloc (n_cells * sizeof (*z));
+    rho = malloc (n_cells * sizeof (*rho));
+    if (!z || !rho)
+      Exit (MEM_ALLOC_ERR, "Unable to allocate memory to resample density file %s\n", filepath);
+    copy_ascending (cells, n_cells, z, rho);
+
+    for (i = 1; i < n_cells; i++)
+      if (!(z[i] > z[i - 1]))
+        Exit (FILE_IN_ERR, "z in density file %s must be strictly increasing or decreasing to be resampled\n",
+              filepath);
+
+    geo.nz_cells = n_target;
+    allocate_1d_grid ();
+    resample_density (z, rho, (int) n_cells, mode, filepath);
+    Log ("\t\t- Resampled %li points onto %i cells uniform in %s\n", n_cells, geo.nz_cells,
+         mode == RESAMPLE_Z ? "z" : "log(tau)");
+
+    free (z);
+    free (rho);
+  }
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    grid.n[i] = i;
+    grid.T[i] = grid.T_old[i] = geo.T_init;
+  }
+
+  free (pairs);
+  if (munmap (map, file_stat.st_size))
+    Exit (FILE_CLOSE_ERR, "Unable to unmap density file %s\n", filepath);
 }
 
 // A density equation I found in some lecture notes
@@ -161,13 +631,14 @@ standard_density_profile (void)
   if (geo.irho < 0)
     Exit (UNKNOWN_PARAMETER, "Invalid value for irho: irho >= 0\n");
 
+  geo.hz = geo.z_max / geo.nz_cells;
   allocate_1d_grid ();
 
   for (i = 0; i < geo.nz_cells; i++)
   {
-    grid[i].n = i;
-    grid[i].T = grid[i].T_old = geo.T_init;
-    grid[i].z = i * geo.hz;
-    grid[i].rho = density_profile_disk_height (grid[i].z);
+    grid.n[i] = i;
+    grid.T[i] = grid.T_old[i] = geo.T_init;
+    grid.z[i] = i * geo.hz;
+    grid.rho[i] = density_profile_disk_height (grid.z[i]);
   }
 }
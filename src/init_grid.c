@@ -24,8 +24,6 @@ get_temp_params (void)
   get_double ("T_disk", &geo.T_disk);
   if (geo.T_disk < 0)
     Exit (UNKNOWN_PARAMETER, "Invalid value for T_disk: T_disk >= 0\n");
-
-  geo.hz = geo.z_max / geo.nz_cells;
 }
 
 // Main control function for initialising the grid cells
@@ -34,9 +32,22 @@ init_grid (void)
 {
   Log_verbose ("\t\t- Initialising grid cells\n");
 
+  profile_start (PHASE_GRID_INIT);
   get_temp_params ();
+  profile_stop (PHASE_GRID_INIT);
+
+  /*
+   * The opacity table is initialised first, as it is needed to resample the
+   * density profile uniformly in optical depth
+   */
+
+  profile_start (PHASE_TABLE_LOAD);
+  init_opacity_table ();
+  profile_stop (PHASE_TABLE_LOAD);
 
-  if (check_for_parameter ("opacity_table"))
+  profile_start (PHASE_GRID_INIT);
+
+  if (check_for_parameter ("density_file"))
   {
     Log ("\t\t- Initialising density profile from file\n");
     get_string ("density_file", geo.density_filepath);
@@ -48,17 +59,29 @@ init_grid (void)
     standard_density_profile ();
   }
 
-  Log ("\t\t- Atmosphere height %e cm\n", grid[geo.nz_cells - 1].z);
+  Log ("\t\t- Atmosphere height %e cm\n", grid.z[geo.nz_cells - 1]);
 
   /*
-   * Update the opacity and optical depth for each cell. We also initialise the
-   * opacity table which is being used here
+   * Update the opacity and optical depth for each cell
    */
 
-  init_opacity_table ();
+  init_opacity_cache ();
+  init_tau_summation ();
+  init_output_buffers ();
+  profile_stop (PHASE_GRID_INIT);
+
+  profile_start (PHASE_OPACITY);
   update_cell_opacities ();
+  profile_stop (PHASE_OPACITY);
+  profile_start (PHASE_TAU);
   find_vertical_tau ();
+  profile_stop (PHASE_TAU);
 
-  Log_verbose ("\t\t- Writing initial grid to file\n");
-  write_grid ();
+  if (snapshot_due (FALSE, FALSE))
+  {
+    Log_verbose ("\t\t- Writing initial grid to file\n");
+    profile_start (PHASE_OUTPUT);
+    write_grid ();
+    profile_stop (PHASE_OUTPUT);
+  }
 }
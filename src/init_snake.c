@@ -26,7 +26,9 @@ init_snake (void)
    */
 
   modes.opal = FALSE;
+  modes.opal_slice = FALSE;
   modes.low_temp = FALSE;
+  modes.newton = FALSE;
 
   /*
    * Geometry parameters for planar atmosphere
@@ -0,0 +1,427 @@
+/* ***************************************************************************
+ *
+ * @file interp_2d.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Functions for 2D bilinear and bicubic interpolation over tables
+ *        which are on a uniform, or piecewise uniform, lattice.
+ *
+ * @details
+ *
+ * The bicubic interpolation follows the same method as gsl_interp2d_bicubic,
+ * i.e. the partial derivatives at each knot are found using natural cubic
+ * splines along each axis and these are then used to construct a bicubic
+ * Hermite patch for each cell of the table.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "snake.h"
+#include "interp_2d.h"
+
+/*
+ * The relative tolerance to decide if the spacing between knots is uniform.
+ * The tables are written with three decimal places, so anything looser than
+ * this will not be a uniform spacing
+ */
+
+#define UNIFORM_TOL 1e-6
+
+// Initialise an axis and create the bucket index if the axis is not uniform
+void
+interp_axis_init (InterpAxis *axis, const double *v, int n)
+{
+  int i, b;
+  double h, h_min;
+
+  if (n < 2)
+    Exit (INVALID_TABLE, "Interpolation axis requires at least 2 knots, n = %i\n", n);
+
+  axis->n = n;
+  axis->v = v;
+  axis->min = v[0];
+  axis->max = v[n - 1];
+  axis->uniform = TRUE;
+  axis->bucket = NULL;
+  axis->n_buckets = 0;
+
+  /*
+   * Check that the axis is increasing and figure out if the spacing between
+   * each knot is the same
+   */
+
+  h = v[1] - v[0];
+  h_min = h;
+  for (i = 1; i < n; i++)
+  {
+    if (v[i] <= v[i - 1])
+      Exit (INVALID_TABLE, "Interpolation axis is not strictly increasing at knot %i\n", i);
+    if (fabs ((v[i] - v[i - 1]) - h) > UNIFORM_TOL * h)
+      axis->uniform = FALSE;
+    if (v[i] - v[i - 1] < h_min)
+      h_min = v[i] - v[i - 1];
+  }
+
+  if (axis->uniform)
+  {
+    axis->inv_step = (n - 1) / (axis->max - axis->min);
+    return;
+  }
+
+  /*
+   * For a non-uniform axis, split the axis into buckets which are no wider
+   * than the smallest knot spacing. Each bucket stores the lower knot index
+   * at the start of the bucket, so a knot index can be found with one
+   * comparison past the bucket
+   */
+
+  axis->inv_step = 1.0 / h_min;
+  axis->n_buckets = (int) ceil ((axis->max - axis->min) * axis->inv_step) + 1;
+  if (!(axis->bucket = calloc ((size_t) axis->n_buckets, sizeof (*axis->bucket))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for interpolation axis buckets\n");
+
+  for (b = 0, i = 0; b < axis->n_buckets; b++)
+  {
+    while (i < n - 2 && v[i + 1] <= axis->min + b * h_min)
+      i++;
+    axis->bucket[b] = i;
+  }
+}
+
+// Find the index of the lower knot of the cell which contains v. Values
+// outside of the axis are placed into the first or last cell
+int
+interp_axis_index (const InterpAxis *axis, double v)
+{
+  int i, b;
+
+  if (axis->uniform)
+  {
+    i = (int) ((v - axis->min) * axis->inv_step);
+  }
+  else
+  {
+    b = (int) ((v - axis->min) * axis->inv_step);
+    if (b < 0)
+      b = 0;
+    else if (b >= axis->n_buckets)
+      b = axis->n_buckets - 1;
+    i = axis->bucket[b];
+    if (i < axis->n - 2 && v >= axis->v[i + 1])
+      i++;
+  }
+
+  if (i < 0)
+    i = 0;
+  else if (i > axis->n - 2)
+    i = axis->n - 2;
+
+  return i;
+}
+
+// Find the first derivative at each knot of a natural cubic spline through
+// the points (x[i], y[i * stride]). The derivatives are written to dydx with
+// the same stride as y, and c and work are scratch arrays of length n
+void
+spline_knot_derivatives (const double *x, const double *y, int n, int stride, double *dydx, double *c,
+                         double *work)
+{
+  int i;
+  double h, h_prev, dy, dy_prev, m;
+
+  /*
+   * Solve the tridiagonal system for c, the coefficient of the quadratic term
+   * of each spline segment, with the natural boundary condition that c = 0 at
+   * the end knots. work is used to store the modified super diagonal in the
+   * Thomas algorithm
+   */
+
+  c[0] = c[n - 1] = 0.0;
+  work[0] = 0.0;
+  for (i = 1; i < n - 1; i++)
+  {
+    h_prev = x[i] - x[i - 1];
+    h = x[i + 1] - x[i];
+    dy_prev = (y[i * stride] - y[(i - 1) * stride]) / h_prev;
+    dy = (y[(i + 1) * stride] - y[i * stride]) / h;
+    m = 2.0 * (h_prev + h) - h_prev * work[i - 1];
+    work[i] = h / m;
+    c[i] = (3.0 * (dy - dy_prev) - h_prev * c[i - 1]) / m;
+  }
+  for (i = n - 3; i > 0; i--)
+    c[i] -= work[i] * c[i + 1];
+
+  /*
+   * The derivative at each knot is the linear coefficient of the segment
+   * starting at the knot, apart from the final knot which uses the segment
+   * ending at the knot
+   */
+
+  for (i = 0; i < n - 1; i++)
+  {
+    h = x[i + 1] - x[i];
+    dy = (y[(i + 1) * stride] - y[i * stride]) / h;
+    dydx[i * stride] = dy - h * (c[i + 1] + 2.0 * c[i]) / 3.0;
+  }
+  h = x[n - 1] - x[n - 2];
+  dy = (y[(n - 1) * stride] - y[(n - 2) * stride]) / h;
+  dydx[(n - 1) * stride] = dy + h * (2.0 * c[n - 1] + c[n - 2]) / 3.0;
+}
+
+// Allocate memory for the partial derivatives at each knot
+void
+allocate_derivatives (Interp2D *interp)
+{
+  size_t n_knots = (size_t) interp->nx * interp->ny;
+
+  if (!(interp->zx = calloc (n_knots, sizeof (*interp->zx))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for bicubic derivatives\n");
+  if (!(interp->zy = calloc (n_knots, sizeof (*interp->zy))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for bicubic derivatives\n");
+  if (!(interp->zxy = calloc (n_knots, sizeof (*interp->zxy))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for bicubic derivatives\n");
+}
+
+// Calculate the partial derivatives at each knot for bicubic interpolation. If
+// known is TRUE, zx and zy have already been provided and only the cross
+// derivative is calculated
+void
+init_bicubic_derivatives (Interp2D *interp, int known)
+{
+  int i, j;
+  int nx = interp->nx, ny = interp->ny;
+  int n_max = nx > ny ? nx : ny;
+  double *c, *work;
+
+  if (!(c = calloc ((size_t) n_max, sizeof (*c))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for spline coefficients\n");
+  if (!(work = calloc ((size_t) n_max, sizeof (*work))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for spline coefficients\n");
+
+  /*
+   * dz/dx from splines along each row, dz/dy from splines along each column
+   * and then d2z/dxdy from splines of dz/dy along each row
+   */
+
+  if (!known)
+  {
+    for (j = 0; j < ny; j++)
+      spline_knot_derivatives (interp->x.v, &interp->z[j * nx], nx, 1, &interp->zx[j * nx], c, work);
+    for (i = 0; i < nx; i++)
+      spline_knot_derivatives (interp->y.v, &interp->z[i], ny, nx, &interp->zy[i], c, work);
+  }
+  for (j = 0; j < ny; j++)
+    spline_knot_derivatives (interp->x.v, &interp->zy[j * nx], nx, 1, &interp->zxy[j * nx], c, work);
+
+  free (c);
+  free (work);
+}
+
+// Initialise the interpolation engine for the table z with axes x and y. The
+// arrays x, y and z are not copied, so must not be freed until the
+// interpolation engine is no longer required
+void
+interp2d_init (Interp2D *interp, int type, const double *x, int nx, const double *y, int ny,
+               const double *z)
+{
+  interp->type = type;
+  interp->nx = nx;
+  interp->ny = ny;
+  interp->z = z;
+  interp->zx = interp->zy = interp->zxy = NULL;
+
+  interp_axis_init (&interp->x, x, nx);
+  interp_axis_init (&interp->y, y, ny);
+
+  if (type == INTERP_BICUBIC)
+  {
+    allocate_derivatives (interp);
+    init_bicubic_derivatives (interp, FALSE);
+  }
+  else if (type != INTERP_BILINEAR)
+    Exit (UNKNOWN_MODE, "Unknown interpolation type %i\n", type);
+
+  Log_verbose ("\t\t- Interpolation axes are %s in x and %s in y\n",
+               interp->x.uniform ? "uniform" : "non-uniform",
+               interp->y.uniform ? "uniform" : "non-uniform");
+}
+
+// Initialise the interpolation engine for bicubic Hermite interpolation when
+// the partial derivatives zx and zy are already known at each knot, e.g. when
+// they are provided with the table. If zxy is NULL, the cross derivatives are
+// found using splines of zy. The derivatives are copied, but x, y and z are not
+void
+interp2d_init_hermite (Interp2D *interp, const double *x, int nx, const double *y, int ny, const double *z,
+                       const double *zx, const double *zy, const double *zxy)
+{
+  size_t i;
+
+  interp->type = INTERP_BICUBIC;
+  interp->nx = nx;
+  interp->ny = ny;
+  interp->z = z;
+
+  interp_axis_init (&interp->x, x, nx);
+  interp_axis_init (&interp->y, y, ny);
+
+  allocate_derivatives (interp);
+  for (i = 0; i < (size_t) nx * ny; i++)
+  {
+    interp->zx[i] = zx[i];
+    interp->zy[i] = zy[i];
+    if (zxy)
+      interp->zxy[i] = zxy[i];
+  }
+
+  if (!zxy)
+    init_bicubic_derivatives (interp, TRUE);
+}
+
+// Interpolate the table at the point (x, y). The point is assumed to be within
+// the bounds of the table, otherwise the result is an extrapolation
+double
+interp2d_eval (const Interp2D *interp, double x, double y)
+{
+  int i, j, k00, k10, k01, k11;
+  int nx = interp->nx;
+  double dx, dy, t, u;
+  double ht0, ht1, gt0, gt1, hu0, hu1, gu0, gu1;
+  const double *xv = interp->x.v, *yv = interp->y.v, *z = interp->z;
+
+  i = interp_axis_index (&interp->x, x);
+  j = interp_axis_index (&interp->y, y);
+
+  dx = xv[i + 1] - xv[i];
+  dy = yv[j + 1] - yv[j];
+  t = (x - xv[i]) / dx;
+  u = (y - yv[j]) / dy;
+
+  k00 = j * nx + i;
+  k10 = k00 + 1;
+  k01 = k00 + nx;
+  k11 = k01 + 1;
+
+  if (interp->type == INTERP_BILINEAR)
+    return (1.0 - t) * (1.0 - u) * z[k00] + t * (1.0 - u) * z[k10] + (1.0 - t) * u * z[k01] + t * u * z[k11];
+
+  /*
+   * Cubic Hermite basis functions in each direction, where h are the basis
+   * functions for the knot values and g are the basis functions for the
+   * derivatives, already scaled by the cell width
+   */
+
+  ht0 = (1.0 + 2.0 * t) * (1.0 - t) * (1.0 - t);
+  ht1 = t * t * (3.0 - 2.0 * t);
+  gt0 = t * (1.0 - t) * (1.0 - t) * dx;
+  gt1 = -t * t * (1.0 - t) * dx;
+
+  hu0 = (1.0 + 2.0 * u) * (1.0 - u) * (1.0 - u);
+  hu1 = u * u * (3.0 - 2.0 * u);
+  gu0 = u * (1.0 - u) * (1.0 - u) * dy;
+  gu1 = -u * u * (1.0 - u) * dy;
+
+  return hu0 * (ht0 * z[k00] + ht1 * z[k10] + gt0 * interp->zx[k00] + gt1 * interp->zx[k10])
+       + hu1 * (ht0 * z[k01] + ht1 * z[k11] + gt0 * interp->zx[k01] + gt1 * interp->zx[k11])
+       + gu0 * (ht0 * interp->zy[k00] + ht1 * interp->zy[k10] + gt0 * interp->zxy[k00] + gt1 * interp->zxy[k10])
+       + gu1 * (ht0 * interp->zy[k01] + ht1 * interp->zy[k11] + gt0 * interp->zxy[k01] + gt1 * interp->zxy[k11]);
+}
+
+// Interpolate the table at the point (x, y) and also return the partial
+// derivatives of the interpolant df/dx and df/dy at the point
+void
+interp2d_eval_deriv (const Interp2D *interp, double x, double y, double *f, double *dfdx, double *dfdy)
+{
+  int i, j, k00, k10, k01, k11;
+  int nx = interp->nx;
+  double dx, dy, t, u;
+  double ht0, ht1, gt0, gt1, hu0, hu1, gu0, gu1;
+  double dht0, dht1, dgt0, dgt1, dhu0, dhu1, dgu0, dgu1;
+  double zx00, zx10, zx01, zx11, zy00, zy10, zy01, zy11;
+  const double *xv = interp->x.v, *yv = interp->y.v, *z = interp->z;
+
+  i = interp_axis_index (&interp->x, x);
+  j = interp_axis_index (&interp->y, y);
+
+  dx = xv[i + 1] - xv[i];
+  dy = yv[j + 1] - yv[j];
+  t = (x - xv[i]) / dx;
+  u = (y - yv[j]) / dy;
+
+  k00 = j * nx + i;
+  k10 = k00 + 1;
+  k01 = k00 + nx;
+  k11 = k01 + 1;
+
+  if (interp->type == INTERP_BILINEAR)
+  {
+    *f = (1.0 - t) * (1.0 - u) * z[k00] + t * (1.0 - u) * z[k10] + (1.0 - t) * u * z[k01] + t * u * z[k11];
+    *dfdx = ((1.0 - u) * (z[k10] - z[k00]) + u * (z[k11] - z[k01])) / dx;
+    *dfdy = ((1.0 - t) * (z[k01] - z[k00]) + t * (z[k11] - z[k10])) / dy;
+    return;
+  }
+
+  /*
+   * The Hermite basis functions, and their derivatives with respect to x and
+   * y, as in interp2d_eval
+   */
+
+  ht0 = (1.0 + 2.0 * t) * (1.0 - t) * (1.0 - t);
+  ht1 = t * t * (3.0 - 2.0 * t);
+  gt0 = t * (1.0 - t) * (1.0 - t) * dx;
+  gt1 = -t * t * (1.0 - t) * dx;
+  dht0 = -6.0 * t * (1.0 - t) / dx;
+  dht1 = -dht0;
+  dgt0 = (1.0 - t) * (1.0 - 3.0 * t);
+  dgt1 = t * (3.0 * t - 2.0);
+
+  hu0 = (1.0 + 2.0 * u) * (1.0 - u) * (1.0 - u);
+  hu1 = u * u * (3.0 - 2.0 * u);
+  gu0 = u * (1.0 - u) * (1.0 - u) * dy;
+  gu1 = -u * u * (1.0 - u) * dy;
+  dhu0 = -6.0 * u * (1.0 - u) / dy;
+  dhu1 = -dhu0;
+  dgu0 = (1.0 - u) * (1.0 - 3.0 * u);
+  dgu1 = u * (3.0 * u - 2.0);
+
+  zx00 = interp->zx[k00];
+  zx10 = interp->zx[k10];
+  zx01 = interp->zx[k01];
+  zx11 = interp->zx[k11];
+  zy00 = interp->zy[k00];
+  zy10 = interp->zy[k10];
+  zy01 = interp->zy[k01];
+  zy11 = interp->zy[k11];
+
+  *f = hu0 * (ht0 * z[k00] + ht1 * z[k10] + gt0 * zx00 + gt1 * zx10)
+     + hu1 * (ht0 * z[k01] + ht1 * z[k11] + gt0 * zx01 + gt1 * zx11)
+     + gu0 * (ht0 * zy00 + ht1 * zy10 + gt0 * interp->zxy[k00] + gt1 * interp->zxy[k10])
+     + gu1 * (ht0 * zy01 + ht1 * zy11 + gt0 * interp->zxy[k01] + gt1 * interp->zxy[k11]);
+
+  *dfdx = hu0 * (dht0 * z[k00] + dht1 * z[k10] + dgt0 * zx00 + dgt1 * zx10)
+        + hu1 * (dht0 * z[k01] + dht1 * z[k11] + dgt0 * zx01 + dgt1 * zx11)
+        + gu0 * (dht0 * zy00 + dht1 * zy10 + dgt0 * interp->zxy[k00] + dgt1 * interp->zxy[k10])
+        + gu1 * (dht0 * zy01 + dht1 * zy11 + dgt0 * interp->zxy[k01] + dgt1 * interp->zxy[k11]);
+
+  *dfdy = dhu0 * (ht0 * z[k00] + ht1 * z[k10] + gt0 * zx00 + gt1 * zx10)
+        + dhu1 * (ht0 * z[k01] + ht1 * z[k11] + gt0 * zx01 + gt1 * zx11)
+        + dgu0 * (ht0 * zy00 + ht1 * zy10 + gt0 * interp->zxy[k00] + gt1 * interp->zxy[k10])
+        + dgu1 * (ht0 * zy01 + ht1 * zy11 + gt0 * interp->zxy[k01] + gt1 * interp->zxy[k11]);
+}
+
+// Free the memory allocated by the interpolation engine
+void
+interp2d_free (Interp2D *interp)
+{
+  free (interp->x.bucket);
+  free (interp->y.bucket);
+  free (interp->zx);
+  free (interp->zy);
+  free (interp->zxy);
+  interp->x.bucket = interp->y.bucket = NULL;
+  interp->zx = interp->zy = interp->zxy = NULL;
+}
@@ -0,0 +1,78 @@
+/* ***************************************************************************
+ *
+ * @file interp_2d.h
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Structures and function definitions for the 2D interpolation engine
+ *        used for tabulated opacities.
+ *
+ * @details
+ *
+ * The engine is designed for tables which sit on a uniform, or piecewise
+ * uniform, lattice. The spacing of each axis is checked when the engine is
+ * initialised, so that a cell index can be computed arithmetically rather than
+ * by searching the axis for each lookup.
+ *
+ * ************************************************************************** */
+
+#ifndef INTERP_2D_H
+#define INTERP_2D_H
+
+/*
+ * The available interpolation types -- these should match the choices for the
+ * gsl_interpolation parameter
+ */
+
+enum INTERP_TYPES
+{
+  INTERP_BILINEAR,
+  INTERP_BICUBIC
+};
+
+/*
+ * An axis of the interpolation table. If the axis is uniform, the index of a
+ * value is found directly using inv_step. Otherwise, the axis is split into
+ * buckets no wider than the smallest knot spacing and bucket stores the lower
+ * knot index for each bucket, hence at most one extra comparison is required
+ * to find the correct knot index
+ */
+
+typedef struct InterpAxis
+{
+  int n;
+  const double *v;
+  int uniform;
+  double min, max;
+  double inv_step;
+  int n_buckets;
+  int *bucket;
+} InterpAxis;
+
+/*
+ * The interpolation table. z is stored with x varying fastest, i.e. the value
+ * at the knot (x[i], y[j]) is z[j * nx + i]. zx, zy and zxy are the partial
+ * derivatives at each knot and are only allocated for bicubic interpolation
+ */
+
+typedef struct Interp2D
+{
+  int type;
+  int nx, ny;
+  const double *z;
+  double *zx, *zy, *zxy;
+  InterpAxis x, y;
+} Interp2D;
+
+void interp2d_init (Interp2D *interp, int type, const double *x, int nx, const double *y, int ny,
+                    const double *z);
+void interp2d_init_hermite (Interp2D *interp, const double *x, int nx, const double *y, int ny, const double *z,
+                           const double *zx, const double *zy, const double *zxy);
+int interp_axis_index (const InterpAxis *axis, double v);
+double interp2d_eval (const Interp2D *interp, double x, double y);
+void interp2d_eval_deriv (const Interp2D *interp, double x, double y, double *f, double *dfdx, double *dfdy);
+void interp2d_free (Interp2D *interp);
+
+#endif
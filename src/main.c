@@ -12,7 +12,7 @@
 *
  * ************************************************************************** */
 
-#include <time.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "snake.h"
@@ -20,9 +20,8 @@
 int
 main (int argc, char **argv)
 {
-  struct timespec start_time;
+  int n_workers = 0;
   char par_file_path[LINE_LEN];
-  int verbosity = FALSE;
 
   /*
    * Set flag that the logfile is needed to be initialised
@@ -30,12 +29,37 @@ main (int argc, char **argv)
 
   INIT_LOGFILE = TRUE;
 
-  start_time = get_time ();
-
   Log ("\n--------------------------------------------------------------\n\n");
   print_time_date ();
   Log ("\n--------------------------------------------------------------\n\n");
 
+  /*
+   * If the first argument is --batch, the parameter files listed in the batch
+   * manifest given by the second argument are run, using the number of worker
+   * processes given by the optional third argument
+   */
+
+  if (argc > 1 && !strcmp (argv[1], "--batch"))
+  {
+    if (argc < 3 || argc > 4)
+      Exit (FILE_IN_ERR, "Usage: snake --batch manifest [n_workers]\n");
+    if (argc == 4 && (n_workers = atoi (argv[3])) < 1)
+      Exit (INVALID_VALUE, "Invalid number of batch workers %s\n", argv[3]);
+    return run_batch (argv[2], n_workers);
+  }
+
+  /*
+   * If the first argument is --opal-cache, the Opal tables are read in from
+   * GN93hz and written to the Opal cache, so later runs can map them directly
+   */
+
+  if (argc > 1 && !strcmp (argv[1], "--opal-cache"))
+  {
+    if (argc != 2)
+      Exit (FILE_IN_ERR, "Usage: snake --opal-cache\n");
+    return build_opal_cache ();
+  }
+
   /*
    * Begin the process of reading in the parameters from file:
    *  - If no arguments to the program are provided, the user will be prompted
@@ -52,26 +76,8 @@ main (int argc, char **argv)
     strcpy (par_file_path, argv[1]);
   else
     Exit (FILE_IN_ERR, "Too many arguments provided\n");
-  init_parameter_file (par_file_path);
-
-  get_optional_int ("verbosity", &verbosity);
-  VERBOSITY = verbosity;
-  if ((VERBOSITY != FALSE) && (VERBOSITY != TRUE))
-    Exit (UNKNOWN_PARAMETER, "Invalid value for verbosity: verbosity should be 0 or 1\n");
-
-  Log (" - Beginning initialisation routines\n");
-  init_snake ();
-  init_outfile ();
-  init_geo ();
-  Log (" - End of initialisation routines\n");
-
-  eddington_iterations ();
-
-  Log ("\n--------------------------------------------------------------\n\n");
-  print_duration (start_time, " Simulation completed in");
-  Log ("\n--------------------------------------------------------------\n\n");
 
-  clean_up ();
+  run_simulation (par_file_path, NULL, NULL);
 
   return SUCCESS;
 }
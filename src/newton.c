@@ -0,0 +1,195 @@
+/* ***************************************************************************
+ *
+ * @file newton.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Functions for solving for the cell temperatures using Newton-Raphson
+ *        iterations.
+ *
+ * @details
+ *
+ * The Eddington iterations find the fixed point T = G(T) of the map from the
+ * cell temperatures to the temperatures given by the Eddington approximation,
+ *
+ *    G_i(T)^4 = T_disk^4 (tau_i + 2/3) / (tau_0 + 2/3),
+ *
+ * where tau_i is the optical depth from the top of the atmosphere to cell i,
+ * which depends on the opacity, and hence the temperature, of every cell
+ * above it. Rather than setting T = G(T) each iteration, the Newton solver
+ * solves J dT = G(T) - T, where J = I - dG/dT, using the derivative of the
+ * opacity dln(kappa)/dln(T) at constant density from Opal or the 2D table.
+ *
+ * Writing c_j = dtau_j/dT_j for the optical depth of cell j, the Jacobian is
+ *
+ *    dG_i/dT_j = a_i c_j [j >= i] - b_i c_j,
+ *
+ * with a_i = G_i / (4 (tau_i + 2/3)) and b_i = G_i / (4 (tau_0 + 2/3)). As the
+ * optical depth to a cell is a sum over all of the cells above it, J is not
+ * banded, but is an upper triangular matrix with a cumulative sum structure
+ * plus a rank one term. The upper triangular part can be solved by back
+ * substitution keeping a running sum, and the rank one term with the
+ * Sherman-Morrison formula, so each Newton step is O(nz_cells).
+ *
+ * Each step is limited so that no cell changes temperature by more than a
+ * fraction NEWTON_MAX_STEP. If the step can not be found, the fixed point
+ * update is used instead.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snake.h"
+
+#define NEWTON_MAX_STEP 0.5
+
+/*
+ * Work arrays for the Newton solver, allocated once for the whole run
+ */
+
+double *newton_a, *newton_c, *newton_y, *newton_z;
+
+// Initialise the choice of solver for the cell temperatures
+void
+init_solver (void)
+{
+  char solver[LINE_LEN], acceleration[LINE_LEN];
+
+  strcpy (solver, "fixed_point");
+  get_optional_string ("solver", solver);
+
+  if (!strcmp (solver, "fixed_point"))
+    modes.newton = FALSE;
+  else if (!strcmp (solver, "newton"))
+    modes.newton = TRUE;
+  else
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for solver: %s. Allowed: fixed_point or newton\n", solver);
+
+  if (!modes.newton)
+    return;
+
+  strcpy (acceleration, "none");
+  get_optional_string ("acceleration", acceleration);
+  if (strcmp (acceleration, "none"))
+    Exit (INVALID_VALUE, "acceleration can not be used with the Newton solver\n");
+
+  Log ("\t- Using the Newton solver for the cell temperatures\n");
+
+  newton_a = allocate_grid_array (sizeof (*newton_a));
+  newton_c = allocate_grid_array (sizeof (*newton_c));
+  newton_y = allocate_grid_array (sizeof (*newton_y));
+  newton_z = allocate_grid_array (sizeof (*newton_z));
+}
+
+// Solve (I - diag(a) U diag(c)) y = r, where U is the upper triangular matrix
+// of ones, by back substitution from the top of the atmosphere. Returns
+// FAILURE if the matrix is singular
+int
+newton_back_substitute (const double *a, const double *c, const double *r, double *y)
+{
+  int i;
+  double diag, sum = 0.0;
+
+  for (i = geo.nz_cells - 1; i > -1; i--)
+  {
+    diag = 1.0 - a[i] * c[i];
+    if (diag == 0.0)
+      return FAILURE;
+    y[i] = (r[i] + a[i] * sum) / diag;
+    sum += c[i] * y[i];
+  }
+
+  return SUCCESS;
+}
+
+// Replace the fixed point update of the cell temperatures with a Newton step.
+// update_cell_temperatures must be called first, so that T_old is the current
+// temperature and T is the fixed point update G(T_old)
+void
+newton_update_temperatures (void)
+{
+  int i;
+  double x, g, b, cy = 0.0, cz = 0.0, max_step = 0.0, lambda = 1.0;
+  double tau0 = geo.tot_tau + 2.0 / 3.0;
+
+  Log_verbose ("\t\t- Taking Newton step for cell temperatures\n");
+
+  /*
+   * newton_y holds the residual G(T) - T and newton_z holds b, and both are
+   * overwritten by the solutions of the upper triangular system
+   */
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    x = grid.T_old[i];
+    g = grid.T[i];
+    newton_a[i] = g / (4.0 * (grid.tau_depth[i] + 2.0 / 3.0));
+    newton_c[i] = grid.cell_tau[i] * grid.dlnk_dlnT[i] / x;
+    newton_z[i] = g / (4.0 * tau0);
+    newton_y[i] = g - x;
+  }
+
+  if (newton_back_substitute (newton_a, newton_c, newton_y, newton_y) ||
+      newton_back_substitute (newton_a, newton_c, newton_z, newton_z))
+  {
+    Log_verbose ("\t\t- Newton step is singular, using fixed point update\n");
+    return;
+  }
+
+  /*
+   * Sherman-Morrison for the rank one term: dT = y - z (c.y) / (1 + c.z)
+   */
+
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    cy += newton_c[i] * newton_y[i];
+    cz += newton_c[i] * newton_z[i];
+  }
+
+  if (1.0 + cz == 0.0 || !isfinite (cy) || !isfinite (cz))
+  {
+    Log_verbose ("\t\t- Newton step is singular, using fixed point update\n");
+    return;
+  }
+
+  b = cy / (1.0 + cz);
+  for (i = 0; i < geo.nz_cells; i++)
+  {
+    newton_y[i] -= newton_z[i] * b;
+    if (fabs (newton_y[i]) / grid.T_old[i] > max_step)
+      max_step = fabs (newton_y[i]) / grid.T_old[i];
+  }
+
+  if (!isfinite (max_step))
+  {
+    Log_verbose ("\t\t- Newton step is not finite, using fixed point update\n");
+    return;
+  }
+
+  if (max_step > NEWTON_MAX_STEP)
+  {
+    lambda = NEWTON_MAX_STEP / max_step;
+    Log_verbose ("\t\t- Newton step limited by a factor of %f\n", lambda);
+  }
+
+  for (i = 0; i < geo.nz_cells; i++)
+    grid.T[i] = grid.T_old[i] + lambda * newton_y[i];
+}
+
+// Free the work arrays for the Newton solver
+void
+clean_up_solver (void)
+{
+  if (!modes.newton)
+    return;
+
+  free (newton_a);
+  free (newton_c);
+  free (newton_y);
+  free (newton_z);
+  newton_a = newton_c = newton_y = newton_z = NULL;
+}
@@ -0,0 +1,581 @@
+/* ***************************************************************************
+ *
+ * @file opac_batch.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Kernels for finding the Rosseland mean opacity for an array of
+ *        temperatures and densities using the 2D opacity tables.
+ *
+ * @details
+ *
+ * There is a scalar kernel which works everywhere, and AVX2 and AVX-512
+ * kernels which are compiled using function target attributes so that the
+ * kernel can be chosen at runtime depending on what the CPU supports. The
+ * vector kernels use vectorised versions of the fdlibm log and exp functions,
+ * which are accurate to a couple of ulp. Hence the opacities from the vector
+ * kernels are not bit for bit identical to the scalar kernel. They typically
+ * agree to a relative tolerance of ~1e-15, or ~1e-12 in the cells of the
+ * table with very steep gradients.
+ *
+ * For bilinear interpolation, the table lookup is also vectorised using
+ * gather instructions. Bicubic interpolation uses the scalar interpolation
+ * routine for each element, but the log and exp are still vectorised.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#include "snake.h"
+#include "opac_batch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SNAKE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Constants for the fdlibm log and exp functions
+ */
+
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define INV_LN2 1.44269504088896338700e+00
+#define LN10 2.30258509299404568402
+#define INV_LN10 0.43429448190325182765
+#define SQRT2 1.41421356237309504880
+#define LG1 6.666666666666735130e-01
+#define LG2 3.999999999940941908e-01
+#define LG3 2.857142874366239149e-01
+#define LG4 2.222219843214978396e-01
+#define LG5 1.818357216161805012e-01
+#define LG6 1.531383769920937332e-01
+#define LG7 1.479819860511658591e-01
+#define P1 1.66666666666666019037e-01
+#define P2 -2.77777777770155933842e-03
+#define P3 6.61375632143793436117e-05
+#define P4 -1.65339022054652515390e-06
+#define P5 4.13813679705723846039e-08
+
+// 2^52, used to convert between integers and doubles without AVX-512DQ
+#define TWO52 4503599627370496.0
+
+// Check if logT and logR are within the table, written so that NaN is
+// considered to be outside of the table
+int
+in_table_bounds (const OpacBounds *bounds, double logT, double logR)
+{
+  return logT >= bounds->logT_min && logT <= bounds->logT_max && logR >= bounds->logR_min &&
+         logR <= bounds->logR_max;
+}
+
+// The scalar kernel, which is the same as the original per cell calculation
+int
+opac_batch_scalar (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                   const double *rho, double *kappa)
+{
+  int i;
+  double logT, logR;
+
+  for (i = 0; i < n; i++)
+  {
+    logT = log10 (T[i]);
+    logR = log10 (rho[i] / pow (T[i] * 1e-6, 3.0));
+    if (!in_table_bounds (bounds, logT, logR))
+      return i;
+    kappa[i] = pow (10.0, interp2d_eval (interp, logR, logT));
+  }
+
+  return -1;
+}
+
+#ifdef SNAKE_X86_SIMD
+
+#define AVX2_TARGET __attribute__ ((target ("avx2,fma")))
+#define AVX512_TARGET __attribute__ ((target ("avx512f,avx2,fma")))
+
+/* ************************************************************************** */
+
+/*
+ * AVX2 kernel, four elements at a time
+ */
+
+// Natural log of four positive, normal doubles
+static AVX2_TARGET __m256d
+log_avx2 (__m256d x)
+{
+  __m256i bits;
+  __m256d e, m, big, f, s, z, w, t1, t2, r, hfsq;
+
+  /*
+   * Split x into an exponent e and mantissa m in [sqrt(2) / 2, sqrt(2))
+   */
+
+  bits = _mm256_castpd_si256 (x);
+  e = _mm256_castsi256_pd (_mm256_or_si256 (_mm256_srli_epi64 (bits, 52),
+                                            _mm256_castpd_si256 (_mm256_set1_pd (TWO52))));
+  e = _mm256_sub_pd (e, _mm256_set1_pd (TWO52 + 1023.0));
+  m = _mm256_castsi256_pd (_mm256_or_si256 (_mm256_and_si256 (bits, _mm256_set1_epi64x (0x000FFFFFFFFFFFFFLL)),
+                                            _mm256_set1_epi64x (0x3FF0000000000000LL)));
+  big = _mm256_cmp_pd (m, _mm256_set1_pd (SQRT2), _CMP_GT_OQ);
+  m = _mm256_blendv_pd (m, _mm256_mul_pd (m, _mm256_set1_pd (0.5)), big);
+  e = _mm256_add_pd (e, _mm256_and_pd (big, _mm256_set1_pd (1.0)));
+
+  /*
+   * log(m) = log(1 + f) = 2 atanh(s) where s = f / (2 + f)
+   */
+
+  f = _mm256_sub_pd (m, _mm256_set1_pd (1.0));
+  s = _mm256_div_pd (f, _mm256_add_pd (f, _mm256_set1_pd (2.0)));
+  z = _mm256_mul_pd (s, s);
+  w = _mm256_mul_pd (z, z);
+  t1 = _mm256_fmadd_pd (w, _mm256_set1_pd (LG6), _mm256_set1_pd (LG4));
+  t1 = _mm256_fmadd_pd (w, t1, _mm256_set1_pd (LG2));
+  t1 = _mm256_mul_pd (w, t1);
+  t2 = _mm256_fmadd_pd (w, _mm256_set1_pd (LG7), _mm256_set1_pd (LG5));
+  t2 = _mm256_fmadd_pd (w, t2, _mm256_set1_pd (LG3));
+  t2 = _mm256_fmadd_pd (w, t2, _mm256_set1_pd (LG1));
+  t2 = _mm256_mul_pd (z, t2);
+  r = _mm256_add_pd (t1, t2);
+  hfsq = _mm256_mul_pd (_mm256_set1_pd (0.5), _mm256_mul_pd (f, f));
+
+  r = _mm256_fmadd_pd (s, _mm256_add_pd (hfsq, r), _mm256_mul_pd (e, _mm256_set1_pd (LN2_LO)));
+  r = _mm256_sub_pd (_mm256_sub_pd (hfsq, r), f);
+
+  return _mm256_fmsub_pd (e, _mm256_set1_pd (LN2_HI), r);
+}
+
+// Exponential of four doubles, where |x| is small enough that the result is a
+// normal double
+static AVX2_TARGET __m256d
+exp_avx2 (__m256d x)
+{
+  __m256d k, hi, lo, r, t, c, y, scale;
+
+  /*
+   * Reduce x to r = x - k ln(2) where |r| <= 0.5 ln(2)
+   */
+
+  k = _mm256_round_pd (_mm256_mul_pd (x, _mm256_set1_pd (INV_LN2)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  hi = _mm256_fnmadd_pd (k, _mm256_set1_pd (LN2_HI), x);
+  lo = _mm256_mul_pd (k, _mm256_set1_pd (LN2_LO));
+  r = _mm256_sub_pd (hi, lo);
+
+  t = _mm256_mul_pd (r, r);
+  c = _mm256_fmadd_pd (t, _mm256_set1_pd (P5), _mm256_set1_pd (P4));
+  c = _mm256_fmadd_pd (t, c, _mm256_set1_pd (P3));
+  c = _mm256_fmadd_pd (t, c, _mm256_set1_pd (P2));
+  c = _mm256_fmadd_pd (t, c, _mm256_set1_pd (P1));
+  c = _mm256_fnmadd_pd (t, c, r);
+
+  y = _mm256_div_pd (_mm256_mul_pd (r, c), _mm256_sub_pd (_mm256_set1_pd (2.0), c));
+  y = _mm256_sub_pd (_mm256_sub_pd (lo, y), hi);
+  y = _mm256_sub_pd (_mm256_set1_pd (1.0), y);
+
+  /*
+   * Scale by 2^k by placing k + 1023 into the exponent bits
+   */
+
+  scale = _mm256_add_pd (k, _mm256_set1_pd (TWO52 + 1023.0));
+  scale = _mm256_castsi256_pd (_mm256_slli_epi64 (_mm256_castpd_si256 (scale), 52));
+
+  return _mm256_mul_pd (y, scale);
+}
+
+// Find the lower knot index for four values on an axis
+static AVX2_TARGET __m128i
+axis_index_avx2 (const InterpAxis *axis, __m256d v)
+{
+  __m128i i, b, advance;
+  __m256d f, next;
+
+  f = _mm256_mul_pd (_mm256_sub_pd (v, _mm256_set1_pd (axis->min)), _mm256_set1_pd (axis->inv_step));
+
+  if (axis->uniform)
+  {
+    f = _mm256_max_pd (f, _mm256_setzero_pd ());
+    f = _mm256_min_pd (f, _mm256_set1_pd (axis->n - 2));
+    return _mm256_cvttpd_epi32 (f);
+  }
+
+  f = _mm256_max_pd (f, _mm256_setzero_pd ());
+  f = _mm256_min_pd (f, _mm256_set1_pd (axis->n_buckets - 1));
+  b = _mm256_cvttpd_epi32 (f);
+  i = _mm_i32gather_epi32 (axis->bucket, b, 4);
+  i = _mm_min_epi32 (i, _mm_set1_epi32 (axis->n - 2));
+
+  next = _mm256_i32gather_pd (axis->v, _mm_add_epi32 (i, _mm_set1_epi32 (1)), 8);
+  advance = _mm256_cvttpd_epi32 (_mm256_and_pd (_mm256_cmp_pd (v, next, _CMP_GE_OQ), _mm256_set1_pd (1.0)));
+  i = _mm_add_epi32 (i, advance);
+
+  return _mm_min_epi32 (i, _mm_set1_epi32 (axis->n - 2));
+}
+
+// Bilinear interpolation of four points using gathers from the table
+static AVX2_TARGET __m256d
+bilinear_avx2 (const Interp2D *interp, __m256d x, __m256d y)
+{
+  __m128i i, j, k, one, nx;
+  __m256d x0, x1, y0, y1, t, u, z00, z10, z01, z11, f;
+
+  one = _mm_set1_epi32 (1);
+  nx = _mm_set1_epi32 (interp->nx);
+
+  i = axis_index_avx2 (&interp->x, x);
+  j = axis_index_avx2 (&interp->y, y);
+
+  x0 = _mm256_i32gather_pd (interp->x.v, i, 8);
+  x1 = _mm256_i32gather_pd (interp->x.v, _mm_add_epi32 (i, one), 8);
+  y0 = _mm256_i32gather_pd (interp->y.v, j, 8);
+  y1 = _mm256_i32gather_pd (interp->y.v, _mm_add_epi32 (j, one), 8);
+  t = _mm256_div_pd (_mm256_sub_pd (x, x0), _mm256_sub_pd (x1, x0));
+  u = _mm256_div_pd (_mm256_sub_pd (y, y0), _mm256_sub_pd (y1, y0));
+
+  k = _mm_add_epi32 (_mm_mullo_epi32 (j, nx), i);
+  z00 = _mm256_i32gather_pd (interp->z, k, 8);
+  z10 = _mm256_i32gather_pd (interp->z, _mm_add_epi32 (k, one), 8);
+  k = _mm_add_epi32 (k, nx);
+  z01 = _mm256_i32gather_pd (interp->z, k, 8);
+  z11 = _mm256_i32gather_pd (interp->z, _mm_add_epi32 (k, one), 8);
+
+  f = _mm256_mul_pd (_mm256_mul_pd (_mm256_sub_pd (_mm256_set1_pd (1.0), t), _mm256_sub_pd (_mm256_set1_pd (1.0), u)), z00);
+  f = _mm256_fmadd_pd (_mm256_mul_pd (t, _mm256_sub_pd (_mm256_set1_pd (1.0), u)), z10, f);
+  f = _mm256_fmadd_pd (_mm256_mul_pd (_mm256_sub_pd (_mm256_set1_pd (1.0), t), u), z01, f);
+  f = _mm256_fmadd_pd (_mm256_mul_pd (t, u), z11, f);
+
+  return f;
+}
+
+// The AVX2 kernel. The tail of the arrays is padded with the last element so
+// that every element is handled by the vector code
+AVX2_TARGET int
+opac_batch_avx2 (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                 const double *rho, double *kappa)
+{
+  int i, l, n_lanes, ok;
+  double T_pad[4], rho_pad[4], kappa_pad[4], x_lane[4], y_lane[4], f_lane[4];
+  __m256d vT, vrho, vT6, vR, logT, logR, f, in;
+
+  for (i = 0; i < n; i += 4)
+  {
+    n_lanes = n - i < 4 ? n - i : 4;
+    for (l = 0; l < 4; l++)
+    {
+      T_pad[l] = T[i + (l < n_lanes ? l : n_lanes - 1)];
+      rho_pad[l] = rho[i + (l < n_lanes ? l : n_lanes - 1)];
+    }
+
+    vT = _mm256_loadu_pd (T_pad);
+    vrho = _mm256_loadu_pd (rho_pad);
+
+    /*
+     * Find logT and logR = log10(rho / T6^3) and check they are in the table.
+     * log is only valid for positive, normal doubles, so anything else is
+     * flagged as outside of the table
+     */
+
+    vT6 = _mm256_mul_pd (vT, _mm256_set1_pd (1e-6));
+    logT = _mm256_mul_pd (log_avx2 (vT), _mm256_set1_pd (INV_LN10));
+    vR = _mm256_div_pd (vrho, _mm256_mul_pd (vT6, _mm256_mul_pd (vT6, vT6)));
+    in = _mm256_and_pd (_mm256_cmp_pd (vT, _mm256_set1_pd (DBL_MIN), _CMP_GE_OQ),
+                        _mm256_cmp_pd (vR, _mm256_set1_pd (DBL_MIN), _CMP_GE_OQ));
+    in = _mm256_and_pd (in, _mm256_cmp_pd (vR, _mm256_set1_pd (DBL_MAX), _CMP_LE_OQ));
+    logR = _mm256_mul_pd (log_avx2 (vR), _mm256_set1_pd (INV_LN10));
+    in = _mm256_and_pd (in, _mm256_cmp_pd (logT, _mm256_set1_pd (bounds->logT_min), _CMP_GE_OQ));
+    in = _mm256_and_pd (in, _mm256_cmp_pd (logT, _mm256_set1_pd (bounds->logT_max), _CMP_LE_OQ));
+    in = _mm256_and_pd (in, _mm256_cmp_pd (logR, _mm256_set1_pd (bounds->logR_min), _CMP_GE_OQ));
+    in = _mm256_and_pd (in, _mm256_cmp_pd (logR, _mm256_set1_pd (bounds->logR_max), _CMP_LE_OQ));
+
+    ok = _mm256_movemask_pd (in);
+    if (ok != 0xF)
+    {
+      for (l = 0; l < n_lanes; l++)
+        if (!(ok & (1 << l)))
+          return i + l;
+    }
+
+    if (interp->type == INTERP_BILINEAR)
+    {
+      f = bilinear_avx2 (interp, logR, logT);
+    }
+    else
+    {
+      _mm256_storeu_pd (x_lane, logR);
+      _mm256_storeu_pd (y_lane, logT);
+      for (l = 0; l < 4; l++)
+        f_lane[l] = interp2d_eval (interp, x_lane[l], y_lane[l]);
+      f = _mm256_loadu_pd (f_lane);
+    }
+
+    f = exp_avx2 (_mm256_mul_pd (f, _mm256_set1_pd (LN10)));
+
+    if (n_lanes == 4)
+    {
+      _mm256_storeu_pd (&kappa[i], f);
+    }
+    else
+    {
+      _mm256_storeu_pd (kappa_pad, f);
+      for (l = 0; l < n_lanes; l++)
+        kappa[i + l] = kappa_pad[l];
+    }
+  }
+
+  return -1;
+}
+
+/* ************************************************************************** */
+
+/*
+ * AVX-512 kernel, eight elements at a time
+ */
+
+// Natural log of eight positive, normal doubles
+static AVX512_TARGET __m512d
+log_avx512 (__m512d x)
+{
+  __m512i bits;
+  __m512d e, m, f, s, z, w, t1, t2, r, hfsq;
+  __mmask8 big;
+
+  bits = _mm512_castpd_si512 (x);
+  e = _mm512_castsi512_pd (_mm512_or_si512 (_mm512_srli_epi64 (bits, 52),
+                                            _mm512_castpd_si512 (_mm512_set1_pd (TWO52))));
+  e = _mm512_sub_pd (e, _mm512_set1_pd (TWO52 + 1023.0));
+  m = _mm512_castsi512_pd (_mm512_or_si512 (_mm512_and_si512 (bits, _mm512_set1_epi64 (0x000FFFFFFFFFFFFFLL)),
+                                            _mm512_set1_epi64 (0x3FF0000000000000LL)));
+  big = _mm512_cmp_pd_mask (m, _mm512_set1_pd (SQRT2), _CMP_GT_OQ);
+  m = _mm512_mask_mul_pd (m, big, m, _mm512_set1_pd (0.5));
+  e = _mm512_mask_add_pd (e, big, e, _mm512_set1_pd (1.0));
+
+  f = _mm512_sub_pd (m, _mm512_set1_pd (1.0));
+  s = _mm512_div_pd (f, _mm512_add_pd (f, _mm512_set1_pd (2.0)));
+  z = _mm512_mul_pd (s, s);
+  w = _mm512_mul_pd (z, z);
+  t1 = _mm512_fmadd_pd (w, _mm512_set1_pd (LG6), _mm512_set1_pd (LG4));
+  t1 = _mm512_fmadd_pd (w, t1, _mm512_set1_pd (LG2));
+  t1 = _mm512_mul_pd (w, t1);
+  t2 = _mm512_fmadd_pd (w, _mm512_set1_pd (LG7), _mm512_set1_pd (LG5));
+  t2 = _mm512_fmadd_pd (w, t2, _mm512_set1_pd (LG3));
+  t2 = _mm512_fmadd_pd (w, t2, _mm512_set1_pd (LG1));
+  t2 = _mm512_mul_pd (z, t2);
+  r = _mm512_add_pd (t1, t2);
+  hfsq = _mm512_mul_pd (_mm512_set1_pd (0.5), _mm512_mul_pd (f, f));
+
+  r = _mm512_fmadd_pd (s, _mm512_add_pd (hfsq, r), _mm512_mul_pd (e, _mm512_set1_pd (LN2_LO)));
+  r = _mm512_sub_pd (_mm512_sub_pd (hfsq, r), f);
+
+  return _mm512_fmsub_pd (e, _mm512_set1_pd (LN2_HI), r);
+}
+
+// Exponential of eight doubles
+static AVX512_TARGET __m512d
+exp_avx512 (__m512d x)
+{
+  __m512d k, hi, lo, r, t, c, y, scale;
+
+  k = _mm512_roundscale_pd (_mm512_mul_pd (x, _mm512_set1_pd (INV_LN2)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  hi = _mm512_fnmadd_pd (k, _mm512_set1_pd (LN2_HI), x);
+  lo = _mm512_mul_pd (k, _mm512_set1_pd (LN2_LO));
+  r = _mm512_sub_pd (hi, lo);
+
+  t = _mm512_mul_pd (r, r);
+  c = _mm512_fmadd_pd (t, _mm512_set1_pd (P5), _mm512_set1_pd (P4));
+  c = _mm512_fmadd_pd (t, c, _mm512_set1_pd (P3));
+  c = _mm512_fmadd_pd (t, c, _mm512_set1_pd (P2));
+  c = _mm512_fmadd_pd (t, c, _mm512_set1_pd (P1));
+  c = _mm512_fnmadd_pd (t, c, r);
+
+  y = _mm512_div_pd (_mm512_mul_pd (r, c), _mm512_sub_pd (_mm512_set1_pd (2.0), c));
+  y = _mm512_sub_pd (_mm512_sub_pd (lo, y), hi);
+  y = _mm512_sub_pd (_mm512_set1_pd (1.0), y);
+
+  scale = _mm512_add_pd (k, _mm512_set1_pd (TWO52 + 1023.0));
+  scale = _mm512_castsi512_pd (_mm512_slli_epi64 (_mm512_castpd_si512 (scale), 52));
+
+  return _mm512_mul_pd (y, scale);
+}
+
+// Find the lower knot index for eight values on an axis
+static AVX512_TARGET __m256i
+axis_index_avx512 (const InterpAxis *axis, __m512d v)
+{
+  __m256i i, b;
+  __m512d f, next;
+  __mmask8 advance;
+
+  f = _mm512_mul_pd (_mm512_sub_pd (v, _mm512_set1_pd (axis->min)), _mm512_set1_pd (axis->inv_step));
+
+  if (axis->uniform)
+  {
+    f = _mm512_max_pd (f, _mm512_setzero_pd ());
+    f = _mm512_min_pd (f, _mm512_set1_pd (axis->n - 2));
+    return _mm512_cvttpd_epi32 (f);
+  }
+
+  f = _mm512_max_pd (f, _mm512_setzero_pd ());
+  f = _mm512_min_pd (f, _mm512_set1_pd (axis->n_buckets - 1));
+  b = _mm512_cvttpd_epi32 (f);
+  i = _mm256_i32gather_epi32 (axis->bucket, b, 4);
+  i = _mm256_min_epi32 (i, _mm256_set1_epi32 (axis->n - 2));
+
+  next = _mm512_i32gather_pd (_mm256_add_epi32 (i, _mm256_set1_epi32 (1)), axis->v, 8);
+  advance = _mm512_cmp_pd_mask (v, next, _CMP_GE_OQ);
+  i = _mm256_add_epi32 (i, _mm512_cvttpd_epi32 (_mm512_maskz_mov_pd (advance, _mm512_set1_pd (1.0))));
+
+  return _mm256_min_epi32 (i, _mm256_set1_epi32 (axis->n - 2));
+}
+
+// Bilinear interpolation of eight points using gathers from the table
+static AVX512_TARGET __m512d
+bilinear_avx512 (const Interp2D *interp, __m512d x, __m512d y)
+{
+  __m256i i, j, k, one, nx;
+  __m512d x0, x1, y0, y1, t, u, z00, z10, z01, z11, f;
+
+  one = _mm256_set1_epi32 (1);
+  nx = _mm256_set1_epi32 (interp->nx);
+
+  i = axis_index_avx512 (&interp->x, x);
+  j = axis_index_avx512 (&interp->y, y);
+
+  x0 = _mm512_i32gather_pd (i, interp->x.v, 8);
+  x1 = _mm512_i32gather_pd (_mm256_add_epi32 (i, one), interp->x.v, 8);
+  y0 = _mm512_i32gather_pd (j, interp->y.v, 8);
+  y1 = _mm512_i32gather_pd (_mm256_add_epi32 (j, one), interp->y.v, 8);
+  t = _mm512_div_pd (_mm512_sub_pd (x, x0), _mm512_sub_pd (x1, x0));
+  u = _mm512_div_pd (_mm512_sub_pd (y, y0), _mm512_sub_pd (y1, y0));
+
+  k = _mm256_add_epi32 (_mm256_mullo_epi32 (j, nx), i);
+  z00 = _mm512_i32gather_pd (k, interp->z, 8);
+  z10 = _mm512_i32gather_pd (_mm256_add_epi32 (k, one), interp->z, 8);
+  k = _mm256_add_epi32 (k, nx);
+  z01 = _mm512_i32gather_pd (k, interp->z, 8);
+  z11 = _mm512_i32gather_pd (_mm256_add_epi32 (k, one), interp->z, 8);
+
+  f = _mm512_mul_pd (_mm512_mul_pd (_mm512_sub_pd (_mm512_set1_pd (1.0), t), _mm512_sub_pd (_mm512_set1_pd (1.0), u)), z00);
+  f = _mm512_fmadd_pd (_mm512_mul_pd (t, _mm512_sub_pd (_mm512_set1_pd (1.0), u)), z10, f);
+  f = _mm512_fmadd_pd (_mm512_mul_pd (_mm512_sub_pd (_mm512_set1_pd (1.0), t), u), z01, f);
+  f = _mm512_fmadd_pd (_mm512_mul_pd (t, u), z11, f);
+
+  return f;
+}
+
+// The AVX-512 kernel. The tail of the arrays is handled using masked loads and
+// stores
+AVX512_TARGET int
+opac_batch_avx512 (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                   const double *rho, double *kappa)
+{
+  int i, l, n_lanes;
+  double x_lane[8], y_lane[8], f_lane[8];
+  __m512d vT, vrho, vT6, vR, logT, logR, f;
+  __mmask8 lanes, in;
+
+  for (i = 0; i < n; i += 8)
+  {
+    n_lanes = n - i < 8 ? n - i : 8;
+    lanes = (__mmask8) ((1 << n_lanes) - 1);
+
+    /*
+     * Unused lanes are set to the first element so that they are always
+     * valid for log
+     */
+
+    vT = _mm512_mask_loadu_pd (_mm512_set1_pd (T[i]), lanes, &T[i]);
+    vrho = _mm512_mask_loadu_pd (_mm512_set1_pd (rho[i]), lanes, &rho[i]);
+
+    vT6 = _mm512_mul_pd (vT, _mm512_set1_pd (1e-6));
+    logT = _mm512_mul_pd (log_avx512 (vT), _mm512_set1_pd (INV_LN10));
+    vR = _mm512_div_pd (vrho, _mm512_mul_pd (vT6, _mm512_mul_pd (vT6, vT6)));
+    in = _mm512_cmp_pd_mask (vT, _mm512_set1_pd (DBL_MIN), _CMP_GE_OQ);
+    in &= _mm512_cmp_pd_mask (vR, _mm512_set1_pd (DBL_MIN), _CMP_GE_OQ);
+    in &= _mm512_cmp_pd_mask (vR, _mm512_set1_pd (DBL_MAX), _CMP_LE_OQ);
+    logR = _mm512_mul_pd (log_avx512 (vR), _mm512_set1_pd (INV_LN10));
+    in &= _mm512_cmp_pd_mask (logT, _mm512_set1_pd (bounds->logT_min), _CMP_GE_OQ);
+    in &= _mm512_cmp_pd_mask (logT, _mm512_set1_pd (bounds->logT_max), _CMP_LE_OQ);
+    in &= _mm512_cmp_pd_mask (logR, _mm512_set1_pd (bounds->logR_min), _CMP_GE_OQ);
+    in &= _mm512_cmp_pd_mask (logR, _mm512_set1_pd (bounds->logR_max), _CMP_LE_OQ);
+
+    if ((in & lanes) != lanes)
+    {
+      for (l = 0; l < n_lanes; l++)
+        if (!(in & (1 << l)))
+          return i + l;
+    }
+
+    if (interp->type == INTERP_BILINEAR)
+    {
+      f = bilinear_avx512 (interp, logR, logT);
+    }
+    else
+    {
+      _mm512_storeu_pd (x_lane, logR);
+      _mm512_storeu_pd (y_lane, logT);
+      for (l = 0; l < 8; l++)
+        f_lane[l] = interp2d_eval (interp, x_lane[l], y_lane[l]);
+      f = _mm512_loadu_pd (f_lane);
+    }
+
+    f = exp_avx512 (_mm512_mul_pd (f, _mm512_set1_pd (LN10)));
+    _mm512_mask_storeu_pd (&kappa[i], lanes, f);
+  }
+
+  return -1;
+}
+
+#endif
+
+/* ************************************************************************** */
+
+// Choose the kernel to use. choice is one of auto, scalar, avx2 or avx512 and
+// the name of the chosen kernel is copied into name
+OpacKernel
+select_opac_kernel (char *choice, char *name)
+{
+  int avx2 = FALSE, avx512 = FALSE;
+
+#ifdef SNAKE_X86_SIMD
+  __builtin_cpu_init ();
+  avx2 = __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+  avx512 = avx2 && __builtin_cpu_supports ("avx512f");
+#endif
+
+  if (!strcmp (choice, "auto"))
+  {
+    if (avx512)
+      strcpy (choice, "avx512");
+    else if (avx2)
+      strcpy (choice, "avx2");
+    else
+      strcpy (choice, "scalar");
+  }
+
+  strcpy (name, choice);
+
+  if (!strcmp (choice, "scalar"))
+    return opac_batch_scalar;
+
+#ifdef SNAKE_X86_SIMD
+  if (!strcmp (choice, "avx2"))
+  {
+    if (!avx2)
+      Exit (INVALID_VALUE, "The avx2 opacity kernel is not supported by this CPU\n");
+    return opac_batch_avx2;
+  }
+  if (!strcmp (choice, "avx512"))
+  {
+    if (!avx512)
+      Exit (INVALID_VALUE, "The avx512 opacity kernel is not supported by this CPU\n");
+    return opac_batch_avx512;
+  }
+#endif
+
+  Exit (UNKNOWN_PARAMETER, "Unknown or unsupported choice for opacity_kernel: %s\n", choice);
+
+  return opac_batch_scalar;
+}
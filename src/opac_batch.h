@@ -0,0 +1,48 @@
+/* ***************************************************************************
+ *
+ * @file opac_batch.h
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Function definitions for the batched 2D opacity lookup kernels.
+ *
+ * @details
+ *
+ * A kernel takes arrays of temperature and density and returns the Rosseland
+ * mean opacity for each element. The return value is the index of the first
+ * element which is outside of the opacity table, or -1 if every element was
+ * within the table. When an element is outside of the table, the opacities
+ * returned are undefined.
+ *
+ * ************************************************************************** */
+
+#ifndef OPAC_BATCH_H
+#define OPAC_BATCH_H
+
+#include "interp_2d.h"
+
+/*
+ * The bounds of the table used by the kernels -- this is done so the kernels
+ * do not depend on the table globals in gsl_interp.h
+ */
+
+typedef struct OpacBounds
+{
+  double logT_min, logT_max;
+  double logR_min, logR_max;
+} OpacBounds;
+
+typedef int (*OpacKernel) (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                           const double *rho, double *kappa);
+
+int opac_batch_scalar (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                       const double *rho, double *kappa);
+int opac_batch_avx2 (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                     const double *rho, double *kappa);
+int opac_batch_avx512 (const Interp2D *interp, const OpacBounds *bounds, int n, const double *T,
+                       const double *rho, double *kappa);
+OpacKernel select_opac_kernel (char *choice, char *name);
+
+#endif
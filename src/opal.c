@@ -0,0 +1,899 @@
+/* ***************************************************************************
+ *
+ * @file opal.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Reentrant interpolation of the Opal opacity tables.
+ *
+ * @details
+ *
+ * This is a port of the subroutines opacgn93, kappa, t6rinterp and quad from
+ * opal.f. The tables are still read in and smoothed by readco in opal.f, but
+ * are then copied into an OpalTables structure which is only read from. The
+ * OpalTables structure is also written to a binary cache next to GN93hz, which
+ * is memory mapped by later runs so the tables are not parsed and smoothed
+ * again. The variables which were kept in SAVE statements and common blocks
+ * are instead kept in an OpalState which is owned by the caller, and the
+ * opacity is returned through an argument rather than via common block e.
+ *
+ * The variable names, and the one based indexing, follow opal.f so the two
+ * can be compared side by side. Where opal.f would stop, a status code is
+ * returned instead.
+ *
+ * ************************************************************************** */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snake.h"
+#include "opal.h"
+
+/*
+ * iop = 1 provides smoothed interpolations, iop = 0 gives no smoothing
+ */
+
+#define IOP 1
+
+/*
+ * Macros to access the tables with the same indices as opal.f, and the patch
+ * of the tables around the point being interpolated
+ */
+
+#define XZ(t, m, iz, k, l) ((t)->xz[(l)][(k)][(iz)][(m)])
+#define ZZ(t, m, iz) ((t)->zz[(iz)][(m)])
+#define OPL(s, m, it, ir) ((s)->opl[(m)][(it) - (s)->k1][(ir) - (s)->l1])
+#define OPK(s, it, ir) ((s)->opk[(it) - (s)->k1][(ir) - (s)->l1])
+
+/*
+ * The Opal cache, OPAL_CACHE_FILENAME, holds the tables after they have been
+ * read in and smoothed by opal.f, so they can be memory mapped rather than
+ * read in again. The cache is laid out as,
+ *
+ *  - A header of OPAL_CACHE_HEADER_SIZE bytes, in the byte order of the
+ *    machine which wrote the file:
+ *      char    magic[8]        "SNAKEOPL"
+ *      int32   endian          OPAL_CACHE_ENDIAN_MARK, to detect the byte order
+ *      int32   version         OPAL_CACHE_VERSION
+ *      int32   header_size     OPAL_CACHE_HEADER_SIZE
+ *      int32   dims[4]         OP_MX, OP_MZ, OP_NT and OP_NR
+ *      int32   table_size      the size of OpalTables
+ *      int64   source_size     the size of GN93hz the cache was made from
+ *      int64   source_mtime    the modification time of GN93hz
+ *      uint64  checksum        the FNV-1a hash of the tables
+ *  - The OpalTables structure
+ *
+ * The cache is only used if every field of the header matches the current
+ * GN93hz and build of Snake and the checksum matches, otherwise it is rebuilt.
+ * OPAL_CACHE_VERSION should be increased if OpalTables or the smoothing done
+ * by opal.f changes
+ */
+
+#define OPAL_CACHE_FILENAME "GN93hz.cache"
+#define OPAL_CACHE_MAGIC "SNAKEOPL"
+#define OPAL_CACHE_ENDIAN_MARK 0x01020304
+#define OPAL_CACHE_VERSION 1
+#define OPAL_CACHE_HEADER_SIZE 64
+
+typedef struct OpalCacheHeader
+{
+  char magic[8];
+  int32_t endian;
+  int32_t version;
+  int32_t header_size;
+  int32_t dims[4];
+  int32_t table_size;
+  int64_t source_size;
+  int64_t source_mtime;
+  uint64_t checksum;
+} OpalCacheHeader;
+
+/*
+ * The memory map of the Opal cache, or NULL if the tables were read in by
+ * opal.f
+ */
+
+char *opal_cache_map;
+
+// Return the FNV-1a hash of n bytes, used as the checksum of the Opal cache
+uint64_t
+opal_cache_checksum (const void *data, size_t n)
+{
+  size_t i;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const unsigned char *bytes = data;
+
+  for (i = 0; i < n; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+// Fill in the header of the Opal cache for the tables tab, using the size and
+// modification time of GN93hz. Returns FAILURE if GN93hz can not be found
+int
+make_opal_cache_header (const OpalTables *tab, OpalCacheHeader *header)
+{
+  struct stat source;
+
+  if (stat (OPAL_FILENAME, &source))
+    return FAILURE;
+
+  memset (header, 0, sizeof (*header));
+  memcpy (header->magic, OPAL_CACHE_MAGIC, sizeof (header->magic));
+  header->endian = OPAL_CACHE_ENDIAN_MARK;
+  header->version = OPAL_CACHE_VERSION;
+  header->header_size = OPAL_CACHE_HEADER_SIZE;
+  header->dims[0] = OP_MX;
+  header->dims[1] = OP_MZ;
+  header->dims[2] = OP_NT;
+  header->dims[3] = OP_NR;
+  header->table_size = (int32_t) sizeof (*tab);
+  header->source_size = (int64_t) source.st_size;
+  header->source_mtime = (int64_t) source.st_mtime;
+  header->checksum = tab ? opal_cache_checksum (tab, sizeof (*tab)) : 0;
+
+  return SUCCESS;
+}
+
+// Memory map the Opal cache. Returns NULL if the cache does not exist, was
+// made from a different GN93hz or for a different build of Snake, or is
+// corrupt
+OpalTables *
+map_opal_cache (void)
+{
+  int fd;
+  size_t map_size = OPAL_CACHE_HEADER_SIZE + sizeof (OpalTables);
+  char *map;
+  struct stat cache;
+  OpalCacheHeader expected, found;
+  OpalTables *tab;
+
+  if ((fd = open (OPAL_CACHE_FILENAME, O_RDONLY)) == -1)
+    return NULL;
+
+  if (fstat (fd, &cache) || (size_t) cache.st_size != map_size)
+  {
+    Log ("\t- Opal cache %s is the wrong size, it will be rebuilt\n", OPAL_CACHE_FILENAME);
+    close (fd);
+    return NULL;
+  }
+
+  map = mmap (NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  /*
+   * Everything but the checksum has to match the header which would be written
+   * for the current GN93hz, then the checksum is checked against the tables
+   */
+
+  tab = (OpalTables *) (map + OPAL_CACHE_HEADER_SIZE);
+  memcpy (&found, map, sizeof (found));
+  if (make_opal_cache_header (NULL, &expected) == SUCCESS)
+  {
+    expected.checksum = found.checksum;
+    if (!memcmp (&expected, &found, sizeof (found)) && opal_cache_checksum (tab, sizeof (*tab)) == found.checksum)
+    {
+      opal_cache_map = map;
+      return tab;
+    }
+  }
+
+  Log ("\t- Opal cache %s is out of date or corrupt, it will be rebuilt\n", OPAL_CACHE_FILENAME);
+  munmap (map, map_size);
+
+  return NULL;
+}
+
+// Write the Opal tables to the Opal cache. The cache is written to a temporary
+// file which is then renamed, so another process never sees a partly written
+// cache. Returns FAILURE if the cache could not be written
+int
+write_opal_cache (const OpalTables *tab)
+{
+  int ok;
+  char header[OPAL_CACHE_HEADER_SIZE], tmp_name[LINE_LEN];
+  OpalCacheHeader cache_header;
+  FILE *cache;
+
+  if (make_opal_cache_header (tab, &cache_header))
+    return FAILURE;
+  memset (header, 0, sizeof (header));
+  memcpy (header, &cache_header, sizeof (cache_header));
+
+  snprintf (tmp_name, LINE_LEN, "%s.%li", OPAL_CACHE_FILENAME, (long) getpid ());
+  if (!(cache = fopen (tmp_name, "wb")))
+    return FAILURE;
+
+  ok = fwrite (header, sizeof (header), 1, cache) == 1 && fwrite (tab, sizeof (*tab), 1, cache) == 1;
+  ok = !fclose (cache) && ok;
+  if (!ok || rename (tmp_name, OPAL_CACHE_FILENAME))
+  {
+    remove (tmp_name);
+    return FAILURE;
+  }
+
+  return SUCCESS;
+}
+
+// Read in the Opal tables using readco from opal.f and copy them into tab
+void
+read_opal_tables (OpalTables *tab)
+{
+  int i, iz, k, l, m;
+  float X, Z, T6f, Rf;
+
+  /*
+   * The tables are read in by opal.f on its first call. The composition used
+   * here is chosen so that kappa does not change xa, xx or dfsx, which are
+   * altered depending on X and Z for each call
+   */
+
+  X = 0.7;
+  Z = 0.02;
+  T6f = 1.0;
+  Rf = 1e-3;
+  opacgn93_ (&Z, &X, &T6f, &Rf);
+
+  for (l = 1; l <= OP_NR; l++)
+    for (k = 1; k <= OP_NT; k++)
+      for (iz = 1; iz <= OP_MZ; iz++)
+        for (m = 1; m <= OP_MX; m++)
+          XZ (tab, m, iz, k, l) = a_.xz[l - 1][k - 1][iz - 1][m - 1];
+
+  for (iz = 1; iz <= OP_MZ; iz++)
+  {
+    for (m = 1; m <= OP_MX; m++)
+      ZZ (tab, m, iz) = b_.zz[iz - 1][m - 1];
+    tab->za[iz] = a_.za[iz - 1];
+    tab->zza[iz] = ee_.zza[iz - 1];
+    tab->dfsz[iz] = a_.dfsz[iz - 1];
+  }
+
+  for (k = 1; k <= OP_NT; k++)
+  {
+    tab->t6list[k] = a_.t6list[k - 1];
+    tab->alt[k] = a_.alt[k - 1];
+    tab->dfs[k] = a_.dfs[k - 1];
+  }
+
+  for (l = 1; l <= OP_NR; l++)
+  {
+    tab->alr[l] = a_.alr[l - 1];
+    tab->dfsr[l] = a_.dfsr[l - 1];
+    tab->nta[l] = b_.nta[l - 1];
+  }
+
+  for (i = 1; i <= OP_MX; i++)
+  {
+    tab->xa[i] = a_.xa[i - 1];
+    tab->xx[i] = ee_.xx[i - 1];
+    tab->dfsx[i] = a_.dfsx[i - 1];
+  }
+}
+
+// Load the Opal tables into memory which is read only from then on. The tables
+// are mapped from the Opal cache if it is valid, otherwise they are read in
+// and smoothed by opal.f and the cache is rebuilt
+void
+init_opal_tables (void)
+{
+  OpalTables *tab;
+
+  if ((tab = map_opal_cache ()))
+  {
+    Log ("\t- Mapped Opal tables from %s\n", OPAL_CACHE_FILENAME);
+    opal_tables = tab;
+    return;
+  }
+
+  Log ("\t- Reading in Opal tables\n");
+
+  if (!(tab = calloc (1, sizeof (*tab))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for Opal tables\n");
+  read_opal_tables (tab);
+  opal_tables = tab;
+
+  if (write_opal_cache (tab))
+    Log ("\t- Unable to write Opal cache %s\n", OPAL_CACHE_FILENAME);
+  else
+    Log_verbose ("\t- Wrote Opal tables to %s\n", OPAL_CACHE_FILENAME);
+}
+
+// Read in GN93hz and write the Opal cache, replacing any existing cache.
+// Returns FAILURE if the cache could not be written
+int
+build_opal_cache (void)
+{
+  OpalTables *tab;
+
+  if (access (OPAL_FILENAME, F_OK) == -1)
+    Exit (FILE_OPEN_ERR, "%s not found in current directory.\n", OPAL_FILENAME);
+
+  Log (" - Reading in Opal tables from %s\n", OPAL_FILENAME);
+  if (!(tab = calloc (1, sizeof (*tab))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for Opal tables\n");
+  read_opal_tables (tab);
+
+  if (write_opal_cache (tab))
+  {
+    Log (" - Unable to write Opal cache %s\n", OPAL_CACHE_FILENAME);
+    free (tab);
+    return FAILURE;
+  }
+
+  Log (" - Wrote Opal tables to %s\n", OPAL_CACHE_FILENAME);
+  free (tab);
+
+  return SUCCESS;
+}
+
+// Free the memory for the Opal tables, or unmap them if they were mapped from
+// the Opal cache
+void
+clean_up_opal_tables (void)
+{
+  if (opal_cache_map)
+    munmap (opal_cache_map, OPAL_CACHE_HEADER_SIZE + sizeof (*opal_tables));
+  else
+    free (opal_tables);
+  opal_cache_map = NULL;
+  opal_tables = NULL;
+  Log_verbose (" - Opal tables cleaned up successfully\n");
+}
+
+// Return a description of a status code returned by opal_opacity
+char *
+opal_status_message (int status)
+{
+  switch (status)
+  {
+    case OPAL_OK:
+      return "No error";
+    case OPAL_OUT_OF_RANGE:
+      return "T6/LogR outside of table range";
+    case OPAL_MASS_FRACTIONS:
+      return "Mass fractions exceed unity";
+    case OPAL_Z_MISMATCH:
+      return "Z does not match Z in GN93hz files you are using";
+    case OPAL_UNCOVERED_XZ:
+      return "X,Z location not covered by logic";
+    case OPAL_BAD_INDICES:
+      return "Interpolation indices out of range";
+    default:
+      return "Unknown Opal status";
+  }
+}
+
+// Quadratic interpolation through the points (x1, y1), (x2, y2) and (x3, y3).
+// The derivative at x is returned in dkap, which was common block d in opal.f
+float
+opal_quad (float x, float y1, float y2, float y3, float x1, float x2, float x3, float *dkap)
+{
+  float xx12, xx13, xx23, xx1sq, xx1pxx2;
+  float c1, c2, c3;
+
+  xx12 = 1.0f / (x1 - x2);
+  xx13 = 1.0f / (x1 - x3);
+  xx23 = 1.0f / (x2 - x3);
+  xx1sq = x1 * x1;
+  xx1pxx2 = x1 + x2;
+
+  c3 = (y1 - y2) * xx12;
+  c3 = c3 - (y2 - y3) * xx23;
+  c3 = c3 * xx13;
+  c2 = (y1 - y2) * xx12 - xx1pxx2 * c3;
+  c1 = y1 - x1 * c2 - xx1sq * c3;
+  *dkap = c2 + (x + x) * c3;
+
+  return c1 + x * (c2 + x * c3);
+}
+
+// Interpolate in log(T6) and log(R) over the patch opk, mixing overlapping
+// quadratics to obtain smoothed derivatives. This is t6rinterp from opal.f
+int
+opal_t6rinterp (const OpalTables *tab, OpalState *s, float slr, float slt)
+{
+  int iu, kx, lx;
+  float h[5], q[5];
+  float dkap, dkap1, dkap2, dkapq1, dkapq2, dkapq3, dopactq, dopacrq;
+  float opact, opact2, opactq, opactq2;
+  float dopact, dopacr, dix = 0.0f, dix2 = 0.0f;
+  const float *alr = tab->alr, *alt = tab->alt;
+  int k1 = s->k1, k2 = s->k2, k3 = s->k3, k4 = s->k4;
+  int l1 = s->l1, l2 = s->l2, l3 = s->l3, l4 = s->l4;
+
+  dkapq1 = dopactq = 0.0f;
+  opactq = 0.0f;
+
+  iu = 0;
+  for (kx = k1; kx <= k1 + s->ip; kx++)
+  {
+    iu++;
+    h[iu] = opal_quad (slr, OPK (s, kx, l1), OPK (s, kx, l2), OPK (s, kx, l3), alr[l1], alr[l2], alr[l3], &dkap);
+    if (s->iq == 3)
+      q[iu] = opal_quad (slr, OPK (s, kx, l2), OPK (s, kx, l3), OPK (s, kx, l4), alr[l2], alr[l3], alr[l4], &dkap);
+  }
+
+  /*
+   * k and Dlog(k)/dlog(T6) in lower-right 3x3
+   */
+
+  opact = opal_quad (slt, h[1], h[2], h[3], alt[k1], alt[k2], alt[k3], &dkap);
+  dopact = dkap;
+  dkap1 = dkap;
+  if (s->iq == 3)
+  {
+    // k and Dlog(k)/Dlog(T6) upper-right 3x3
+    opactq = opal_quad (slt, q[1], q[2], q[3], alt[k1], alt[k2], alt[k3], &dkap);
+    dkapq1 = dkap;
+  }
+  if (s->ip == 3)
+  {
+    // k and Dlog(k)/Dlog(T6) in lower-left 3x3, then smoothed in left 3x4
+    opact2 = opal_quad (slt, h[2], h[3], h[4], alt[k2], alt[k3], alt[k4], &dkap);
+    dkap2 = dkap;
+    dix = (alt[k3] - slt) * tab->dfs[k3];
+    dopact = dkap1 * dix + dkap2 * (1.0f - dix);
+    opact = opact * dix + opact2 * (1.0f - dix);
+  }
+  if (s->iq == 3)
+  {
+    // k and Dlog(k)/Dlog(T6) in upper-right 3x3
+    opactq2 = opal_quad (slt, q[2], q[3], q[4], alt[k2], alt[k3], alt[k4], &dkap);
+    dkapq2 = dkap;
+    dopactq = dkapq1 * dix + dkapq2 * (1.0f - dix);
+    opactq = opactq * dix + opactq2 * (1.0f - dix);
+  }
+
+  iu = 0;
+  for (lx = l1; lx <= l1 + s->iq; lx++)
+  {
+    iu++;
+    h[iu] = opal_quad (slt, OPK (s, k1, lx), OPK (s, k2, lx), OPK (s, k3, lx), alt[k1], alt[k2], alt[k3], &dkap);
+    if (s->ip == 3)
+      q[iu] = opal_quad (slt, OPK (s, k2, lx), OPK (s, k3, lx), OPK (s, k4, lx), alt[k2], alt[k3], alt[k4], &dkap);
+  }
+
+  /*
+   * k and Dlog(k)/Dlog(R) in lower-left 3x3. Only the derivatives are needed
+   * from here on
+   */
+
+  opal_quad (slr, h[1], h[2], h[3], alr[l1], alr[l2], alr[l3], &dkap);
+  dopacr = dkap;
+  dkapq3 = 0.0f;
+  if (s->ip == 3)
+  {
+    // k and Dlog(k)/Dlog(R) in upper-left 3x3
+    opal_quad (slr, q[1], q[2], q[3], alr[l1], alr[l2], alr[l3], &dkap);
+    dkapq3 = dkap;
+  }
+  if (s->iq == 3)
+  {
+    // k and Dlog(k)/Dlog(R) in lower-right 3x3
+    opal_quad (slr, h[2], h[3], h[4], alr[l2], alr[l3], alr[l4], &dkap);
+    dix2 = (alr[l3] - slr) * tab->dfsr[l3];
+    dopacr = dopacr * dix2 + dkap * (1.0f - dix2);
+    if (s->ip == 3)
+    {
+      // k and Dlog(k)/Dlog(T6) smoothed in both log(T6) and log(R)
+      dopact = dopact * dix2 + dopactq * (1.0f - dix2);
+      opact = opact * dix2 + opactq * (1.0f - dix2);
+    }
+  }
+  if (s->ip == 3)
+  {
+    // k and Dlog(k)/Dlog(R) in upper-right 3x3
+    opal_quad (slr, q[2], q[3], q[4], alr[l2], alr[l3], alr[l4], &dkap);
+    if (s->iq == 3)
+    {
+      // Dlog(k)/Dlog(R) smoothed in both log(T6) and log(R)
+      dopacrq = dkapq3 * dix2 + dkap * (1.0f - dix2);
+      dopacr = dopacr * dix + dopacrq * (1.0f - dix);
+    }
+  }
+
+  s->opact = opact;
+  s->dopact = dopact;
+  s->dopacr = dopacr;
+  s->dopactd = dopact - 3.0f * dopacr;
+
+  if (opact > 1e15f)
+    return OPAL_BAD_INDICES;
+
+  if (opact > 9.0f)
+  {
+    s->dopact = 99.0f;
+    s->dopacr = 99.0f;
+    s->dopactd = 99.0f;
+  }
+
+  return OPAL_OK;
+}
+
+// Interpolate log(kappa) in X, T6 and R for the set of tables with Z index
+// mzin. If izi is 0, the table indices are recalculated, otherwise the
+// indices from the previous call are used. This is kappa from opal.f
+int
+opal_kappa (const OpalTables *tab, OpalState *s, int izi, int mzin, float xh, float t6, float r)
+{
+  int i, m, ir, it, ilo, ihi, imd;
+  int kmin, k1in, iadvance, mfin, mxend, ntlimit;
+  float z, xxx, slt, slr, dixr, opk2, dkap;
+
+  z = tab->za[mzin];
+
+  if ((izi == 0) && (z + xh - 1e-6f > 1.0f))
+    return OPAL_MASS_FRACTIONS;
+  if ((izi != 0) && (s->zval + xh - 1e-6f > 1.0f))
+    return OPAL_MASS_FRACTIONS;
+
+  xxx = log10f (0.005f + xh);
+  slt = log10f (t6);
+  slr = log10f (r);
+
+  /*
+   * The last X of the tables depends on Z, i.e. X = 1 - Z, so the X grid is
+   * adjusted for each set of tables
+   */
+
+  for (i = 1; i <= OP_MX; i++)
+  {
+    s->xa[i] = tab->xa[i];
+    s->xx[i] = tab->xx[i];
+    s->dfsx[i] = tab->dfsx[i];
+  }
+
+  mxend = OP_MX;
+  s->xa[OP_MX] = 1.0f - z;
+  if (s->xa[OP_MX] < s->xa[OP_MX - 1])
+  {
+    mxend = OP_MX - 1;
+    s->xa[mxend] = s->xa[OP_MX];
+  }
+  if (xh >= 0.8f)
+  {
+    s->xx[mxend] = log10f (0.005f + s->xa[mxend]);
+    s->dfsx[mxend] = 1.0f / (s->xx[mxend] - s->xx[mxend - 1]);
+  }
+
+  /*
+   * Determine log R and log T6 grid points to use in the interpolation
+   */
+
+  if ((slt < tab->alt[1]) || (slt > tab->alt[OP_NT]))
+    return OPAL_OUT_OF_RANGE;
+  if ((slr < tab->alr[1]) || (slr > tab->alr[OP_NR]))
+    return OPAL_OUT_OF_RANGE;
+
+  if (izi == 0)
+  {
+    ilo = 2;
+    ihi = OP_MX;
+    while (ihi - ilo > 1)
+    {
+      imd = (ihi + ilo) / 2;
+      if (xh <= s->xa[imd] + 1e-7f)
+        ihi = imd;
+      else
+        ilo = imd;
+    }
+    i = ihi;
+    s->mf = i - 2;
+    s->mg = i - 1;
+    s->mh = i;
+    s->mi = i + 1;
+    s->mf2 = s->mi;
+    if (xh < 1e-6f)
+    {
+      s->mh = 1;
+      s->mg = 1;
+      s->mi = 2;
+      s->mf2 = 1;
+    }
+    if ((xh <= s->xa[2] + 1e-7f) || (xh >= s->xa[OP_MX - 2] - 1e-7f))
+      s->mf2 = s->mh;
+
+    ilo = 2;
+    ihi = OP_NR;
+    while (ihi - ilo > 1)
+    {
+      imd = (ihi + ilo) / 2;
+      if (slr <= tab->alr[imd] + 1e-7f)
+        ihi = imd;
+      else
+        ilo = imd;
+    }
+    i = ihi;
+    s->l1 = i - 2;
+    s->l2 = i - 1;
+    s->l3 = i;
+    s->l4 = s->l3 + 1;
+
+    ilo = 2;
+    ihi = OP_NT;
+    while (ihi - ilo > 1)
+    {
+      imd = (ihi + ilo) / 2;
+      if (t6 <= tab->t6list[imd] + 1e-7f)
+        ihi = imd;
+      else
+        ilo = imd;
+    }
+    i = ihi;
+    s->k1 = i - 2;
+    s->k2 = i - 1;
+    s->k3 = i;
+    s->k4 = s->k3 + 1;
+    s->l3s = s->l3;
+    s->k3s = s->k3;
+  }
+
+  /*
+   * Where there is no data at low T for X = 0, either move up in X or move the
+   * patch to where there is data
+   */
+
+  kmin = 0;
+  k1in = s->k1;
+  iadvance = 0;
+  mfin = s->mf;
+  if ((mfin == 1) && (XZ (tab, 1, mzin, s->k1, s->l1) > 9.0f))
+  {
+    for (i = 1; i <= 6; i++)
+    {
+      if (XZ (tab, 1, mzin, i, s->l1) > 9.0f)
+      {
+        if (xh < 0.1f)
+        {
+          kmin = i + 1;
+        }
+        else if (iadvance == 0)
+        {
+          iadvance++;
+          s->mf++;
+          s->mg++;
+          s->mh++;
+          s->mi++;
+          s->mf2++;
+        }
+      }
+    }
+    if ((iadvance == 0) && (s->k1 <= kmin) && (slt <= tab->alt[kmin]))
+    {
+      s->k1 = kmin;
+      if ((XZ (tab, 1, mzin, kmin, s->l1 + 1) < 9.0f) && ((slr + 0.01f) > tab->alr[s->l1 + 1]))
+      {
+        s->l1++;
+        kmin = 0;
+        s->k1 = k1in;
+        for (i = 1; i <= 6; i++)
+          if (XZ (tab, 1, mzin, i, s->l1) > 9.0f)
+            kmin = i + 1;
+        if ((kmin != 0) && (k1in < kmin))
+          s->k1 = kmin;
+      }
+    }
+    if ((slt + 0.001f) < tab->alt[s->k1])
+    {
+      s->opact = 30.0f;
+      s->dopact = 99.0f;
+      s->dopacr = 99.0f;
+      s->dopactd = 99.0f;
+      return OPAL_OK;
+    }
+    s->l2 = s->l1 + 1;
+    s->l3 = s->l2 + 1;
+    s->l4 = s->l3 + 1;
+    s->l3s = s->l3;
+    s->k2 = s->k1 + 1;
+    s->k3 = s->k2 + 1;
+    s->k4 = s->k3 + 1;
+    s->k3s = s->k3;
+  }
+
+  /*
+   * Allow for the jagged edge of the tables at high T and R. opal.f would read
+   * past the end of the tables if l3 is past the last column, which can only
+   * happen after the patch has been moved above
+   */
+
+  for (i = 14; i <= 18; i++)
+    if ((s->l3s > i) && (s->k3s > tab->nta[i + 1]))
+      return OPAL_OUT_OF_RANGE;
+  if (s->l3 > OP_NR)
+    return OPAL_OUT_OF_RANGE;
+
+  for (m = s->mf; m <= s->mf2; m++)
+  {
+    s->ip = 3;
+    s->iq = 3;
+    ntlimit = tab->nta[s->l3s];
+    if ((s->k3 == ntlimit) || (IOP == 0))
+    {
+      s->ip = 2;
+      s->iq = 2;
+    }
+    if (t6 <= tab->t6list[2] + 1e-7f)
+      s->ip = 2;
+    if ((s->l3 == OP_NR) || (IOP == 0))
+    {
+      s->iq = 2;
+      s->ip = 2;
+    }
+    if ((s->l4 <= OP_NR) && (XZ (tab, m, mzin, s->k3, s->l4) == 0.0f))
+      s->iq = 2;
+    if (slr <= tab->alr[2] + 1e-7f)
+      s->iq = 2;
+
+    for (ir = s->l1; ir <= s->l1 + s->iq; ir++)
+      for (it = s->k1; it <= s->k1 + s->ip; it++)
+        OPL (s, m, it, ir) = XZ (tab, m, mzin, it, ir);
+  }
+
+  if ((ZZ (tab, s->mg, mzin) != ZZ (tab, s->mf, mzin)) || (ZZ (tab, s->mh, mzin) != ZZ (tab, s->mf, mzin)))
+    return OPAL_Z_MISMATCH;
+  if (z != ZZ (tab, s->mf, mzin))
+    return OPAL_Z_MISMATCH;
+
+  /*
+   * Interpolate in X using a quadratic, or by mixing two overlapping
+   * quadratics
+   */
+
+  for (ir = s->l1; ir <= s->l1 + s->iq; ir++)
+  {
+    for (it = s->k1; it <= s->k1 + s->ip; it++)
+    {
+      if (s->mf2 == 1)
+        OPK (s, it, ir) = OPL (s, s->mf, it, ir);
+      else
+        OPK (s, it, ir) = opal_quad (xxx, OPL (s, s->mf, it, ir), OPL (s, s->mg, it, ir), OPL (s, s->mh, it, ir),
+                                     s->xx[s->mf], s->xx[s->mg], s->xx[s->mh], &dkap);
+    }
+  }
+
+  if (s->mi == s->mf2)
+  {
+    dixr = (s->xx[s->mh] - xxx) * s->dfsx[s->mh];
+    for (ir = s->l1; ir <= s->l1 + s->iq; ir++)
+    {
+      for (it = s->k1; it <= s->k1 + s->ip; it++)
+      {
+        opk2 = opal_quad (xxx, OPL (s, s->mg, it, ir), OPL (s, s->mh, it, ir), OPL (s, s->mi, it, ir),
+                          s->xx[s->mg], s->xx[s->mh], s->xx[s->mi], &dkap);
+        OPK (s, it, ir) = OPK (s, it, ir) * dixr + opk2 * (1.0f - dixr);
+      }
+    }
+  }
+
+  /*
+   * Completed H, Z interpolation. Now interpolate T6 and log R on a 4x4 grid
+   */
+
+  return opal_t6rinterp (tab, s, slr, slt);
+}
+
+// Find the Rosseland mean opacity and its derivatives for the composition z
+// and xh, temperature t6 (in millions of Kelvin) and r = rho / t6^3. The
+// interpolation along Z is done here using the tables either side of z. This
+// is opacgn93 from opal.f. Returns OPAL_OK, or the status of the error
+int
+opal_opacity (const OpalTables *tables, OpalState *state, double z, double xh, double t6, double r,
+              OpalOpacity *opacity)
+{
+  int i, iz, izi, ilo, ihi, imd, status;
+  int m1, m2, m3, m4, mfm;
+  float zf = (float) z, xhf = (float) xh, t6f = (float) t6, rf = (float) r;
+  float zzl, dix, dkap;
+  float kapz[OP_MZ + 2] = {0}, dkapdtr[OP_MZ + 2] = {0}, dkapdrt[OP_MZ + 2] = {0};
+  float kapz1, kapz2, dkapz1, dkapz2, dkapz3, dkapz4;
+  const float *zza = tables->zza;
+
+  state->zval = zf;
+  zzl = zf;
+
+  /*
+   * If Z is one of the tables, then there is no need to interpolate along Z
+   */
+
+  for (i = 1; i <= OP_MZ; i++)
+  {
+    if (fabsf (zf - tables->za[i]) < 1e-7f)
+    {
+      if ((status = opal_kappa (tables, state, 0, i, xhf, t6f, rf)) != OPAL_OK)
+        return status;
+      opacity->opact = state->opact;
+      opacity->dopact = state->dopact;
+      opacity->dopacr = state->dopacr;
+      opacity->dopactd = state->dopactd;
+      return OPAL_OK;
+    }
+  }
+
+  ilo = 2;
+  ihi = OP_MZ;
+  while (ihi - ilo > 1)
+  {
+    imd = (ihi + ilo) / 2;
+    if (zf <= tables->za[imd] + 1e-7f)
+      ihi = imd;
+    else
+      ilo = imd;
+  }
+  i = ihi;
+  m1 = i - 2;
+  m2 = i - 1;
+  m3 = i;
+  m4 = i + 1;
+  mfm = m4;
+
+  /*
+   * Check whether Z is near a table limit, and if the Z + X interpolation sums
+   * exceed unity at the needed indices. If so, backup to lower Z indices
+   */
+
+  if ((zf <= tables->za[2] + 1e-7f) || (zf >= tables->za[OP_MZ - 1]))
+    mfm = m3;
+  if (xhf + tables->za[mfm] > 1.0f)
+    mfm = m3;
+  if (xhf + tables->za[mfm] > 1.0f)
+  {
+    if (m1 <= 1)
+      return OPAL_UNCOVERED_XZ;
+    m1--;
+    m2--;
+    m3--;
+  }
+
+  izi = 0;
+  for (iz = m1; iz <= mfm; iz++)
+  {
+    if ((status = opal_kappa (tables, state, izi, iz, xhf, t6f, rf)) != OPAL_OK)
+      return status;
+    izi = 1;
+    kapz[iz] = powf (10.0f, state->opact);
+    dkapdtr[iz] = state->dopact;
+    dkapdrt[iz] = state->dopacr;
+  }
+
+  kapz1 = opal_quad (zzl, kapz[m1], kapz[m2], kapz[m3], zza[m1], zza[m2], zza[m3], &dkap);
+  dkapz1 = opal_quad (zzl, dkapdtr[m1], dkapdtr[m2], dkapdtr[m3], zza[m1], zza[m2], zza[m3], &dkap);
+  dkapz3 = opal_quad (zzl, dkapdrt[m1], dkapdrt[m2], dkapdrt[m3], zza[m1], zza[m2], zza[m3], &dkap);
+
+  if (mfm == m3)
+  {
+    opacity->opact = log10f (kapz1);
+    opacity->dopact = dkapz1;
+    opacity->dopacr = dkapz3;
+    opacity->dopactd = -3.0f * dkapz3 + dkapz1;
+    return OPAL_OK;
+  }
+
+  kapz2 = opal_quad (zzl, kapz[m2], kapz[m3], kapz[m4], zza[m2], zza[m3], zza[m4], &dkap);
+  dkapz2 = opal_quad (zzl, dkapdtr[m2], dkapdtr[m3], dkapdtr[m4], zza[m2], zza[m3], zza[m4], &dkap);
+  dkapz4 = opal_quad (zzl, dkapdrt[m2], dkapdrt[m3], dkapdrt[m4], zza[m2], zza[m3], zza[m4], &dkap);
+  dix = (zza[m3] - zzl) * tables->dfsz[m3];
+
+  opacity->opact = log10f (kapz1 * dix + kapz2 * (1.0f - dix));
+  opacity->dopact = dkapz1 * dix + dkapz2 * (1.0f - dix);
+  opacity->dopacr = dkapz3 * dix + dkapz4 * (1.0f - dix);
+  opacity->dopactd = -3.0f * (float) opacity->dopacr + (float) opacity->dopact;
+
+  return OPAL_OK;
+}
@@ -0,0 +1,115 @@
+/* ***************************************************************************
+ *
+ * @file opal.h
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Structures and function definitions for the reentrant interpolation
+ *        of the Opal opacity tables.
+ *
+ * @details
+ *
+ * The Opal interpolation routines in opal.f keep their state in SAVE variables
+ * and common blocks and return the opacity via the common block e, so they
+ * can not be used by more than one thread. The routines in opal.c are a port
+ * of opacgn93, kappa, t6rinterp and quad where the tables are read only once
+ * they have been loaded and everything which changes during a call is held in
+ * an OpalState owned by the caller. Each thread should have its own OpalState.
+ *
+ * The arithmetic is done in single precision, as in opal.f, so the results are
+ * the same as the Fortran routines.
+ *
+ * ************************************************************************** */
+
+#ifndef OPAL_H
+#define OPAL_H
+
+#include "flib/flib.h"
+
+/*
+ * The status codes returned by opal_opacity, these correspond to the places
+ * where opal.f would stop
+ */
+
+enum OPAL_STATUS
+{
+  OPAL_OK,
+  OPAL_OUT_OF_RANGE,
+  OPAL_MASS_FRACTIONS,
+  OPAL_Z_MISMATCH,
+  OPAL_UNCOVERED_XZ,
+  OPAL_BAD_INDICES
+};
+
+/*
+ * The Opal tables, after they have been read in and smoothed by readco. To
+ * keep the port close to opal.f the arrays are one based, hence the extra
+ * element in each dimension, and the order of the dimensions is the reverse
+ * of opal.f, i.e. xz(m, iz, k, l) is xz[l][k][iz][m]
+ */
+
+typedef struct OpalTables
+{
+  float xz[OP_NR + 1][OP_NT + 1][OP_MZ + 1][OP_MX + 1];
+  float zz[OP_MZ + 1][OP_MX + 1];
+  float t6list[OP_NT + 1];
+  float alt[OP_NT + 1];
+  float alr[OP_NR + 1];
+  float dfs[OP_NT + 1];
+  float dfsr[OP_NR + 1];
+  float dfsz[OP_MZ + 1];
+  float xa[OP_MX + 1];
+  float xx[OP_MX + 1];
+  float dfsx[OP_MX + 1];
+  float za[OP_MZ + 1];
+  float zza[OP_MZ + 1];
+  int nta[OP_NR + 1];
+} OpalTables;
+
+/*
+ * The working state of one call of opal_opacity. The X grid is adjusted for
+ * each Z during a call, so the copies of xa, xx and dfsx live here. opl and opk
+ * only hold the 4 x 4 patch of the tables around the point
+ */
+
+typedef struct OpalState
+{
+  int mf, mg, mh, mi, mf2;
+  int l1, l2, l3, l4, l3s;
+  int k1, k2, k3, k4, k3s;
+  int ip, iq;
+  float zval;
+  float xa[OP_MX + 1];
+  float xx[OP_MX + 1];
+  float dfsx[OP_MX + 1];
+  float opl[OP_MX + 2][4][4];
+  float opk[4][4];
+  float opact, dopact, dopacr, dopactd;
+} OpalState;
+
+/*
+ * The opacity returned by opal_opacity:
+ *
+ * OPACT       Is the Log of the Rosseland mean opacity: Log(kappa)
+ * DOPACT      Is Dlog(kappa)/Dlog(T6)   at constant R
+ * DOPACR      Is Dlog(kappa)/Dlog(R)    at constant T
+ * DOPACTD     Is Dlog(kappa)/Dlog(T6)   at constant Rho
+ */
+
+typedef struct OpalOpacity
+{
+  double opact;
+  double dopact;
+  double dopacr;
+  double dopactd;
+} OpalOpacity;
+
+OpalTables *opal_tables;
+
+int opal_opacity (const OpalTables *tables, OpalState *state, double z, double xh, double t6, double r,
+                  OpalOpacity *opacity);
+char *opal_status_message (int status);
+
+#endif
@@ -0,0 +1,207 @@
+/* ***************************************************************************
+ *
+ * @file opal_slice.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Functions for the fixed composition fast path for the Opal opacities.
+ *
+ * @details
+ *
+ * The composition of the atmosphere does not change during a run, so the X
+ * and Z interpolation which opal_opacity performs for every cell gives the
+ * same result each time it is called. Instead, opal_opacity is called once for
+ * each point of the native (logT, logR) lattice of the Opal tables at the start
+ * of the run, using an OpalState owned by the caller, and the opacity and its
+ * derivatives dlog(kappa)/dlog(T) and dlog(kappa)/dlog(R) are stored as a 2D
+ * slice. A cell is then looked up using bicubic Hermite interpolation, using
+ * the derivatives from Opal at each knot.
+ *
+ * Lattice points which are beyond the jagged high T and high R edge of the
+ * tables, where Opal can not interpolate, or where Opal has no data, are
+ * marked as missing. Any cell of the slice which touches a missing point is
+ * not used and the full Opal routine is called instead.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "snake.h"
+#include "interp_2d.h"
+#include "opal.h"
+
+/*
+ * Any value of log(kappa) above this value is a flag from Opal that there is
+ * no data at that point
+ */
+
+#define OP_NO_DATA 9.0
+
+/*
+ * The slice of the Opal tables for the composition of the atmosphere. The
+ * tables are stored with logR varying fastest, as required by the
+ * interpolation engine. cell_ok is TRUE for each cell of the slice where all
+ * four knots have data
+ */
+
+typedef struct OpalSlice
+{
+  double logR[OP_NR];
+  double logT[OP_NT];
+  double logk[OP_NT * OP_NR];
+  double dlogk_dlogR[OP_NT * OP_NR];
+  double dlogk_dlogT[OP_NT * OP_NR];
+  double d2logk[OP_NT * OP_NR];
+  int have_data[OP_NT * OP_NR];
+  int cell_ok[(OP_NT - 1) * (OP_NR - 1)];
+  Interp2D interp;
+} OpalSlice;
+
+OpalSlice *opal_slice;
+
+// Calculate the cross derivative d2log(kappa)/dlog(R)dlog(T) at each knot by
+// differencing the Opal derivatives between neighbouring knots. Only knots
+// with data are used, so missing knots do not affect the knots next to them
+void
+opal_slice_cross_derivatives (OpalSlice *s)
+{
+  int k, l, lo, hi, n;
+  double d;
+
+  for (k = 0; k < OP_NT; k++)
+  {
+    for (l = 0; l < OP_NR; l++)
+    {
+      s->d2logk[k * OP_NR + l] = 0.0;
+      if (!s->have_data[k * OP_NR + l])
+        continue;
+
+      n = 0;
+      d = 0.0;
+
+      // d/dlogT of dlog(kappa)/dlog(R)
+      lo = (k > 0 && s->have_data[(k - 1) * OP_NR + l]) ? k - 1 : k;
+      hi = (k < OP_NT - 1 && s->have_data[(k + 1) * OP_NR + l]) ? k + 1 : k;
+      if (hi > lo)
+      {
+        d += (s->dlogk_dlogR[hi * OP_NR + l] - s->dlogk_dlogR[lo * OP_NR + l]) / (s->logT[hi] - s->logT[lo]);
+        n++;
+      }
+
+      // d/dlogR of dlog(kappa)/dlog(T)
+      lo = (l > 0 && s->have_data[k * OP_NR + l - 1]) ? l - 1 : l;
+      hi = (l < OP_NR - 1 && s->have_data[k * OP_NR + l + 1]) ? l + 1 : l;
+      if (hi > lo)
+      {
+        d += (s->dlogk_dlogT[k * OP_NR + hi] - s->dlogk_dlogT[k * OP_NR + lo]) / (s->logR[hi] - s->logR[lo]);
+        n++;
+      }
+
+      if (n > 0)
+        s->d2logk[k * OP_NR + l] = d / n;
+    }
+  }
+}
+
+// Initialise the fixed composition slice of the Opal tables for X and Z
+void
+init_opal_slice (void)
+{
+  int k, l, knot, n_missing = 0;
+  OpalState state;
+  OpalOpacity opacity;
+
+  Log ("\t- Initialising fixed composition slice of the Opal tables\n");
+
+  if (!(opal_slice = calloc (1, sizeof (*opal_slice))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for Opal slice\n");
+
+  for (l = 0; l < OP_NR; l++)
+    opal_slice->logR[l] = opal_tables->alr[l + 1];
+  for (k = 0; k < OP_NT; k++)
+    opal_slice->logT[k] = opal_tables->alt[k + 1] + 6.0;
+
+  /*
+   * Call Opal at each knot of the lattice, skipping those where Opal can not
+   * interpolate as the patch of the tables it uses reaches past the edge of
+   * the tables. Opal returns the derivative with respect to log(T6), which is
+   * the same as the derivative with respect to log(T)
+   */
+
+  for (k = 0; k < OP_NT; k++)
+  {
+    for (l = 0; l < OP_NR; l++)
+    {
+      knot = k * OP_NR + l;
+      if (opal_opacity (opal_tables, &state, geo.Z, geo.X, opal_tables->t6list[k + 1],
+                        (float) pow (10.0, opal_tables->alr[l + 1]), &opacity) != OPAL_OK ||
+          opacity.opact > OP_NO_DATA)
+      {
+        n_missing++;
+        continue;
+      }
+
+      opal_slice->have_data[knot] = TRUE;
+      opal_slice->logk[knot] = opacity.opact;
+      opal_slice->dlogk_dlogT[knot] = opacity.dopact;
+      opal_slice->dlogk_dlogR[knot] = opacity.dopacr;
+    }
+  }
+
+  for (k = 0; k < OP_NT - 1; k++)
+    for (l = 0; l < OP_NR - 1; l++)
+      opal_slice->cell_ok[k * (OP_NR - 1) + l] =
+        opal_slice->have_data[k * OP_NR + l] && opal_slice->have_data[k * OP_NR + l + 1] &&
+        opal_slice->have_data[(k + 1) * OP_NR + l] && opal_slice->have_data[(k + 1) * OP_NR + l + 1];
+
+  opal_slice_cross_derivatives (opal_slice);
+  interp2d_init_hermite (&opal_slice->interp, opal_slice->logR, OP_NR, opal_slice->logT, OP_NT,
+                         opal_slice->logk, opal_slice->dlogk_dlogR, opal_slice->dlogk_dlogT,
+                         opal_slice->d2logk);
+
+  Log_verbose ("\t\t- Opal slice has %i knots, %i of which have no data\n", OP_NT * OP_NR, n_missing);
+}
+
+// Look up log(kappa) for logT and logR using the fixed composition slice of
+// the Opal tables. The derivatives dlog(kappa)/dlog(T) and dlog(kappa)/dlog(R)
+// are also returned if dlogk_dlogT and dlogk_dlogR are not NULL. Returns
+// FAILURE if the slice can not be used for this point, in which case the full
+// Opal routine should be used instead
+int
+opal_slice_lookup (double logT, double logR, double *logRMO, double *dlogk_dlogT, double *dlogk_dlogR)
+{
+  int i, j;
+  double f, dfdx, dfdy;
+
+  i = interp_axis_index (&opal_slice->interp.x, logR);
+  j = interp_axis_index (&opal_slice->interp.y, logT);
+
+  if (!opal_slice->cell_ok[j * (OP_NR - 1) + i])
+    return FAILURE;
+
+  interp2d_eval_deriv (&opal_slice->interp, logR, logT, &f, &dfdx, &dfdy);
+
+  *logRMO = f;
+  if (dlogk_dlogT)
+    *dlogk_dlogT = dfdy;
+  if (dlogk_dlogR)
+    *dlogk_dlogR = dfdx;
+
+  return SUCCESS;
+}
+
+// Clean up the fixed composition slice of the Opal tables
+void
+clean_up_opal_slice (void)
+{
+  if (!opal_slice)
+    return;
+
+  interp2d_free (&opal_slice->interp);
+  free (opal_slice);
+  opal_slice = NULL;
+  Log_verbose (" - Opal slice cleaned up successfully\n");
+}
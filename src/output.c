@@ -11,25 +11,290 @@
  *
  * @details
  *
+ * The grid can be written as text to sgrid.out, as binary to sgrid.bin, to
+ * both, or not at all, depending on the optional parameter output_format. The
+ * binary file is laid out so it can be memory mapped without being parsed:
+ *
+ *  - A header of BIN_HEADER_SIZE bytes, in the byte order of the machine which
+ *    wrote the file:
+ *      char    magic[8]        "SNAKEBIN"
+ *      int32   endian          BIN_ENDIAN_MARK, to detect the byte order
+ *      int32   version         BIN_VERSION
+ *      int32   header_size     BIN_HEADER_SIZE
+ *      int32   n_fields        BIN_NFIELDS
+ *      int32   nz_cells
+ *      int32   n_cycles        the number of cycle blocks in the file
+ *      char    fields[n_fields][BIN_NAME_LEN]
+ *  - One block for each cycle written, each of 8 * (2 + n_fields * nz_cells)
+ *    bytes of float64:
+ *      float64 icycle
+ *      float64 tot_tau
+ *      float64 field[n_fields][nz_cells]
+ *
+ * The fields are in the same order as the columns of sgrid.out. n_cycles is
+ * only updated when the file is closed, so if Snake did not finish the number
+ * of cycles should be taken from the size of the file.
+ *
+ * Unless the optional parameter output_async is 0, the grid is written by a
+ * background thread. write_grid copies the grid into the next free snapshot
+ * of a pool of output_buffers snapshots and returns, so the next iteration can
+ * begin whilst the snapshot is being written. The snapshots are written in the
+ * order they were taken. If all of the snapshots are waiting to be written,
+ * write_grid waits for the writer thread to free one.
+ *
+ * Which cycles are written is controlled by output_snapshots, which can be
+ * every, to write the initial grid, every output_every cycles and the final
+ * cycle, converged, to write only the cycle in which the grid converged, or
+ * initial_final, to write only the initial grid and the final cycle. If
+ * output_summary is 1, a line containing tot_tau, T_eff and the fraction of
+ * converged cells is also written to sgrid_summary.out for every cycle.
+ *
  * ************************************************************************** */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "snake.h"
 
+#define BIN_MAGIC "SNAKEBIN"
+#define BIN_ENDIAN_MARK 0x01020304
+#define BIN_VERSION 1
+#define BIN_NFIELDS 7
+#define BIN_NAME_LEN 32
+#define BIN_HEADER_SIZE (8 + 6 * 4 + BIN_NFIELDS * BIN_NAME_LEN)
+
+const char *bin_fields[BIN_NFIELDS] =
+  {"n_cell", "zcoord", "rho", "rosseland_opacity", "cell_optical_depth", "cumulative_tau", "temperature"};
+
 FILE *outfile;
 char output_name[LINE_LEN];
 
+FILE *binfile;
+char binary_name[LINE_LEN];
+int n_binary_cycles;
+double *binary_buffer;
+
+int output_text;
+int output_binary;
+
+/*
+ * The choices for which cycles are written to the grid output file
+ */
+
+enum SNAPSHOT_MODES
+{
+  SNAPSHOT_EVERY,
+  SNAPSHOT_CONVERGED,
+  SNAPSHOT_INITIAL_FINAL
+};
+
+int snapshot_mode;
+int output_every;
+
+FILE *summaryfile;
+char summary_name[LINE_LEN];
+
+/*
+ * A copy of the grid at the end of a cycle. T_old is not written, so it is not
+ * copied
+ */
+
+typedef struct Snapshot
+{
+  int icycle;
+  double tot_tau;
+  Grid grid;
+} Snapshot;
+
+/*
+ * The pool of snapshots for the writer thread, used as a ring buffer. The
+ * snapshots waiting to be written are n_queued snapshots starting at head.
+ * The snapshot at head is only freed once it has been written
+ */
+
+typedef struct Writer
+{
+  int async;
+  int running;
+  int shutdown;
+  int n_buffers;
+  int head;
+  int n_queued;
+  int n_waits;
+  Snapshot *buffers;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+  pthread_cond_t freed;
+} Writer;
+
+Writer writer;
+
+// Write the header of the binary grid output file. This is called again when
+// the file is closed to update the number of cycles
+void
+write_binary_header (void)
+{
+  int i;
+  int32_t ints[6];
+  char name[BIN_NAME_LEN];
+
+  ints[0] = BIN_ENDIAN_MARK;
+  ints[1] = BIN_VERSION;
+  ints[2] = BIN_HEADER_SIZE;
+  ints[3] = BIN_NFIELDS;
+  ints[4] = geo.nz_cells;
+  ints[5] = n_binary_cycles;
+
+  rewind (binfile);
+  fwrite (BIN_MAGIC, 1, 8, binfile);
+  fwrite (ints, sizeof (*ints), 6, binfile);
+  for (i = 0; i < BIN_NFIELDS; i++)
+  {
+    memset (name, 0, BIN_NAME_LEN);
+    strncpy (name, bin_fields[i], BIN_NAME_LEN - 1);
+    fwrite (name, 1, BIN_NAME_LEN, binfile);
+  }
+
+  if (ferror (binfile))
+    Exit (FILE_OPEN_ERR, "Unable to write header to %s\n", binary_name);
+}
+
+// Initialise the choice of which cycles are written and the summary file
+void
+init_output_cadence (void)
+{
+  int output_summary = FALSE;
+  char output_snapshots[LINE_LEN];
+
+  strcpy (output_snapshots, "every");
+  get_optional_string ("output_snapshots", output_snapshots);
+
+  if (!strcmp (output_snapshots, "every"))
+    snapshot_mode = SNAPSHOT_EVERY;
+  else if (!strcmp (output_snapshots, "converged"))
+    snapshot_mode = SNAPSHOT_CONVERGED;
+  else if (!strcmp (output_snapshots, "initial_final"))
+    snapshot_mode = SNAPSHOT_INITIAL_FINAL;
+  else
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for output_snapshots: %s. Allowed: every, converged or initial_final\n",
+          output_snapshots);
+
+  output_every = 1;
+  get_optional_int ("output_every", &output_every);
+  if (output_every < 1)
+    Exit (INVALID_VALUE, "Invalid value for output_every: output_every should be at least 1\n");
+
+  if (snapshot_mode == SNAPSHOT_EVERY)
+    Log_verbose ("\t\t- Writing the grid every %i cycles\n", output_every);
+  else
+    Log_verbose ("\t\t- Writing the grid for the %s cycles only\n", output_snapshots);
+
+  get_optional_int ("output_summary", &output_summary);
+  if ((output_summary != FALSE) && (output_summary != TRUE))
+    Exit (UNKNOWN_PARAMETER, "Invalid value for output_summary: output_summary should be 0 or 1\n");
+
+  if (output_summary)
+  {
+    prefixed_name (summary_name, "sgrid_summary.out");
+    Log ("\t- Initialising summary file %s\n", summary_name);
+    if (!(summaryfile = fopen (summary_name, "w")))
+      Exit (FILE_IN_ERR, "Can't open file %s to write\n", summary_name);
+    fprintf (summaryfile, "# cycle tot_tau T_eff converged_fraction\n");
+  }
+}
+
 // Initialise the grid output file
 void
 init_outfile (void)
 {
-  strcpy (output_name, "sgrid.out");
-  Log ("\t- Initialising output file %s\n", output_name);
-  if (!(outfile = fopen (output_name, "w")))
-    Exit (FILE_IN_ERR, "Can't open file %s to write\n", output_name);
-  Log_verbose ("\t\t- Opened %s with write access\n", output_name);
+  char output_format[LINE_LEN];
+
+  strcpy (output_format, "text");
+  get_optional_string ("output_format", output_format);
+
+  output_text = !strcmp (output_format, "text") || !strcmp (output_format, "both");
+  output_binary = !strcmp (output_format, "binary") || !strcmp (output_format, "both");
+  if (!output_text && !output_binary && strcmp (output_format, "none"))
+    Exit (UNKNOWN_PARAMETER, "Unknown choice for output_format: %s. Allowed: text, binary, both or none\n",
+          output_format);
+
+  if (output_text)
+  {
+    prefixed_name (output_name, "sgrid.out");
+    Log ("\t- Initialising output file %s\n", output_name);
+    if (!(outfile = fopen (output_name, "w")))
+      Exit (FILE_IN_ERR, "Can't open file %s to write\n", output_name);
+    Log_verbose ("\t\t- Opened %s with write access\n", output_name);
+  }
+
+  /*
+   * The header is written once the number of cells is known, i.e. when the
+   * first cycle is written
+   */
+
+  if (output_binary)
+  {
+    prefixed_name (binary_name, "sgrid.bin");
+    Log ("\t- Initialising binary output file %s\n", binary_name);
+    if (!(binfile = fopen (binary_name, "wb")))
+      Exit (FILE_IN_ERR, "Can't open file %s to write\n", binary_name);
+    Log_verbose ("\t\t- Opened %s with write access\n", binary_name);
+  }
+
+  writer.async = TRUE;
+  writer.n_buffers = 2;
+  get_optional_int ("output_async", &writer.async);
+  get_optional_int ("output_buffers", &writer.n_buffers);
+  if ((writer.async != FALSE) && (writer.async != TRUE))
+    Exit (UNKNOWN_PARAMETER, "Invalid value for output_async: output_async should be 0 or 1\n");
+  if (writer.n_buffers < 1)
+    Exit (INVALID_VALUE, "Invalid value for output_buffers: output_buffers should be at least 1\n");
+  if (writer.async)
+    Log_verbose ("\t\t- Writing the grid in the background with %i buffers\n", writer.n_buffers);
+
+  init_output_cadence ();
+}
+
+// Stop the writer thread once it has written all of the queued snapshots and
+// free the snapshots
+void
+stop_writer (void)
+{
+  int i;
+
+  if (!writer.running)
+    return;
+
+  pthread_mutex_lock (&writer.lock);
+  writer.shutdown = TRUE;
+  pthread_cond_signal (&writer.queued);
+  pthread_mutex_unlock (&writer.lock);
+
+  if (pthread_join (writer.thread, NULL))
+    Exit (FILE_CLOSE_ERR, "Unable to join the output writer thread\n");
+
+  pthread_mutex_destroy (&writer.lock);
+  pthread_cond_destroy (&writer.queued);
+  pthread_cond_destroy (&writer.freed);
+  writer.running = FALSE;
+
+  for (i = 0; i < writer.n_buffers; i++)
+  {
+    free (writer.buffers[i].grid.n);
+    free (writer.buffers[i].grid.z);
+    free (writer.buffers[i].grid.rho);
+    free (writer.buffers[i].grid.kappa);
+    free (writer.buffers[i].grid.cell_tau);
+    free (writer.buffers[i].grid.tau_depth);
+    free (writer.buffers[i].grid.T);
+  }
+  free (writer.buffers);
+
+  Log_verbose (" - Output writer stopped, the solver waited for a free buffer %i times\n", writer.n_waits);
 }
 
 // Close the grid output file
@@ -55,28 +320,242 @@ close_outfile (void)
    * allocated fixed this problem.
    */
 
+  stop_writer ();
+
+  if (summaryfile)
+  {
+    if (fclose (summaryfile))
+      Exit (FILE_CLOSE_ERR, "Can't close the summary file\n");
+    Log_verbose (" - Closed %s successfully\n", summary_name);
+  }
 
-  if (fclose (outfile))
-    Exit (FILE_CLOSE_ERR, "Can't close the output file\n");
-  Log_verbose (" - Closed %s successfully\n", output_name);
+  if (output_text)
+  {
+    if (fclose (outfile))
+      Exit (FILE_CLOSE_ERR, "Can't close the output file\n");
+    Log_verbose (" - Closed %s successfully\n", output_name);
+  }
+
+  if (output_binary)
+  {
+    write_binary_header ();
+    if (fclose (binfile))
+      Exit (FILE_CLOSE_ERR, "Can't close the binary output file\n");
+    free (binary_buffer);
+    Log_verbose (" - Closed %s successfully with %i cycles\n", binary_name, n_binary_cycles);
+  }
 }
 
-// Write to the grid output file. This should only need to be called and not
-// looped over and called for each cell
+// Write a snapshot of the grid as a cycle block to the binary grid output file
 void
-write_grid (void)
+write_snapshot_binary (const Snapshot *snap)
+{
+  int i;
+  size_t nz = (size_t) geo.nz_cells;
+  double cycle_info[2];
+
+  cycle_info[0] = snap->icycle;
+  cycle_info[1] = snap->tot_tau;
+  fwrite (cycle_info, sizeof (*cycle_info), 2, binfile);
+
+  for (i = 0; i < geo.nz_cells; i++)  // The cell numbers are stored as float64 too
+    binary_buffer[i] = snap->grid.n[i];
+
+  fwrite (binary_buffer, sizeof (*binary_buffer), nz, binfile);
+  fwrite (snap->grid.z, sizeof (*snap->grid.z), nz, binfile);
+  fwrite (snap->grid.rho, sizeof (*snap->grid.rho), nz, binfile);
+  fwrite (snap->grid.kappa, sizeof (*snap->grid.kappa), nz, binfile);
+  fwrite (snap->grid.cell_tau, sizeof (*snap->grid.cell_tau), nz, binfile);
+  fwrite (snap->grid.tau_depth, sizeof (*snap->grid.tau_depth), nz, binfile);
+  fwrite (snap->grid.T, sizeof (*snap->grid.T), nz, binfile);
+
+  if (ferror (binfile))
+    Exit (FILE_OPEN_ERR, "Unable to write cycle %i to %s\n", snap->icycle, binary_name);
+
+  n_binary_cycles++;
+}
+
+// Write a snapshot of the grid to the text grid output file
+void
+write_snapshot_text (const Snapshot *snap)
 {
   int i;
 
-  if (geo.icycle == 0)
-    fprintf (outfile, "# Grid init tot_tau %e\n", geo.tot_tau);
+  if (snap->icycle == 0)
+    fprintf (outfile, "# Grid init tot_tau %e\n", snap->tot_tau);
   else
-    fprintf (outfile, "# Cycle %i tot_tau %e\n", geo.icycle, geo.tot_tau);
+    fprintf (outfile, "# Cycle %i tot_tau %e\n", snap->icycle, snap->tot_tau);
 
   fprintf (outfile,  // Write header
            "# n_cell zcoord rho rosseland_opacity cell_optical_depth cumulative_tau temperature\n");
 
   for (i = 0; i < geo.nz_cells; i++)  // Write grid
-    fprintf (outfile, "%+i %+e %+e %+e %+e %+e %+e\n", grid[i].n, grid[i].z, grid[i].rho, grid[i].kappa,
-             grid[i].cell_tau, grid[i].tau_depth, grid[i].T);
+    fprintf (outfile, "%+i %+e %+e %+e %+e %+e %+e\n", snap->grid.n[i], snap->grid.z[i], snap->grid.rho[i],
+             snap->grid.kappa[i], snap->grid.cell_tau[i], snap->grid.tau_depth[i], snap->grid.T[i]);
+}
+
+// Write a snapshot of the grid to each of the output files
+void
+write_snapshot (const Snapshot *snap)
+{
+  if (output_binary)
+    write_snapshot_binary (snap);
+  if (output_text)
+    write_snapshot_text (snap);
+}
+
+// The writer thread, which writes the queued snapshots in order until it is
+// told to stop and there are no snapshots left to write
+void *
+writer_thread (void *arg)
+{
+  Snapshot *snap;
+
+  pthread_mutex_lock (&writer.lock);
+
+  while (TRUE)
+  {
+    while (!writer.n_queued && !writer.shutdown)
+      pthread_cond_wait (&writer.queued, &writer.lock);
+    if (!writer.n_queued)
+      break;
+
+    snap = &writer.buffers[writer.head];
+    pthread_mutex_unlock (&writer.lock);
+
+    write_snapshot (snap);
+
+    pthread_mutex_lock (&writer.lock);
+    writer.head = (writer.head + 1) % writer.n_buffers;
+    writer.n_queued--;
+    pthread_cond_signal (&writer.freed);
+  }
+
+  pthread_mutex_unlock (&writer.lock);
+
+  return NULL;
+}
+
+// Allocate the snapshots and start the writer thread
+void
+start_writer (void)
+{
+  int i;
+
+  if (!(writer.buffers = calloc ((size_t) writer.n_buffers, sizeof (*writer.buffers))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for output buffers\n");
+
+  for (i = 0; i < writer.n_buffers; i++)
+  {
+    writer.buffers[i].grid.n = allocate_grid_array (sizeof (*grid.n));
+    writer.buffers[i].grid.z = allocate_grid_array (sizeof (*grid.z));
+    writer.buffers[i].grid.rho = allocate_grid_array (sizeof (*grid.rho));
+    writer.buffers[i].grid.kappa = allocate_grid_array (sizeof (*grid.kappa));
+    writer.buffers[i].grid.cell_tau = allocate_grid_array (sizeof (*grid.cell_tau));
+    writer.buffers[i].grid.tau_depth = allocate_grid_array (sizeof (*grid.tau_depth));
+    writer.buffers[i].grid.T = allocate_grid_array (sizeof (*grid.T));
+  }
+
+  writer.head = writer.n_queued = writer.n_waits = 0;
+  writer.shutdown = FALSE;
+  pthread_mutex_init (&writer.lock, NULL);
+  pthread_cond_init (&writer.queued, NULL);
+  pthread_cond_init (&writer.freed, NULL);
+
+  if (pthread_create (&writer.thread, NULL, writer_thread, NULL))
+    Exit (MEM_ALLOC_ERR, "Unable to start the output writer thread\n");
+  writer.running = TRUE;
+}
+
+// Allocate the buffers used to write the grid, once the number of cells is
+// known, so nothing is allocated when the grid is written during the
+// iterations. The header of the binary file is also written here
+void
+init_output_buffers (void)
+{
+  if (output_binary && !binary_buffer)
+  {
+    binary_buffer = allocate_grid_array (sizeof (*binary_buffer));
+    write_binary_header ();
+  }
+
+  if (writer.async && !writer.running && (output_text || output_binary))
+    start_writer ();
+}
+
+// Write to the grid output file. This should only need to be called and not
+// looped over and called for each cell
+void
+write_grid (void)
+{
+  size_t nz = (size_t) geo.nz_cells;
+  Snapshot *snap, current;
+
+  if (!writer.async)
+  {
+    current.icycle = geo.icycle;
+    current.tot_tau = geo.tot_tau;
+    current.grid = grid;
+    write_snapshot (&current);
+    return;
+  }
+
+  /*
+   * Wait for a free snapshot if the writer thread has fallen behind. The
+   * snapshot after the queued snapshots can be filled without holding the lock
+   * as the writer thread will not touch it until it has been queued
+   */
+
+  pthread_mutex_lock (&writer.lock);
+  if (writer.n_queued == writer.n_buffers)
+    writer.n_waits++;
+  while (writer.n_queued == writer.n_buffers)
+    pthread_cond_wait (&writer.freed, &writer.lock);
+  snap = &writer.buffers[(writer.head + writer.n_queued) % writer.n_buffers];
+  pthread_mutex_unlock (&writer.lock);
+
+  snap->icycle = geo.icycle;
+  snap->tot_tau = geo.tot_tau;
+  memcpy (snap->grid.n, grid.n, nz * sizeof (*grid.n));
+  memcpy (snap->grid.z, grid.z, nz * sizeof (*grid.z));
+  memcpy (snap->grid.rho, grid.rho, nz * sizeof (*grid.rho));
+  memcpy (snap->grid.kappa, grid.kappa, nz * sizeof (*grid.kappa));
+  memcpy (snap->grid.cell_tau, grid.cell_tau, nz * sizeof (*grid.cell_tau));
+  memcpy (snap->grid.tau_depth, grid.tau_depth, nz * sizeof (*grid.tau_depth));
+  memcpy (snap->grid.T, grid.T, nz * sizeof (*grid.T));
+
+  pthread_mutex_lock (&writer.lock);
+  writer.n_queued++;
+  pthread_cond_signal (&writer.queued);
+  pthread_mutex_unlock (&writer.lock);
+}
+
+// Check if the grid should be written for the current cycle. final should be
+// TRUE for the last cycle of the Eddington iterations and converged TRUE if
+// the grid has converged
+int
+snapshot_due (int final, int converged)
+{
+  if (!output_text && !output_binary)
+    return FALSE;
+
+  switch (snapshot_mode)
+  {
+    case SNAPSHOT_CONVERGED:
+      return final && converged;
+    case SNAPSHOT_INITIAL_FINAL:
+      return geo.icycle == 0 || final;
+    default:
+      return geo.icycle % output_every == 0 || final;
+  }
+}
+
+// Write the summary line for the current cycle, if the summary file is enabled
+void
+write_summary (double c_fraction)
+{
+  if (!summaryfile)
+    return;
+
+  fprintf (summaryfile, "%i %e %e %f\n", geo.icycle, geo.tot_tau, geo.T_eff, c_fraction);
 }
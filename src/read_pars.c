@@ -11,6 +11,13 @@
  *
  * @details
  *
+ * The parameter file is read once, when it is opened, into a hash table of
+ * the parameter names and their values. The parameters are then looked up in
+ * the table rather than by reading the file again. If a parameter is defined
+ * more than once, the last definition is used, as before. Any parameters which
+ * were never looked up are reported when the parameter file is closed, as
+ * these are usually typos.
+ *
  * ************************************************************************** */
 
 #include <stdio.h>
@@ -19,9 +26,158 @@
 
 #include "snake.h"
 
-FILE *PAR_FILE_PTR;
+/*
+ * A parameter from the parameter file and the hash table of the parameters,
+ * which uses open addressing with linear probing. The capacity of the table
+ * is always a power of 2 and the table is kept at most half full. An empty
+ * slot has a line_num of 0 and a parameter which was not read from the file,
+ * i.e. one set by set_parameter, has a line_num of -1
+ */
+
+typedef struct Parameter
+{
+  char name[LINE_LEN];
+  char value[LINE_LEN];
+  int line_num;
+  int used;
+} Parameter;
+
+typedef struct ParameterTable
+{
+  int n_pars;
+  int capacity;
+  Parameter *pars;
+} ParameterTable;
+
+ParameterTable par_table;
 char par_file[LINE_LEN];
 
+#define PAR_TABLE_INIT_CAPACITY 64
+
+// The FNV-1a hash of a parameter name
+unsigned long
+hash_par_name (const char *par_name)
+{
+  unsigned long hash = 2166136261UL;
+
+  while (*par_name)
+  {
+    hash ^= (unsigned char) *par_name++;
+    hash = (hash * 16777619UL) & 0xffffffffUL;
+  }
+
+  return hash;
+}
+
+// Find the slot in the table for a parameter name: either the slot which
+// contains the parameter, or the empty slot where it should be inserted
+Parameter *
+find_par_slot (const ParameterTable *table, const char *par_name)
+{
+  unsigned long mask = (unsigned long) table->capacity - 1;
+  unsigned long slot = hash_par_name (par_name) & mask;
+
+  while (table->pars[slot].line_num && strcmp (table->pars[slot].name, par_name))
+    slot = (slot + 1) & mask;
+
+  return &table->pars[slot];
+}
+
+// Allocate an empty parameter table
+void
+allocate_par_table (ParameterTable *table, int capacity)
+{
+  table->n_pars = 0;
+  table->capacity = capacity;
+  if (!(table->pars = calloc ((size_t) capacity, sizeof (*table->pars))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for parameter table\n");
+}
+
+// Double the capacity of the parameter table and rehash the parameters
+void
+grow_par_table (ParameterTable *table)
+{
+  int i;
+  ParameterTable old = *table;
+
+  allocate_par_table (table, 2 * old.capacity);
+  for (i = 0; i < old.capacity; i++)
+  {
+    if (!old.pars[i].line_num)
+      continue;
+    *find_par_slot (table, old.pars[i].name) = old.pars[i];
+    table->n_pars++;
+  }
+
+  free (old.pars);
+}
+
+// Add a parameter to the table. If the parameter is already in the table,
+// the new value replaces the old value
+void
+insert_par (ParameterTable *table, char *par_name, char *par_value, int line_num)
+{
+  Parameter *par;
+
+  if (2 * (table->n_pars + 1) > table->capacity)
+    grow_par_table (table);
+
+  par = find_par_slot (table, par_name);
+  if (par->line_num)
+  {
+    Log (" - Parameter %s on line %i is also defined on line %i, using the value on line %i\n", par_name,
+         par->line_num, line_num, line_num);
+  }
+  else
+  {
+    strcpy (par->name, par_name);
+    table->n_pars++;
+  }
+
+  strcpy (par->value, par_value);
+  par->line_num = line_num;
+}
+
+// Set the value of a parameter, replacing the value from the parameter file.
+// This is used by the batch runner for parameter sweeps
+void
+set_parameter (char *par_name, char *par_value)
+{
+  Parameter *par;
+
+  if (2 * (par_table.n_pars + 1) > par_table.capacity)
+    grow_par_table (&par_table);
+
+  par = find_par_slot (&par_table, par_name);
+  if (!par->line_num)
+  {
+    strcpy (par->name, par_name);
+    par->line_num = -1;
+    par_table.n_pars++;
+  }
+
+  strcpy (par->value, par_value);
+  Log (" - Parameter %s set to %s\n", par_name, par_value);
+}
+
+// Look up a parameter in the table. Returns NULL if the parameter is not in
+// the parameter file
+Parameter *
+find_par (char *par_name)
+{
+  Parameter *par;
+
+  if (!par_table.pars)
+    return NULL;
+
+  par = find_par_slot (&par_table, par_name);
+  if (!par->line_num)
+    return NULL;
+  par->used = TRUE;
+
+  return par;
+}
+
 // Prompt the user to input the path to a parameter file
 void
 find_par_file (char *file_path)
@@ -34,22 +190,78 @@ find_par_file (char *file_path)
     Exit (NO_INPUT, "Nothing entered for parameter file file path\n");
 }
 
-// Open up the parameter file
+// Open up the parameter file and read the parameters into the parameter table
 void
 init_parameter_file (char *file_path)
 {
+  int line_num = 0;
+  FILE *par_file_ptr;
+  char line[LINE_LEN], ini_par_name[LINE_LEN], par_sep[LINE_LEN], par_value[LINE_LEN];
+
   strcpy (par_file, file_path);
-  if (!(PAR_FILE_PTR = fopen (file_path, "r")))
+  if (!(par_file_ptr = fopen (file_path, "r")))
     Exit (FILE_OPEN_ERR, "Could not find parameter file %s\n", file_path);
+
+  allocate_par_table (&par_table, PAR_TABLE_INIT_CAPACITY);
+
+  while (fgets (line, LINE_LEN, par_file_ptr) != NULL)
+  {
+    line_num++;
+    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
+      continue;
+    if (sscanf (line, "%s %s %s", ini_par_name, par_sep, par_value) != 3)
+      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in parameter file\n",
+            line_num);
+    insert_par (&par_table, ini_par_name, par_value, line_num);
+  }
+
+  if (fclose (par_file_ptr))
+    Exit (FILE_CLOSE_ERR, "Couldn't close parameter file %s\n", file_path);
   Log (" - Loaded parameter file %s\n\n", file_path);
 }
 
-// Close the parameter file
+// Free the parameter table without reporting the unused parameters
+void
+free_parameter_table (void)
+{
+  free (par_table.pars);
+  par_table.pars = NULL;
+  par_table.n_pars = par_table.capacity = 0;
+}
+
+// Compare two parameters by the line they were defined on, for qsort
+int
+par_line_compare (const void *a, const void *b)
+{
+  return ((const Parameter *) a)->line_num - ((const Parameter *) b)->line_num;
+}
+
+// Report any parameters which were not used and free the parameter table
 void
 close_parameter_file (void)
 {
-  if (fclose (PAR_FILE_PTR))
-    Exit (FILE_CLOSE_ERR, "Couldn't close parameter file %s\n", par_file);
+  int i, n_unused = 0;
+
+  /*
+   * The table is not needed any more, so the unused parameters are moved to the
+   * front of it and sorted so they are reported in the order of the file
+   */
+
+  for (i = 0; i < par_table.capacity; i++)
+    if (par_table.pars[i].line_num && !par_table.pars[i].used)
+      par_table.pars[n_unused++] = par_table.pars[i];
+  qsort (par_table.pars, (size_t) n_unused, sizeof (*par_table.pars), par_line_compare);
+
+  for (i = 0; i < n_unused; i++)
+  {
+    if (par_table.pars[i].line_num < 0)
+      Log (" - Parameter %s set by the batch manifest was not used\n", par_table.pars[i].name);
+    else
+      Log (" - Parameter %s on line %i of %s was not used\n", par_table.pars[i].name, par_table.pars[i].line_num,
+           par_file);
+  }
+
+  free_parameter_table ();
   Log_verbose (" - Closed %s successfully\n", par_file);
 }
 
@@ -57,28 +269,11 @@ close_parameter_file (void)
 void
 get_double (char *par_name, double *value)
 {
-  int line_num = 0;
-  int found_par = FALSE;
-  char line[LINE_LEN], ini_par_name[LINE_LEN], par_sep[LINE_LEN], par_value[LINE_LEN];
+  Parameter *par;
 
-  rewind (PAR_FILE_PTR);
-  
-  while (fgets (line, LINE_LEN, PAR_FILE_PTR) != NULL)
-  {
-    line_num++;
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
-    if (sscanf (line, "%s %s %s", ini_par_name, par_sep, par_value) != 3)
-      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in parameter file\n",
-            line_num);
-    if (strcmp (par_name, ini_par_name) == 0)
-    {
-      *value = atof (par_value);
-      found_par = TRUE;
-    }
-  }
-  
-  if (!found_par)
+  if ((par = find_par (par_name)))
+    *value = atof (par->value);
+  else
     input_double (par_name, value);
 }
 
@@ -86,28 +281,11 @@ get_double (char *par_name, double *value)
 void
 get_int (char *par_name, int *value)
 {
-  int line_num = 0;
-  int found_par = FALSE;
-  char line[LINE_LEN], ini_par_name[LINE_LEN], par_sep[LINE_LEN], par_value[LINE_LEN];
+  Parameter *par;
 
-  rewind (PAR_FILE_PTR);
-  
-  while (fgets (line, LINE_LEN, PAR_FILE_PTR) != NULL)
-  {
-    line_num++;
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
-    if (sscanf (line, "%s %s %s", ini_par_name, par_sep, par_value) != 3)
-      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in parameter file\n",
-            line_num);
-    if (strcmp (par_name, ini_par_name) == 0)
-    {
-      *value = atoi (par_value);
-      found_par = TRUE;
-    }
-  }
-  
-  if (!found_par)
+  if ((par = find_par (par_name)))
+    *value = atoi (par->value);
+  else
     input_int (par_name, value);
 }
 
@@ -115,51 +293,42 @@ get_int (char *par_name, int *value)
 void
 get_string  (char *par_name, char *value)
 {
-  int line_num = 0;
-  int found_par = FALSE;
-  char line[LINE_LEN], ini_par_name[LINE_LEN], par_sep[LINE_LEN], par_value[LINE_LEN];
+  Parameter *par;
 
-  rewind (PAR_FILE_PTR);
-  
-  while (fgets (line, LINE_LEN, PAR_FILE_PTR) != NULL)
-  {
-    line_num++;
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
-    if (sscanf (line, "%s %s %s", ini_par_name, par_sep, par_value) != 3)
-      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in parameter file\n",
-            line_num);
-    if (strcmp (par_name, ini_par_name) == 0)
-    {
-      strcpy (value, par_value);
-      found_par = TRUE;
-    }
-  }
-  
-  if (!found_par)
+  if ((par = find_par (par_name)))
+    strcpy (value, par->value);
+  else
     input_string (par_name, value);
 }
 
+// Get an optional double from file
+void
+get_optional_double (char *par_name, double *value)
+{
+  Parameter *par;
+
+  if ((par = find_par (par_name)))
+    *value = atof (par->value);
+}
+
 // Get an optional integer from file
 void
 get_optional_int (char *par_name, int *value)
 {
-  int line_num = 0;
-  char line[LINE_LEN], ini_par_name[LINE_LEN], par_sep[LINE_LEN], par_value[LINE_LEN];
+  Parameter *par;
 
-  rewind (PAR_FILE_PTR);
+  if ((par = find_par (par_name)))
+    *value = atoi (par->value);
+}
 
-  while (fgets (line, LINE_LEN, PAR_FILE_PTR) != NULL)
-  {
-    line_num++;
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
-    if (sscanf (line, "%s %s %s", ini_par_name, par_sep, par_value) != 3)
-      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in parameter file\n",
-            line_num);
-    if (strcmp (par_name, ini_par_name) == 0)
-      *value = atoi (par_value);
-  }
+// Get an optional string from file
+void
+get_optional_string (char *par_name, char *value)
+{
+  Parameter *par;
+
+  if ((par = find_par (par_name)))
+    strcpy (value, par->value);
 }
 
 // Prompt the user to input a double
@@ -204,26 +373,11 @@ input_string (char *par_name, char *value)
   strcpy (value, input_value);
 }
 
-// Check if a parameter exists in the parameter file
+// Check if a parameter exists in the parameter file. Returns TRUE if it does
 int check_for_parameter (char *par_name)
 {
-  int line_num = 0;
-  char line[LINE_LEN], ini_par_name[LINE_LEN], par_sep[LINE_LEN],
-    par_value[LINE_LEN];
-
-  rewind (PAR_FILE_PTR);
-
-  while (fgets (line, LINE_LEN, PAR_FILE_PTR) != NULL)
-  {
-    line_num++;
-    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-      continue;
-    if (sscanf (line, "%s %s %s", ini_par_name, par_sep, par_value) != 3)
-      Exit (PAR_FILE_SYNTAX_ERR, "Syntax error on line %i in parameter file\n",
-            line_num);
-    if (strcmp (par_name, ini_par_name) == 0)
-      return (int) strlen (par_name);
-  }
+  if (find_par (par_name))
+    return TRUE;
 
-  return FAILURE;
+  return FALSE;
 }
@@ -0,0 +1,55 @@
+/* ***************************************************************************
+ *
+ * @file simulation.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Contains the function to run a single simulation.
+ *
+ * @details
+ *
+ * This is kept separate from main so that the batch runner and the benchmarks
+ * can run simulations without the main function of Snake.
+ *
+ * ************************************************************************** */
+
+#include <time.h>
+
+#include "snake.h"
+
+// Run a single simulation using the parameters in par_file_path. If par_name
+// is not NULL, the value of the parameter par_name is replaced by par_value
+void
+run_simulation (char *par_file_path, char *par_name, char *par_value)
+{
+  struct timespec start_time;
+  int verbosity = FALSE;
+
+  start_time = get_time ();
+
+  init_parameter_file (par_file_path);
+  if (par_name)
+    set_parameter (par_name, par_value);
+
+  get_optional_int ("verbosity", &verbosity);
+  VERBOSITY = verbosity;
+  if ((VERBOSITY != FALSE) && (VERBOSITY != TRUE))
+    Exit (UNKNOWN_PARAMETER, "Invalid value for verbosity: verbosity should be 0 or 1\n");
+  init_profiler ();
+
+  Log (" - Beginning initialisation routines\n");
+  init_snake ();
+  init_outfile ();
+  init_geo ();
+  Log (" - End of initialisation routines\n");
+
+  eddington_iterations ();
+
+  Log ("\n--------------------------------------------------------------\n\n");
+  print_duration (start_time, " Simulation completed in");
+  Log ("\n--------------------------------------------------------------\n\n");
+
+  clean_up ();
+}
@@ -19,6 +19,7 @@
 #define FAILURE 1
 #define LINE_LEN 128
 #define MAX_ITER 500
+#define CONVERGENCE_EPS 0.025
 
 /*
  * Global variables
@@ -27,6 +28,13 @@
 int INIT_LOGFILE;
 int VERBOSITY;
 
+/*
+ * A prefix added to the name of every file written, so that the runs of a
+ * batch do not overwrite each other's output. This is empty for a single run
+ */
+
+char OUTPUT_PREFIX[LINE_LEN];
+
 /*
  * The available grid types -- note that this code will exploit symmetry
  */
@@ -56,6 +64,24 @@ enum ERRORS
   NEGATIVE_OPACITY
 };
 
+/*
+ * The phases of a simulation which are timed by the profiler
+ */
+
+enum PROFILE_PHASES
+{
+  PHASE_TABLE_LOAD,
+  PHASE_GRID_INIT,
+  PHASE_OPACITY,
+  PHASE_TAU,
+  PHASE_TEMPERATURE,
+  PHASE_COLUMN_DENSITY,
+  PHASE_CONVERGENCE,
+  PHASE_ACCELERATION,
+  PHASE_OUTPUT,
+  N_PROFILE_PHASES
+};
+
 /*
  * The structure to hold various settings and modes
  */
@@ -63,7 +89,10 @@ enum ERRORS
 typedef struct Modes
 {
   int opal;
+  int opal_slice;
   int low_temp;
+  int newton;
+  int fused;
 } Modes;
 
 Modes modes;
@@ -80,6 +109,7 @@ typedef struct Geometry
   int icycle;
   int nz_cells;
   double tot_tau;
+  double T_eff;
   double T_init;
   double T_disk;
   double irho;
@@ -91,21 +121,45 @@ typedef struct Geometry
 Geometry geo;
 
 /*
- * The structure for each cell on the 1D grid
+ * The 1D grid, stored as a structure of arrays so each phase of the algorithm
+ * only streams the quantities it needs. Each array has one element per cell
+ * and is aligned to GRID_ALIGN bytes, i.e. the temperature of cell i is
+ * grid.T[i]. dlnk_dlnT is the derivative of the opacity dln(kappa)/dln(T) at
+ * constant density, which is used by the Newton solver. T_kappa and rho_kappa
+ * are the temperature and density the opacity of the cell was last found at
  */
 
+#define GRID_ALIGN 64
+
 typedef struct Grid
 {
-  int n;
-  double z;
-  double T;
-  double T_old;
-  double kappa;
-  double rho;
-  double cell_tau;
-  double tau_depth;
+  int *n;
+  double *z;
+  double *T;
+  double *T_old;
+  double *kappa;
+  double *rho;
+  double *cell_tau;
+  double *tau_depth;
+  double *dlnk_dlnT;
+  double *T_kappa;
+  double *rho_kappa;
 } Grid;
 
-Grid *grid;
+Grid grid;
+
+/*
+ * In a DEBUG build, the heap allocations made by Snake are counted, so the
+ * Eddington iterations can check that no memory is allocated in the loop.
+ * Allocations made inside the C library, e.g. by fopen, are not counted
+ */
+
+#ifdef DEBUG
+  #include <stdlib.h>
+  #define malloc(size) debug_malloc (size)
+  #define calloc(n, size) debug_calloc (n, size)
+  #define realloc(ptr, size) debug_realloc (ptr, size)
+  #define posix_memalign(ptr, alignment, size) debug_posix_memalign (ptr, alignment, size)
+#endif
 
 #include "snake_functions.h"
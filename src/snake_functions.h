@@ -13,53 +13,108 @@
  *
  * ************************************************************************** */
 
+#include <stddef.h>
+
+// A
+void accelerate_temperatures (void);
+void *allocate_grid_array (size_t element_size);
+// B
+int build_opal_cache (void);
 // C
 int check_for_parameter (char *par_name);
 void clean_up (void);
-void clean_up_gsl (void);
+void clean_up_acceleration (void);
+void clean_up_solver (void);
+void clean_up_tau_summation (void);
+void clean_up_interp_2d (void);
 void clean_up_opac_tables (void);
+void clean_up_opacity_cache (void);
+void clean_up_opal_tables (void);
+void clean_up_opal_slice (void);
+void close_logfile (void);
 void close_outfile (void);
 void close_parameter_file (void);
+long count_heap_allocations (void);
+double convergence_fraction (int n_converged);
 // D
+void *debug_calloc (size_t n, size_t size);
+void *debug_malloc (size_t size);
+int debug_posix_memalign (void **ptr, size_t alignment, size_t size);
+void *debug_realloc (void *ptr, size_t size);
 void density_from_file (char *filepath);
 // E
 void eddington_iterations (void);
 void Exit (int error_code, char *fmt, ...);
 // F
+int find_opacities (int n, const double *T, const double *rho, double *kappa);
 void find_par_file (char *file_path);
 void find_vertical_tau (void);
 int float_compare (double a, double b);
+double fused_iteration (void);
+void free_1d_grid (void);
+void free_parameter_table (void);
 // G
 void get_double (char *par_name, double *value);
 void get_int (char *par_name, int *value);
+void get_optional_double (char *par_name, double *value);
 void get_optional_int (char *par_name, int *value);
+void get_optional_string (char *par_name, char *value);
 void get_string (char *par_name, char *value);
 struct timespec get_time (void);
 // I
-int i2d (int row, int col);
+void init_acceleration (void);
 void init_snake (void);
+void init_solver (void);
+void init_tau_summation (void);
 void init_geo (void);
 void init_grid (void);
+void init_iteration_kernel (void);
+void init_opacity_cache (void);
 void init_opacity_table (void);
+void init_opal_tables (void);
+void init_opal_slice (void);
 void init_outfile (void);
+void init_output_buffers (void);
 void init_parameter_file (char *par_filepath);
+void init_profiler (void);
 void input_double (char *par_name, double *value);
 void input_int (char *par_name, int *value);
 void input_string (char *par_name, char *value);
+// N
+void newton_update_temperatures (void);
 // O
 void opac_2d (double logT, double logR, double *logRMO);
+int opac_2d_batch (int n, const double *T, const double *rho, double *kappa);
+void opac_2d_deriv (double logT, double logR, double *logRMO, double *dlogk_dlogT, double *dlogk_dlogR);
+int opal_slice_lookup (double logT, double logR, double *logRMO, double *dlogk_dlogT, double *dlogk_dlogR);
 // L
+void load_opacity_table (char *table_name);
 void Log (char *fmt, ...);
 void Log_error (char *fmt, ...);
 void Log_verbose (char *fmt, ...);
 // P
+void prefixed_name (char *name, char *base_name);
 void print_duration (struct timespec start_time, char *message);
 void print_time_date (void);
+void profile_start (int phase);
+void profile_stop (int phase);
 // R
 double report_convergence (void);
+int run_batch (char *manifest_path, int n_workers);
+void run_simulation (char *par_file_path, char *par_name, char *par_value);
 // S
+void set_parameter (char *par_name, char *par_value);
+int snapshot_due (int final, int converged);
 void standard_density_profile (void);
+// T
+double time_difference (struct timespec start_time, struct timespec end_time);
 // U
 void update_cell_opacities (void);
+void update_cell_opacities_opal (int first, int n, const int *cells);
+int update_cell_opacities_range (int lo, int hi);
+void update_cell_opacity_derivatives (void);
 // W
+void write_binary_header (void);
 void write_grid (void);
+void write_profile (void);
+void write_summary (double c_fraction);
@@ -10,12 +10,57 @@
  *
  * @details
  *
+ * The durations printed to the log are wall-clock times, as the CPU time of
+ * the process is the sum over all of the threads.
+ *
+ * Each phase of a simulation, i.e. loading the opacity table or updating the
+ * cell opacities, is timed by calling profile_start and profile_stop around
+ * it. Both the wall-clock time and the CPU time of the process are recorded
+ * for each phase in each cycle, where cycle 0 is the initialisation of the
+ * simulation. With the fused iteration kernel, the optical depths and column
+ * densities are counted as part of the opacity phase and the convergence as
+ * part of the temperature phase. When the parameter profile is 1, a summary is
+ * written to snake_profile.json at the end of the simulation.
+ *
  * ************************************************************************** */
 
+#include <stdio.h>
 #include <time.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "snake.h"
 
+/*
+ * The names of each phase, as used in the profile summary
+ */
+
+char *phase_names[N_PROFILE_PHASES] = {
+  "table_load", "grid_init", "opacity", "tau", "temperature", "column_density", "convergence",
+  "acceleration", "output"
+};
+
+/*
+ * The wall-clock and CPU time, in seconds, spent in each phase of each cycle.
+ * n_cycles is one more than the last cycle where a phase was timed
+ */
+
+typedef struct Profiler
+{
+  int enabled;
+  int n_cycles;
+  struct timespec run_wall_start;
+  struct timespec run_cpu_start;
+  struct timespec wall_start[N_PROFILE_PHASES];
+  struct timespec cpu_start[N_PROFILE_PHASES];
+  double wall[MAX_ITER + 1][N_PROFILE_PHASES];
+  double cpu[MAX_ITER + 1][N_PROFILE_PHASES];
+} Profiler;
+
+Profiler profiler;
+
 // Print the current time and date to screen
 void
 print_time_date (void)
@@ -29,26 +74,130 @@ print_time_date (void)
   Log (" Current time: %s", c_time_string);
 }
 
-// Create a timespec structure for the current time
+// Create a timespec structure for the current wall-clock time
 struct timespec
 get_time (void)
 {
   struct timespec time;
 
-  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &time);
+  clock_gettime (CLOCK_MONOTONIC, &time);
 
   return time;
 }
 
-// Print the time difference between two timespec structs
+// Return the time in seconds between two timespec structs
+double
+time_difference (struct timespec start_time, struct timespec end_time)
+{
+  return (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
+}
+
+// Print the wall-clock time since start_time
 void
 print_duration (struct timespec start_time, char *message)
 {
-  double td;
-  struct timespec end_time;
+  Log ("%s %f seconds\n", message, time_difference (start_time, get_time ()));
+}
+
+// Initialise the profiler at the start of a simulation
+void
+init_profiler (void)
+{
+  int profile = FALSE;
+
+  get_optional_int ("profile", &profile);
+  if ((profile != FALSE) && (profile != TRUE))
+    Exit (UNKNOWN_PARAMETER, "Invalid value for profile: profile should be 0 or 1\n");
+
+  profiler.enabled = profile;
+  profiler.n_cycles = 0;
+  clock_gettime (CLOCK_MONOTONIC, &profiler.run_wall_start);
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &profiler.run_cpu_start);
+}
+
+// Start timing a phase of the simulation
+void
+profile_start (int phase)
+{
+  clock_gettime (CLOCK_MONOTONIC, &profiler.wall_start[phase]);
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &profiler.cpu_start[phase]);
+}
+
+// Stop timing a phase of the simulation, adding the time since profile_start
+// was called to the time for the phase in the current cycle
+void
+profile_stop (int phase)
+{
+  int cycle = geo.icycle < MAX_ITER ? geo.icycle : MAX_ITER;
+  struct timespec wall_end, cpu_end;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  clock_gettime (CLOCK_MONOTONIC, &wall_end);
+
+  profiler.wall[cycle][phase] += time_difference (profiler.wall_start[phase], wall_end);
+  profiler.cpu[cycle][phase] += time_difference (profiler.cpu_start[phase], cpu_end);
+  if (cycle >= profiler.n_cycles)
+    profiler.n_cycles = cycle + 1;
+}
+
+// Write the time spent in each phase, in total and for each cycle, to the
+// profile summary file and the log
+void
+write_profile (void)
+{
+  int i, phase, n_threads = 1;
+  double wall, cpu;
+  char profile_name[LINE_LEN];
+  struct timespec cpu_end;
+  FILE *profile_file;
+
+  if (!profiler.enabled)
+    return;
+
+  #ifdef _OPENMP
+    n_threads = omp_get_max_threads ();
+  #endif
+
+  prefixed_name (profile_name, "snake_profile.json");
+  if (!(profile_file = fopen (profile_name, "w")))
+    Exit (FILE_OPEN_ERR, "Can't open file %s to write\n", profile_name);
+
+  fprintf (profile_file, "{\n  \"n_cells\": %i,\n  \"n_threads\": %i,\n  \"n_cycles\": %i,\n", geo.nz_cells,
+           n_threads, profiler.n_cycles);
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  fprintf (profile_file, "  \"total\": {\"wall\": %.9e, \"cpu\": %.9e},\n",
+           time_difference (profiler.run_wall_start, get_time ()), time_difference (profiler.run_cpu_start, cpu_end));
+
+  Log ("\n - Time spent in each phase:\n");
+  Log ("\t%-16s %12s %12s\n", "phase", "wall (s)", "cpu (s)");
+
+  fprintf (profile_file, "  \"phases\": {\n");
+  for (phase = 0; phase < N_PROFILE_PHASES; phase++)
+  {
+    wall = cpu = 0.0;
+    for (i = 0; i < profiler.n_cycles; i++)
+    {
+      wall += profiler.wall[i][phase];
+      cpu += profiler.cpu[i][phase];
+    }
+    fprintf (profile_file, "    \"%s\": {\"wall\": %.9e, \"cpu\": %.9e}%s\n", phase_names[phase], wall, cpu,
+             phase < N_PROFILE_PHASES - 1 ? "," : "");
+    Log ("\t%-16s %12.6f %12.6f\n", phase_names[phase], wall, cpu);
+  }
+  fprintf (profile_file, "  },\n");
+
+  fprintf (profile_file, "  \"cycles\": [\n");
+  for (i = 0; i < profiler.n_cycles; i++)
+  {
+    fprintf (profile_file, "    {\"cycle\": %i", i);
+    for (phase = 0; phase < N_PROFILE_PHASES; phase++)
+      fprintf (profile_file, ", \"%s\": {\"wall\": %.9e, \"cpu\": %.9e}", phase_names[phase],
+               profiler.wall[i][phase], profiler.cpu[i][phase]);
+    fprintf (profile_file, "}%s\n", i < profiler.n_cycles - 1 ? "," : "");
+  }
+  fprintf (profile_file, "  ]\n}\n");
 
-  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &end_time);
-  td = (end_time.tv_sec - start_time.tv_sec) +
-                                (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
-  Log ("%s %f seconds\n", message, td);
+  if (fclose (profile_file))
+    Exit (FILE_CLOSE_ERR, "Can't close the profile file %s\n", profile_name);
+  Log_verbose (" - Wrote profile summary to %s\n", profile_name);
 }
@@ -10,122 +10,445 @@
  *
  * @details
  *
+ * With a 2D table, the opacity of every cell which needs updating is found in
+ * a single call to opac_2d_batch, using the kernel chosen in gsl_interp.c. With
+ * the Opal tables, each cell is updated using the reentrant port in opal.c,
+ * where each thread has its own OpalState. A cache of the temperature and
+ * density each cell's opacity was last found at is kept, so that cells which
+ * have not changed by more than opacity_tolerance are not looked up again.
+ *
  * ************************************************************************** */
 
 #include <math.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "snake.h"
-#include "flib/flib.h"
 #include "gsl_interp.h"
+#include "opal.h"
 
-// Update the opacity in each grid cell using the Rosseland Mean Opacity
+/*
+ * The opacity of a cell is only found again when its temperature or density
+ * has changed by more than a fraction tolerance since its opacity was last
+ * found. dirty_cells is the list of cells which need a new opacity, in
+ * ascending order, and T, rho and kappa are packed copies of those cells for
+ * the batched 2D lookup. A tolerance of 0 means every cell is updated
+ */
+
+typedef struct OpacityCache
+{
+  double tolerance;
+  int n_dirty;
+  int *dirty_cells;
+  double *T, *rho, *kappa;
+  long n_lookups;
+  long n_skipped;
+} OpacityCache;
+
+OpacityCache opac_cache;
+
+// Initialise the cache of cell opacities
 void
-update_cell_opacities (void)
+init_opacity_cache (void)
 {
-  int i;
-  double logT, logR, logRMO;
+  opac_cache.tolerance = 0.0;
+  opac_cache.n_lookups = opac_cache.n_skipped = 0;
+  get_optional_double ("opacity_tolerance", &opac_cache.tolerance);
+  if (opac_cache.tolerance < 0)
+    Exit (INVALID_VALUE, "Invalid value for opacity_tolerance: opacity_tolerance >= 0\n");
+  if (opac_cache.tolerance == 0)
+    return;
 
-  Log_verbose ("\t\t- Updating cell opacities\n");
+  Log ("\t- Only updating opacities when T or rho change by more than %e\n", opac_cache.tolerance);
+
+  opac_cache.dirty_cells = allocate_grid_array (sizeof (*opac_cache.dirty_cells));
+  opac_cache.T = allocate_grid_array (sizeof (*opac_cache.T));
+  opac_cache.rho = allocate_grid_array (sizeof (*opac_cache.rho));
+  opac_cache.kappa = allocate_grid_array (sizeof (*opac_cache.kappa));
+}
+
+// Find the cells lo <= i < hi where the temperature or density has changed by
+// more than the tolerance since the opacity was last found. Returns the number
+// of cells which need a new opacity
+int
+find_dirty_cells (int lo, int hi)
+{
+  int i, n = 0;
+  double tol = opac_cache.tolerance;
+
+  for (i = lo; i < hi; i++)
+    if (grid.T_kappa[i] <= 0 || fabs (grid.T[i] - grid.T_kappa[i]) > tol * grid.T_kappa[i] ||
+        fabs (grid.rho[i] - grid.rho_kappa[i]) > tol * grid.rho_kappa[i])
+      opac_cache.dirty_cells[n++] = i;
+
+  return opac_cache.n_dirty = n;
+}
+
+// Report how many opacity lookups were skipped and free the cache
+void
+clean_up_opacity_cache (void)
+{
+  long n_total = opac_cache.n_lookups + opac_cache.n_skipped;
+
+  if (opac_cache.tolerance == 0)
+    return;
+
+  Log (" - %li of %li opacity lookups were skipped (%1.1f%%)\n", opac_cache.n_skipped, n_total,
+       n_total ? 100.0 * opac_cache.n_skipped / n_total : 0.0);
+
+  free (opac_cache.dirty_cells);
+  free (opac_cache.T);
+  free (opac_cache.rho);
+  free (opac_cache.kappa);
+  opac_cache.dirty_cells = NULL;
+  opac_cache.T = opac_cache.rho = opac_cache.kappa = NULL;
+  opac_cache.tolerance = 0;
+}
+
+// Update the opacity of n cells at once using the 2D opacity table. T, rho and
+// kappa are the temperatures, densities and opacities of the cells, where the
+// k-th element is for the cell cells[k], or for cell first + k if cells is
+// NULL. When built with OpenMP, each thread does the batched lookup for a
+// contiguous chunk of the cells
+void
+update_cell_opacities_2d (int first, int n, const double *T, const double *rho, double *kappa, const int *cells)
+{
+  int i, bad_cell;
+  double logT, logR;
 
-  for (i = 0; i < geo.nz_cells; i++)
+  /*
+   * Call the batched 2D interpolation function designed to work with the tables
+   * which are created by the included Python script create_opacity_table.py.
+   * If a cell is outside of the table, the index of the cell is returned. The
+   * first bad cell over all of the chunks is kept so the error is the same as
+   * a serial run
+   */
+
+  bad_cell = n;
+
+  #ifdef _OPENMP
+    #pragma omp parallel reduction(min:bad_cell)
+  #endif
   {
-    logRMO = -9.999;
-    logT = log10 (grid[i].T);
-    logR = log10 (grid[i].rho / pow (grid[i].T * 1e-6, 3.0));
+    int lo = 0, hi = n, bad;
+
+    #ifdef _OPENMP
+      int n_threads = omp_get_num_threads ();
+      int thread = omp_get_thread_num ();
+      lo = (int) ((long) n * thread / n_threads);
+      hi = (int) ((long) n * (thread + 1) / n_threads);
+    #endif
 
+    if (hi > lo && (bad = opac_2d_batch (hi - lo, &T[lo], &rho[lo], &kappa[lo])) >= 0)
+      bad_cell = lo + bad;
+  }
+
+  if (bad_cell < n)
+  {
+    i = cells ? cells[bad_cell] : first + bad_cell;
+    logT = log10 (grid.T[i]);
+    logR = log10 (grid.rho[i] / pow (grid.T[i] * 1e-6, 3.0));
+    if (!((logR >= min_log_R) && (logR <= max_log_R)))
+    {
+      Log_error ("Cell %i: logR out of bounds: %f\n", grid.n[i], logR);
+      Log_error ("\t%f < logR < %f\n", min_log_R, max_log_R);
+      Exit (TABLE_BOUNDS, "logR out of table range for cell %i\n", grid.n[i]);
+    }
+    Log_error ("Cell %i: logT out of bounds: %f\n", grid.n[i], logT);
+    Log_error ("\t%f < logT < %f\n", min_log_T, max_log_T);
+    Exit (TABLE_BOUNDS, "logT out of table range for cell %i\n", grid.n[i]);
+  }
+
+  #ifdef DEBUG
+    for (i = 0; i < n; i++)
+      Log ("Cell %i interpolated kappa = %e\n", cells ? cells[i] : first + i, kappa[i]);
+  #endif
+}
+
+// Update the opacity of cell i using the Opal tables. If report is FALSE, then
+// FAILURE is returned when there is a problem with the cell, otherwise the
+// problem is reported and the program exits. This is done so the cells can be
+// updated in parallel, with any problem reported afterwards
+int
+update_cell_opacity_opal (int i, OpalState *state, int report)
+{
+  int status;
+  float T6f, Rf;
+  double logT, logR, logRMO, dlogk_dlogT, dlogk_dlogR;
+  OpalOpacity opacity;
+
+  logRMO = -9.999;
+  logT = log10 (grid.T[i]);
+  logR = log10 (grid.rho[i] / pow (grid.T[i] * 1e-6, 3.0));
+
+  #ifdef DEBUG
+    Log ("logT = %f logR = %f\n", logT, logR);
+  #endif
+
+  /*
+   * Opal works in single precision, so R is calculated using T6 as a float
+   * to keep the same values as when the Fortran routines were used
+   */
+
+  T6f = (float) (grid.T[i] * 1e-6);
+  Rf = (float) (grid.rho[i] / pow (T6f, 3.0));
+
+  /*
+   * Ensure that T and R are in the table range
+   */
+
+  if ((logR < OP_MIN_LOG_R) || (logR > OP_MAX_LOG_R))
+  {
+    if (!report)
+      return FAILURE;
+    Log_error ("Cell %i: logR out of bounds: %f\n", grid.n[i], logR);
+    Log_error ("\t%f < logR < %f\n", OP_MIN_LOG_R, OP_MAX_LOG_R);
+    Exit (TABLE_BOUNDS, "logR out of Opal table range for cell %i\n", grid.n[i]);
+  }
+  if ((logT < OP_MIN_LOG_T) || (logT > OP_MAX_LOG_T))
+  {
+    if (!report)
+      return FAILURE;
+    Log_error ("Cell %i: logT out of bounds: %f\n", grid.n[i], logT);
+    Log_error ("\t%f < logT < %f\n", OP_MIN_LOG_T, OP_MAX_LOG_T);
+    Exit (TABLE_BOUNDS, "logT out of Opal table range for cell %i\n", grid.n[i]);
+  }
+
+  /*
+   * If the composition has been fixed, then first try to use the slice of
+   * the Opal tables for this composition. This fails when the cell is near
+   * the jagged edge of the tables, where the full routine is used instead
+   */
+
+  if (modes.opal_slice && opal_slice_lookup (logT, logR, &logRMO, &dlogk_dlogT, &dlogk_dlogR) == SUCCESS)
+  {
+    grid.dlnk_dlnT[i] = dlogk_dlogT - 3.0 * dlogk_dlogR;
     #ifdef DEBUG
-      Log ("logT = %f logR = %f\n", logT, logR);
+      Log ("opal slice interpolated logRMO = %f\n", logRMO);
     #endif
+  }
+  else
+  {
+    /*
+     * Call the reentrant port of the Opal Opacity interpolation function
+     * -- see opal.c and opal.h for a more detailed description of how this
+     * works. Where Opal would have stopped, a status is returned instead
+     */
 
-    if (modes.opal)
+    if ((status = opal_opacity (opal_tables, state, geo.Z, geo.X, T6f, Rf, &opacity)) != OPAL_OK)
     {
-      /*
-       * Due to how my lazy Fortran interoperability works, we have to first
-       * convert these variables to floats, otherwise we will segfault.
-       */
+      if (!report)
+        return FAILURE;
+      Exit (TABLE_BOUNDS, "%s for cell %i\n", opal_status_message (status), grid.n[i]);
+    }
+    if (opacity.opact > 9.0)
+      Log_error ("logK > 9.0, X = %f Z = %f T6 = %f R = %e\n", geo.X, geo.Z, T6f, Rf);
+    logRMO = opacity.opact;
+    grid.dlnk_dlnT[i] = opacity.dopactd;
 
-      float X = (float) geo.X;
-      float Z = (float) geo.Z;
-      float T6f = (float) (grid[i].T * 1e-6);
-      float Rf = (float) (grid[i].rho / pow (T6f, 3.0));
+    #ifdef DEBUG
+      Log ("opal interpolated logRMO = %f\n", logRMO);
+    #endif
+  }
 
-      /*
-       * Ensure that T and R are in the table range
-       */
+  /*
+   * Some basic error checking to check to see if logRMO was changed. The
+   * opacity table should not reach -9.999, so logRMO was initialised as this
+   * value and below it is checked to ensure that it is no longer -9.999
+   */
 
-      if ((logR < OP_MIN_LOG_R) || (logR > OP_MAX_LOG_R))
-      {
-        Log_error ("Cell %i: logR out of bounds: %f\n", grid[i].n, logR);
-        Log_error ("\t%f < logR < %f\n", OP_MIN_LOG_R, OP_MAX_LOG_R);
-        Exit (TABLE_BOUNDS, "logR out of Opal table range for cell %i\n", grid[i].n);
-      }
-      if ((logT < OP_MIN_LOG_T) || (logT > OP_MAX_LOG_T))
-      {
-        Log_error ("Cell %i: logT out of bounds: %f\n", grid[i].n, logT);
-        Log_error ("\t%f < logT < %f\n", OP_MIN_LOG_T, OP_MAX_LOG_T);
-        Exit (TABLE_BOUNDS, "logT out of Opal table range for cell %i\n", grid[i].n);
-      }
+  if (logRMO == -9.999)
+  {
+    if (!report)
+      return FAILURE;
+    Exit (NO_LOG_RMO_RETURNED, "logRMO for cell %i was not updated\n", i);
+  }
 
-      /*
-       * Call the Opal Opacity interpolation function -- see opal.f and flib.h
-       * for more detailed description of how this works. Note that in Opal,
-       * the opacities are returned via common block, hence logRMO is taken from
-       * the struct e_ as the returning common block in Opal is named e
-       */
+  /*
+   * Finally update the opacity of the grid cell
+   */
 
-      opacgn93_ (&Z, &X, &T6f, &Rf);
-      logRMO = e_.opact;
+  if ((grid.kappa[i] = pow (10.0, logRMO)) < 0)
+  {
+    if (!report)
+      return FAILURE;
+    Exit (NEGATIVE_OPACITY, "Negative opacity %f for cell %i\n", grid.kappa[i], i);
+  }
+
+  return SUCCESS;
+}
+
+// Update the derivative of the opacity dln(kappa)/dln(T) at constant density
+// for each cell. The Opal routines return the derivative along with the
+// opacity, but the batched 2D lookup does not, so the derivative is found
+// from the 2D interpolant. This must be called after update_cell_opacities,
+// so only the cells which had their opacity updated are updated here
+void
+update_cell_opacity_derivatives (void)
+{
+  int i, k, n;
+  double logT, logR, logRMO, dlogk_dlogT, dlogk_dlogR;
+
+  if (!modes.low_temp)
+    return;
+
+  n = opac_cache.tolerance > 0 ? opac_cache.n_dirty : geo.nz_cells;
 
-      #ifdef DEBUG
-        Log ("opal interpolated logRMO = %f\n", logRMO);
-      #endif
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i, logT, logR, logRMO, dlogk_dlogT, dlogk_dlogR) schedule(static)
+  #endif
+  for (k = 0; k < n; k++)
+  {
+    i = opac_cache.tolerance > 0 ? opac_cache.dirty_cells[k] : k;
+    logT = log10 (grid.T[i]);
+    logR = log10 (grid.rho[i] / pow (grid.T[i] * 1e-6, 3.0));
+    opac_2d_deriv (logT, logR, &logRMO, &dlogk_dlogT, &dlogk_dlogR);
+    grid.dlnk_dlnT[i] = dlogk_dlogT - 3.0 * dlogk_dlogR;
+  }
+}
+
+// Update the opacity of the cells lo <= i < hi. When the opacities are cached,
+// only the cells where T or rho have moved by more than the tolerance are
+// updated. Returns the number of cells which were updated
+int
+update_cell_opacities_range (int lo, int hi)
+{
+  int k, n = hi - lo;
+  int *cells = NULL;
+
+  if (opac_cache.tolerance > 0)
+  {
+    n = find_dirty_cells (lo, hi);
+    cells = opac_cache.dirty_cells;
+    opac_cache.n_skipped += hi - lo - n;
+  }
+  opac_cache.n_lookups += n;
+
+  if (modes.low_temp)
+  {
+    if (!cells)
+    {
+      update_cell_opacities_2d (lo, n, &grid.T[lo], &grid.rho[lo], &grid.kappa[lo], NULL);
+      return n;
     }
-    else if (modes.low_temp)
+
+    for (k = 0; k < n; k++)
     {
-      /*
-       * Ensure that T and R are in the table range
-       */
+      opac_cache.T[k] = grid.T[cells[k]];
+      opac_cache.rho[k] = grid.rho[cells[k]];
+    }
+    update_cell_opacities_2d (lo, n, opac_cache.T, opac_cache.rho, opac_cache.kappa, cells);
+    for (k = 0; k < n; k++)
+      grid.kappa[cells[k]] = opac_cache.kappa[k];
+  }
+  else
+  {
+    update_cell_opacities_opal (lo, n, cells);
+  }
 
-      if ((logR < MIN_LOG_R) || (logR > MAX_LOG_R))
-      {
-        Log_error ("Cell %i: logR out of bounds: %f\n", grid[i].n, logR);
-        Log_error ("\t%f < logR < %f\n", MIN_LOG_R, MAX_LOG_R);
-        Exit (TABLE_BOUNDS, "logR out of table range for cell %i\n", grid[i].n);
-      }
-      if ((logT < MIN_LOG_T) || (logT > MAX_LOG_T))
-      {
-        Log_error ("Cell %i: logT out of bounds: %f\n", grid[i].n, logT);
-        Log_error ("\t%f < logT < %f\n", MIN_LOG_T, MAX_LOG_T);
-        Exit (TABLE_BOUNDS, "logT out of table range for cell %i\n", grid[i].n);
-      }
+  for (k = 0; cells && k < n; k++)
+  {
+    grid.T_kappa[cells[k]] = grid.T[cells[k]];
+    grid.rho_kappa[cells[k]] = grid.rho[cells[k]];
+  }
+
+  return n;
+}
 
-      /*
-       * Call the 2D interpolation function designed to work with the tables which
-       * is created by the included Python script create_opacity_table.py.
-       */
+// Update the opacity in each grid cell using the Rosseland Mean Opacity
+void
+update_cell_opacities (void)
+{
+  int n;
 
-      opac_2d (logT, logR, &logRMO);
+  Log_verbose ("\t\t- Updating cell opacities\n");
 
-      #ifdef DEBUG
-        Log ("GSL interpolated logRMO = %f\n", logRMO);
-      #endif
-    }
+  n = update_cell_opacities_range (0, geo.nz_cells);
+  if (opac_cache.tolerance > 0)
+    Log_verbose ("\t\t- Updated the opacity of %i of %i cells\n", n, geo.nz_cells);
+}
 
-    /*
-     * Some basic error checking to check to see if logRMO was changed. The
-     * opacity table should not reach -9.999, so logRMO was initialised as this
-     * value and below it is checked to ensure that it is no longer -9.999
-     */
+// Update the opacity of n cells using the Opal tables. The k-th cell updated
+// is cells[k], or cell first + k if cells is NULL
+void
+update_cell_opacities_opal (int first, int n, const int *cells)
+{
+  int k, bad_cell;
+  OpalState report_state;
 
-    if (logRMO == -9.999)
-      Exit (NO_LOG_RMO_RETURNED, "logRMO for cell %i was not updated\n", i);
+  /*
+   * Each thread has its own working state for the Opal interpolation, as the
+   * tables are only read from. The first cell with a problem is found, and then
+   * updated again on its own so that the problem is reported as it would be
+   * in a serial run
+   */
 
-    /*
-     * Finally update the opacity of the grid cell
-     */
+  bad_cell = n;
 
-    if ((grid[i].kappa  = pow (10.0, logRMO)) < 0)
-      Exit (NEGATIVE_OPACITY, "Negative opacity %f for cell %i\n",
-            grid[i].kappa, i);
+  #ifdef _OPENMP
+    #pragma omp parallel reduction(min:bad_cell)
+  #endif
+  {
+    OpalState state;
+
+    #ifdef _OPENMP
+      #pragma omp for schedule(static)
+    #endif
+    for (k = 0; k < n; k++)
+      if (update_cell_opacity_opal (cells ? cells[k] : first + k, &state, FALSE) != SUCCESS && k < bad_cell)
+        bad_cell = k;
   }
+
+  if (bad_cell < n)
+    update_cell_opacity_opal (cells ? cells[bad_cell] : first + bad_cell, &report_state, TRUE);
+}
+
+// Find the opacity for n temperatures and densities which are not grid cells,
+// e.g. the points of a density profile before it is resampled onto the grid.
+// Returns the index of the first point outside of the opacity table, or -1 if
+// all of the points are within the table
+int
+find_opacities (int n, const double *T, const double *rho, double *kappa)
+{
+  int i, bad_point;
+
+  if (modes.low_temp)
+    return opac_2d_batch (n, T, rho, kappa);
+
+  bad_point = n;
+
+  #ifdef _OPENMP
+    #pragma omp parallel reduction(min:bad_point)
+  #endif
+  {
+    float T6f, Rf;
+    double logT, logR;
+    OpalState state;
+    OpalOpacity opacity;
+
+    #ifdef _OPENMP
+      #pragma omp for schedule(static)
+    #endif
+    for (i = 0; i < n; i++)
+    {
+      logT = log10 (T[i]);
+      logR = log10 (rho[i] / pow (T[i] * 1e-6, 3.0));
+      T6f = (float) (T[i] * 1e-6);
+      Rf = (float) (rho[i] / pow (T6f, 3.0));
+
+      if (logR < OP_MIN_LOG_R || logR > OP_MAX_LOG_R || logT < OP_MIN_LOG_T || logT > OP_MAX_LOG_T ||
+          opal_opacity (opal_tables, &state, geo.Z, geo.X, T6f, Rf, &opacity) != OPAL_OK)
+      {
+        if (i < bad_point)
+          bad_point = i;
+        continue;
+      }
+      kappa[i] = pow (10.0, opacity.opact);
+    }
+  }
+
+  return bad_point < n ? bad_point : -1;
 }
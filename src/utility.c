@@ -16,20 +16,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "snake.h"
-#include "gsl_interp.h"
 
 FILE *LOGFILE;
 double FLOAT_EPS = 1e-6;
 
-// Index an element for a 2D array which has been flattened into 1D
-int
-i2d (int row, int col)
-{
-  return row * N_COLS + col;
-}
-
 // Compare if two floats are similar values
 int
 float_compare (double a, double b)
@@ -40,11 +33,23 @@ float_compare (double a, double b)
     return FAILURE;
 }
 
+// Create the name of an output file by adding the output prefix to the base
+// name of the file
+void
+prefixed_name (char *name, char *base_name)
+{
+  if (strlen (OUTPUT_PREFIX) + strlen (base_name) >= LINE_LEN)
+    Exit (INVALID_VALUE, "Output prefix %s is too long\n", OUTPUT_PREFIX);
+  sprintf (name, "%s%s", OUTPUT_PREFIX, base_name);
+}
+
 // Initialise the log file
 void
 init_logfile (void)
 {
-  char *logname = "logfile";
+  char logname[LINE_LEN];
+
+  prefixed_name (logname, "logfile");
 
   if (!(LOGFILE = fopen (logname, "w")))
     Exit (FILE_IN_ERR, "Can't open file %s to write log\n", logname);
@@ -68,14 +73,26 @@ void
 clean_up (void)
 {
   Log_verbose (" - Cleaning up memory and files before exit\n");
-  free (grid);
+  clean_up_acceleration ();
+  clean_up_solver ();
+  clean_up_opacity_cache ();
+  clean_up_tau_summation ();
+  free_1d_grid ();
+  profile_start (PHASE_OUTPUT);
   close_outfile ();
+  profile_stop (PHASE_OUTPUT);
+  write_profile ();
   close_parameter_file ();
 
   if (modes.low_temp)
   {
     clean_up_opac_tables ();
-    clean_up_gsl ();
+    clean_up_interp_2d ();
+  }
+  else if (modes.opal)
+  {
+    clean_up_opal_slice ();
+    clean_up_opal_tables ();
   }
 
   close_logfile ();
@@ -146,3 +163,76 @@ Log_error (char *fmt, ...)
   vfprintf (LOGFILE, fmt, arg_list);
   va_end (arg_list);
 }
+
+/*
+ * The counting wrappers for the heap allocation functions, which are used in
+ * place of them in a DEBUG build. The macros from snake.h are removed here so
+ * the wrappers can call the real functions
+ */
+
+#ifdef DEBUG
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef posix_memalign
+
+long n_heap_allocations;
+
+// Count one heap allocation, which can be made from any thread
+void
+count_heap_allocation (void)
+{
+  #ifdef _OPENMP
+    #pragma omp atomic
+  #endif
+  n_heap_allocations++;
+}
+
+// Return the number of heap allocations made so far
+long
+count_heap_allocations (void)
+{
+  long n;
+
+  #ifdef _OPENMP
+    #pragma omp atomic read
+  #endif
+  n = n_heap_allocations;
+
+  return n;
+}
+
+// Count a call of malloc
+void *
+debug_malloc (size_t size)
+{
+  count_heap_allocation ();
+  return malloc (size);
+}
+
+// Count a call of calloc
+void *
+debug_calloc (size_t n, size_t size)
+{
+  count_heap_allocation ();
+  return calloc (n, size);
+}
+
+// Count a call of realloc
+void *
+debug_realloc (void *ptr, size_t size)
+{
+  count_heap_allocation ();
+  return realloc (ptr, size);
+}
+
+// Count a call of posix_memalign
+int
+debug_posix_memalign (void **ptr, size_t alignment, size_t size)
+{
+  count_heap_allocation ();
+  return posix_memalign (ptr, alignment, size);
+}
+
+#endif
@@ -0,0 +1,680 @@
+/* ***************************************************************************
+ *
+ * @file snake_mktable.c
+ *
+ * @author E. J. Parkinson
+ *
+ * @date 18 Oct 2026
+ *
+ * @brief Create 2D opacity tables by splicing the LA08 low temperature tables
+ *        onto the Opal tables.
+ *
+ * @details
+ *
+ * Usage: snake-mktable [-X x1,x2,...] [-Z z1,z2,...] [-logT min,max,n]
+ *                      [-logR min,max,n] [-splice logT_lo,logT_hi]
+ *                      [-format text|binary|both] [-o name]
+ *                      [-la08 la08_opac.dat] [-la08_sets la08_sets.dat]
+ *
+ * A table is made for every combination of X and Z, on a uniform lattice of n
+ * values of logT and logR. Below logT_lo the opacity is taken from the LA08
+ * tables and above logT_hi from Opal, and in between the two are blended
+ * smoothly in log(kappa). If logT_lo = logT_hi, the tables are spliced without
+ * blending, as create_opacity_table.py does.
+ *
+ * The LA08 tables are only available for a few compositions, so the LA08
+ * opacity for X and Z is interpolated linearly in X and log(Z) between the
+ * tables with the nearest compositions, and then bicubically in logT and logR.
+ * Opal is evaluated using the C port in opal.c, so every point of every table
+ * can be evaluated in parallel with OpenMP. Where Opal has no data, i.e. at
+ * high T and R, the opacity is set to 9.999 as before. The Opal tables, GN93hz,
+ * are required to be in the working directory.
+ *
+ * Each table is written to name.dat and/or name.bin, in the text format of
+ * create_opacity_table.py or the binary format described in gsl_interp.h.
+ * When more than one composition is made, the composition is added to the
+ * name, i.e. name_X0.7_Z0.02.dat.
+ *
+ * ************************************************************************** */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../src/gsl_interp.h"
+#include "../src/interp_2d.h"
+#include "../src/opal.h"
+#include "../src/snake.h"
+
+#define MAX_COMPOSITIONS 64
+#define NO_DATA 9.999
+#define OPAL_NO_DATA 9.0
+
+/*
+ * The LA08 tables. Each table has LA08_N_LOG_T rows of logT and LA08_N_LOG_R
+ * columns of logR, from LA08_MIN_LOG_R in steps of LA08_D_LOG_R. Only the
+ * tables without any enhancement of C, N or O are kept
+ */
+
+#define LA08_N_LOG_T 18
+#define LA08_N_LOG_R 17
+#define LA08_MIN_LOG_R -7.0
+#define LA08_D_LOG_R 0.5
+#define LA08_LINE_LEN 1024
+
+typedef struct La08Tables
+{
+  int n_tables;
+  double *X, *Z;
+  double logT[LA08_N_LOG_T];
+  double logR[LA08_N_LOG_R];
+  double *logk;
+} La08Tables;
+
+/*
+ * The options for the tables to make
+ */
+
+typedef struct MktableOptions
+{
+  int n_X, n_Z;
+  double X[MAX_COMPOSITIONS], Z[MAX_COMPOSITIONS];
+  double logT_min, logT_max, logR_min, logR_max;
+  int n_logT, n_logR;
+  double splice_lo, splice_hi;
+  int text, binary;
+  char name[LINE_LEN];
+  char la08_opac[LINE_LEN], la08_sets[LINE_LEN];
+} MktableOptions;
+
+// Print how to use snake-mktable
+void
+mktable_usage (void)
+{
+  printf ("Usage: snake-mktable [-X x1,x2,...] [-Z z1,z2,...] [-logT min,max,n] [-logR min,max,n]\n"
+          "                     [-splice logT_lo,logT_hi] [-format text|binary|both] [-o name]\n"
+          "                     [-la08 la08_opac.dat] [-la08_sets la08_sets.dat]\n");
+}
+
+// Allocate zeroed memory, exiting if it can not be allocated
+void *
+mktable_calloc (size_t n, size_t size)
+{
+  void *ptr;
+
+  if (!(ptr = calloc (n, size)))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for the opacity tables\n");
+
+  return ptr;
+}
+
+// Parse a comma separated list of at most max_values numbers. Returns the
+// number of values, or 0 if the list is invalid
+int
+parse_list (char *list, double *values, int max_values)
+{
+  int n = 0;
+  char *token, *end;
+
+  for (token = strtok (list, ","); token; token = strtok (NULL, ","))
+  {
+    if (n == max_values)
+      return 0;
+    values[n++] = strtod (token, &end);
+    if (end == token || *end != '\0')
+      return 0;
+  }
+
+  return n;
+}
+
+// Parse the command line options. Exits if they are invalid
+void
+parse_mktable_options (int argc, char **argv, MktableOptions *opts)
+{
+  int i;
+  double range[3];
+
+  opts->n_X = opts->n_Z = 1;
+  opts->X[0] = 0.7;
+  opts->Z[0] = 0.02;
+  opts->logT_min = 3.2;
+  opts->logT_max = 8.7;
+  opts->n_logT = 111;
+  opts->logR_min = -7.0;
+  opts->logR_max = 1.0;
+  opts->n_logR = 17;
+  opts->splice_lo = 3.8;
+  opts->splice_hi = 4.0;
+  opts->text = TRUE;
+  opts->binary = FALSE;
+  strcpy (opts->name, "opacity");
+  strcpy (opts->la08_opac, "data/la08_opac.dat");
+  strcpy (opts->la08_sets, "data/la08_sets.dat");
+
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp (argv[i], "-h") || !strcmp (argv[i], "--help"))
+    {
+      mktable_usage ();
+      exit (SUCCESS);
+    }
+    if (i + 1 == argc)
+    {
+      mktable_usage ();
+      Exit (INVALID_VALUE, "No value given for option %s\n", argv[i]);
+    }
+
+    if (!strcmp (argv[i], "-X"))
+    {
+      if (!(opts->n_X = parse_list (argv[++i], opts->X, MAX_COMPOSITIONS)))
+        Exit (INVALID_VALUE, "Invalid list of X values\n");
+    }
+    else if (!strcmp (argv[i], "-Z"))
+    {
+      if (!(opts->n_Z = parse_list (argv[++i], opts->Z, MAX_COMPOSITIONS)))
+        Exit (INVALID_VALUE, "Invalid list of Z values\n");
+    }
+    else if (!strcmp (argv[i], "-logT") || !strcmp (argv[i], "-logR"))
+    {
+      if (parse_list (argv[i + 1], range, 3) != 3 || range[1] <= range[0] || range[2] < 2 ||
+          range[2] != floor (range[2]))
+        Exit (INVALID_VALUE, "Invalid range for %s, it should be min,max,n with max > min and n >= 2\n", argv[i]);
+      if (!strcmp (argv[i++], "-logT"))
+      {
+        opts->logT_min = range[0];
+        opts->logT_max = range[1];
+        opts->n_logT = (int) range[2];
+      }
+      else
+      {
+        opts->logR_min = range[0];
+        opts->logR_max = range[1];
+        opts->n_logR = (int) range[2];
+      }
+    }
+    else if (!strcmp (argv[i], "-splice"))
+    {
+      if (parse_list (argv[++i], range, 2) != 2 || range[1] < range[0])
+        Exit (INVALID_VALUE, "Invalid splice range, it should be logT_lo,logT_hi with logT_hi >= logT_lo\n");
+      opts->splice_lo = range[0];
+      opts->splice_hi = range[1];
+    }
+    else if (!strcmp (argv[i], "-format"))
+    {
+      i++;
+      opts->text = !strcmp (argv[i], "text") || !strcmp (argv[i], "both");
+      opts->binary = !strcmp (argv[i], "binary") || !strcmp (argv[i], "both");
+      if (!opts->text && !opts->binary)
+        Exit (INVALID_VALUE, "Unknown format %s. Allowed: text, binary or both\n", argv[i]);
+    }
+    else if (!strcmp (argv[i], "-o") || !strcmp (argv[i], "-la08") || !strcmp (argv[i], "-la08_sets"))
+    {
+      if (strlen (argv[i + 1]) >= LINE_LEN - 32)
+        Exit (INVALID_VALUE, "The value for %s is too long\n", argv[i]);
+      if (!strcmp (argv[i], "-o"))
+        strcpy (opts->name, argv[i + 1]);
+      else if (!strcmp (argv[i], "-la08"))
+        strcpy (opts->la08_opac, argv[i + 1]);
+      else
+        strcpy (opts->la08_sets, argv[i + 1]);
+      i++;
+    }
+    else
+    {
+      mktable_usage ();
+      Exit (INVALID_VALUE, "Unknown option %s\n", argv[i]);
+    }
+  }
+}
+
+// Read in the LA08 tables which have no enhancement of C, N or O, along with
+// their composition
+void
+read_la08_tables (char *opac_path, char *sets_path, La08Tables *la08)
+{
+  int i, j, set, line_num = 0, n_alloc = 0;
+  long table;
+  char line[LA08_LINE_LEN], label[LINE_LEN], *p, *end;
+  double X, Y, Z, ratio, enhance[3], logT;
+  long *keep = NULL;
+  FILE *file;
+
+  /*
+   * The sets file lists the composition of each table in la08_opac.dat, in the
+   * same order as the tables
+   */
+
+  if (!(file = fopen (sets_path, "r")))
+    Exit (FILE_OPEN_ERR, "Unable to open LA08 sets file %s\n", sets_path);
+
+  la08->n_tables = 0;
+  table = 0;
+  while (fgets (line, LA08_LINE_LEN, file) != NULL)
+  {
+    line_num++;
+    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
+      continue;
+    if (sscanf (line, "%127s %i %lf %lf %lf %lf %lf %lf %lf", label, &set, &X, &Y, &Z, &ratio, &enhance[0],
+                &enhance[1], &enhance[2]) != 9)
+      Exit (FILE_IN_ERR, "Syntax error on line %i in LA08 sets file %s\n", line_num, sets_path);
+
+    if (enhance[0] == 1.0 && enhance[1] == 1.0 && enhance[2] == 1.0)
+    {
+      if (la08->n_tables == n_alloc)
+      {
+        n_alloc = n_alloc ? 2 * n_alloc : 64;
+        if (!(la08->X = realloc (la08->X, n_alloc * sizeof (*la08->X))) ||
+            !(la08->Z = realloc (la08->Z, n_alloc * sizeof (*la08->Z))) ||
+            !(keep = realloc (keep, n_alloc * sizeof (*keep))))
+          Exit (MEM_ALLOC_ERR, "Unable to allocate memory for LA08 tables\n");
+      }
+      la08->X[la08->n_tables] = X;
+      la08->Z[la08->n_tables] = Z;
+      keep[la08->n_tables++] = table;
+    }
+    table++;
+  }
+
+  if (fclose (file))
+    Exit (FILE_CLOSE_ERR, "Unable to close LA08 sets file %s\n", sets_path);
+  if (!la08->n_tables)
+    Exit (INVALID_TABLE, "No LA08 tables without enhancements in %s\n", sets_path);
+
+  if (!(la08->logk = calloc ((size_t) la08->n_tables * LA08_N_LOG_T * LA08_N_LOG_R, sizeof (*la08->logk))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for LA08 tables\n");
+
+  for (j = 0; j < LA08_N_LOG_R; j++)
+    la08->logR[j] = LA08_MIN_LOG_R + j * LA08_D_LOG_R;
+
+  /*
+   * Each line of la08_opac.dat is the set label, the set number, logT and then
+   * log(kappa) for each logR. Only the lines of the tables which are kept are
+   * read
+   */
+
+  if (!(file = fopen (opac_path, "r")))
+    Exit (FILE_OPEN_ERR, "Unable to open LA08 opacity file %s\n", opac_path);
+
+  line_num = 0;
+  set = 0;
+  while (fgets (line, LA08_LINE_LEN, file) != NULL && set < la08->n_tables)
+  {
+    table = line_num / LA08_N_LOG_T;
+    i = line_num % LA08_N_LOG_T;
+    line_num++;
+    if (table != keep[set])
+      continue;
+
+    if (sscanf (line, "%127s %*i %lf", label, &logT) != 2 || !(p = strstr (line, label)))
+      Exit (FILE_IN_ERR, "Syntax error on line %i in LA08 opacity file %s\n", line_num, opac_path);
+    strtol (p + strlen (label), &end, 10);
+    strtod (end, &p);
+
+    if (set == 0)
+      la08->logT[i] = logT;
+    else if (fabs (logT - la08->logT[i]) > 1e-6)
+      Exit (INVALID_TABLE, "logT on line %i of %s does not match the first table\n", line_num, opac_path);
+
+    for (j = 0; j < LA08_N_LOG_R; j++)
+    {
+      la08->logk[((long) set * LA08_N_LOG_T + i) * LA08_N_LOG_R + j] = strtod (p, &end);
+      if (end == p)
+        Exit (FILE_IN_ERR, "Line %i of LA08 opacity file %s is too short\n", line_num, opac_path);
+      p = end;
+    }
+
+    if (i == LA08_N_LOG_T - 1)
+      set++;
+  }
+
+  if (fclose (file))
+    Exit (FILE_CLOSE_ERR, "Unable to close LA08 opacity file %s\n", opac_path);
+  if (set != la08->n_tables)
+    Exit (FILE_IN_ERR, "LA08 opacity file %s has fewer tables than %s\n", opac_path, sets_path);
+
+  free (keep);
+  Log (" - Read %i LA08 tables from %s\n", la08->n_tables, opac_path);
+}
+
+// Find the two values of v in the unique, sorted list of values which bracket
+// x, and the weight of the upper value. Returns FAILURE if x is outside of the
+// values
+int
+bracket_value (const double *values, int n, double x, double *lo, double *hi, double *weight)
+{
+  int i;
+
+  if (x < values[0] * (1.0 - 1e-9) || x > values[n - 1] * (1.0 + 1e-9))
+    return FAILURE;
+
+  for (i = 0; i < n - 2 && x > values[i + 1]; i++)
+    ;
+
+  *lo = values[i];
+  *hi = values[i + 1];
+  *weight = (x - *lo) / (*hi - *lo);
+  if (*weight < 0.0)
+    *weight = 0.0;
+  if (*weight > 1.0)
+    *weight = 1.0;
+
+  return SUCCESS;
+}
+
+// Find the index of the LA08 table for X and Z. Returns -1 if there is no
+// such table
+int
+find_la08_table (const La08Tables *la08, double X, double Z)
+{
+  int i;
+
+  for (i = 0; i < la08->n_tables; i++)
+    if (fabs (la08->X[i] - X) < 1e-6 && fabs (la08->Z[i] - Z) < 1e-9)
+      return i;
+
+  return -1;
+}
+
+// Add value to the sorted list of unique values, if it is not already in it
+void
+add_unique_value (double *values, int *n, double value)
+{
+  int i, j;
+
+  for (i = 0; i < *n && values[i] < value; i++)
+    ;
+  if (i < *n && fabs (values[i] - value) < 1e-12)
+    return;
+  for (j = *n; j > i; j--)
+    values[j] = values[j - 1];
+  values[i] = value;
+  (*n)++;
+}
+
+// Make the LA08 table for X and Z, by interpolating linearly in X and log(Z)
+// between the four nearest tables
+void
+la08_composition (const La08Tables *la08, double X, double Z, double *logk)
+{
+  int i, j, n_X = 0, n_Z = 0, idx[4];
+  double *X_values, *Z_values, w[4], X_lo, X_hi, wX, Z_lo, Z_hi, wZ, logZ_lo, logZ_hi;
+  size_t n = LA08_N_LOG_T * LA08_N_LOG_R;
+
+  if (!(X_values = calloc (la08->n_tables, sizeof (*X_values))) ||
+      !(Z_values = calloc (la08->n_tables, sizeof (*Z_values))))
+    Exit (MEM_ALLOC_ERR, "Unable to allocate memory for LA08 compositions\n");
+
+  for (i = 0; i < la08->n_tables; i++)
+  {
+    add_unique_value (X_values, &n_X, la08->X[i]);
+    add_unique_value (Z_values, &n_Z, la08->Z[i]);
+  }
+
+  if (n_X < 2 || n_Z < 2 || bracket_value (X_values, n_X, X, &X_lo, &X_hi, &wX) ||
+      bracket_value (Z_values, n_Z, Z, &Z_lo, &Z_hi, &wZ))
+    Exit (INVALID_VALUE, "X = %g and Z = %g are outside of the LA08 tables, %g <= X <= %g and %g <= Z <= %g\n", X, Z,
+          X_values[0], X_values[n_X - 1], Z_values[0], Z_values[n_Z - 1]);
+
+  /*
+   * The weight in Z is found in log(Z), as the tables are spaced roughly
+   * logarithmically in Z
+   */
+
+  logZ_lo = log10 (Z_lo);
+  logZ_hi = log10 (Z_hi);
+  wZ = (log10 (Z) - logZ_lo) / (logZ_hi - logZ_lo);
+  wZ = wZ < 0.0 ? 0.0 : (wZ > 1.0 ? 1.0 : wZ);
+
+  idx[0] = find_la08_table (la08, X_lo, Z_lo);
+  idx[1] = find_la08_table (la08, X_hi, Z_lo);
+  idx[2] = find_la08_table (la08, X_lo, Z_hi);
+  idx[3] = find_la08_table (la08, X_hi, Z_hi);
+  w[0] = (1.0 - wX) * (1.0 - wZ);
+  w[1] = wX * (1.0 - wZ);
+  w[2] = (1.0 - wX) * wZ;
+  w[3] = wX * wZ;
+
+  for (j = 0; j < 4; j++)
+    if (idx[j] < 0)
+      Exit (INVALID_TABLE, "No LA08 table for the compositions around X = %g and Z = %g\n", X, Z);
+
+  for (i = 0; i < (int) n; i++)
+  {
+    logk[i] = 0.0;
+    for (j = 0; j < 4; j++)
+      if (w[j] > 0.0)
+        logk[i] += w[j] * la08->logk[idx[j] * n + i];
+  }
+
+  free (X_values);
+  free (Z_values);
+}
+
+// The weight given to Opal at logT, which is 0 below the splice and 1 above it,
+// and changes smoothly between the two
+double
+splice_weight (const MktableOptions *opts, double logT)
+{
+  double x;
+
+  if (logT < opts->splice_lo)
+    return 0.0;
+  if (logT >= opts->splice_hi)
+    return 1.0;
+
+  x = (logT - opts->splice_lo) / (opts->splice_hi - opts->splice_lo);
+
+  return x * x * (3.0 - 2.0 * x);
+}
+
+// Check that every point of the lattice is covered by the tables which are
+// used for it
+void
+check_lattice (const MktableOptions *opts, const La08Tables *la08)
+{
+  if (opts->logT_min < opts->splice_hi &&
+      (opts->logT_min < la08->logT[0] - 1e-9 || opts->logR_min < la08->logR[0] - 1e-9 ||
+       opts->logR_max > la08->logR[LA08_N_LOG_R - 1] + 1e-9))
+    Exit (INVALID_VALUE, "The LA08 tables only cover %g <= logT and %g <= logR <= %g\n", la08->logT[0],
+          la08->logR[0], la08->logR[LA08_N_LOG_R - 1]);
+
+  if (opts->splice_lo < opts->logT_max && opts->splice_lo > la08->logT[LA08_N_LOG_T - 1] + 1e-9)
+    Exit (INVALID_VALUE, "The splice must start below logT = %g, where the LA08 tables end\n",
+          la08->logT[LA08_N_LOG_T - 1]);
+
+  if (opts->logT_max > opts->splice_lo &&
+      (opts->splice_hi < OP_MIN_LOG_T - 1e-9 || opts->logT_max > OP_MAX_LOG_T + 1e-9 ||
+       opts->logR_min < OP_MIN_LOG_R - 1e-9 || opts->logR_max > OP_MAX_LOG_R + 1e-9))
+    Exit (INVALID_VALUE, "The Opal tables only cover %g <= logT <= %g and %g <= logR <= %g\n", OP_MIN_LOG_T,
+          OP_MAX_LOG_T, OP_MIN_LOG_R, OP_MAX_LOG_R);
+}
+
+// Find the spliced opacity at logT and logR for the composition X and Z, where
+// la08 is the LA08 table for the composition. Returns NO_DATA if Opal is
+// required but has no data
+double
+spliced_opacity (const MktableOptions *opts, const Interp2D *la08, OpalState *state, double X, double Z,
+                 double logT, double logR)
+{
+  double w, logk_la08 = 0.0;
+  OpalOpacity opacity;
+
+  w = splice_weight (opts, logT);
+
+  if (w < 1.0)
+    logk_la08 = interp2d_eval (la08, logR, logT);
+  if (w == 0.0)
+    return logk_la08;
+
+  if (opal_opacity (opal_tables, state, Z, X, pow (10.0, logT - 6.0), pow (10.0, logR), &opacity) != OPAL_OK ||
+      opacity.opact > OPAL_NO_DATA)
+    return NO_DATA;
+
+  return (1.0 - w) * logk_la08 + w * opacity.opact;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i, j, c, n_comp, n_points, n_no_data = 0, ok = TRUE;
+  long p, n_total;
+  double *logT, *logR, *logk, *la08_logk, *X, *Z;
+  char name[2 * LINE_LEN];
+  struct timespec start_time;
+  La08Tables la08;
+  Interp2D *la08_interp;
+  MktableOptions opts;
+
+  strcpy (OUTPUT_PREFIX, "snake_mktable_");
+  INIT_LOGFILE = TRUE;
+  VERBOSITY = FALSE;
+
+  memset (&la08, 0, sizeof (la08));
+  parse_mktable_options (argc, argv, &opts);
+
+  n_comp = opts.n_X * opts.n_Z;
+  n_points = opts.n_logT * opts.n_logR;
+  n_total = (long) n_comp * n_points;
+
+  logT = mktable_calloc (opts.n_logT, sizeof (*logT));
+  logR = mktable_calloc (opts.n_logR, sizeof (*logR));
+  logk = mktable_calloc (n_total, sizeof (*logk));
+  X = mktable_calloc (n_comp, sizeof (*X));
+  Z = mktable_calloc (n_comp, sizeof (*Z));
+  la08_interp = mktable_calloc (n_comp, sizeof (*la08_interp));
+  la08_logk = mktable_calloc ((size_t) n_comp * LA08_N_LOG_T * LA08_N_LOG_R, sizeof (*la08_logk));
+
+  for (i = 0; i < opts.n_logT; i++)
+    logT[i] = opts.logT_min + i * (opts.logT_max - opts.logT_min) / (opts.n_logT - 1);
+  for (j = 0; j < opts.n_logR; j++)
+    logR[j] = opts.logR_min + j * (opts.logR_max - opts.logR_min) / (opts.n_logR - 1);
+
+  for (c = 0; c < n_comp; c++)
+  {
+    X[c] = opts.X[c / opts.n_Z];
+    Z[c] = opts.Z[c % opts.n_Z];
+    if (X[c] < 0.0 || Z[c] < 0.0 || X[c] + Z[c] > 1.0)
+      Exit (INVALID_VALUE, "Invalid composition X = %g and Z = %g, X + Z <= 1\n", X[c], Z[c]);
+  }
+
+  /*
+   * Read in the tables. The LA08 table for each composition is made before the
+   * tables are evaluated
+   */
+
+  read_la08_tables (opts.la08_opac, opts.la08_sets, &la08);
+  check_lattice (&opts, &la08);
+
+  if (opts.logT_max > opts.splice_lo)
+    load_opacity_table (OPAL_FILENAME);
+
+  if (opts.logT_min < opts.splice_hi)
+  {
+    for (c = 0; c < n_comp; c++)
+    {
+      la08_composition (&la08, X[c], Z[c], &la08_logk[c * LA08_N_LOG_T * LA08_N_LOG_R]);
+      interp2d_init (&la08_interp[c], INTERP_BICUBIC, la08.logR, LA08_N_LOG_R, la08.logT, LA08_N_LOG_T,
+                     &la08_logk[c * LA08_N_LOG_T * LA08_N_LOG_R]);
+    }
+  }
+
+  Log (" - Making %i tables of %i logT x %i logR, spliced between logT = %g and %g\n", n_comp, opts.n_logT,
+       opts.n_logR, opts.splice_lo, opts.splice_hi);
+
+  /*
+   * Every point of every table is independent, so they are all evaluated in a
+   * single parallel loop. Each thread has its own Opal state
+   */
+
+  start_time = get_time ();
+
+  #ifdef _OPENMP
+    #pragma omp parallel reduction(+:n_no_data)
+  #endif
+  {
+    int pc, pi, pj;
+    OpalState state;
+
+    #ifdef _OPENMP
+      #pragma omp for schedule(dynamic, 64)
+    #endif
+    for (p = 0; p < n_total; p++)
+    {
+      pc = (int) (p / n_points);
+      pi = (int) ((p % n_points) / opts.n_logR);
+      pj = (int) (p % opts.n_logR);
+      logk[p] = spliced_opacity (&opts, &la08_interp[pc], &state, X[pc], Z[pc], logT[pi], logR[pj]);
+      if (logk[p] == NO_DATA)
+        n_no_data++;
+    }
+  }
+
+  Log (" - Evaluated %li points in %f seconds\n", n_total, time_difference (start_time, get_time ()));
+  if (n_no_data)
+    Log (" - %i points are outside of the Opal tables and have been set to %.3f\n", n_no_data, NO_DATA);
+
+  /*
+   * Write out each of the tables
+   */
+
+  for (c = 0; c < n_comp; c++)
+  {
+    if (opts.text)
+    {
+      if (n_comp == 1)
+        snprintf (name, 2 * LINE_LEN, "%s.dat", opts.name);
+      else
+        snprintf (name, 2 * LINE_LEN, "%s_X%g_Z%g.dat", opts.name, X[c], Z[c]);
+      if (write_2d_opact_table_text (name, logT, opts.n_logT, logR, opts.n_logR, &logk[(long) c * n_points]))
+      {
+        ok = FALSE;
+        Log (" - Unable to write %s\n", name);
+      }
+      else
+      {
+        Log (" - Wrote X = %g Z = %g to %s\n", X[c], Z[c], name);
+      }
+    }
+
+    if (opts.binary)
+    {
+      if (n_comp == 1)
+        snprintf (name, 2 * LINE_LEN, "%s.bin", opts.name);
+      else
+        snprintf (name, 2 * LINE_LEN, "%s_X%g_Z%g.bin", opts.name, X[c], Z[c]);
+      if (write_2d_opact_table_binary (name, logT, opts.n_logT, logR, opts.n_logR, &logk[(long) c * n_points], X[c],
+                                       Z[c]))
+      {
+        ok = FALSE;
+        Log (" - Unable to write %s\n", name);
+      }
+      else
+      {
+        Log (" - Wrote X = %g Z = %g to %s\n", X[c], Z[c], name);
+      }
+    }
+  }
+
+  if (opts.logT_min < opts.splice_hi)
+    for (c = 0; c < n_comp; c++)
+      interp2d_free (&la08_interp[c]);
+
+  free (la08.X);
+  free (la08.Z);
+  free (la08.logk);
+  free (la08_interp);
+  free (la08_logk);
+  free (logT);
+  free (logR);
+  free (logk);
+  free (X);
+  free (Z);
+
+  return ok ? SUCCESS : FAILURE;
+}